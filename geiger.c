@@ -7,35 +7,281 @@
  * This code is under GNU GPLv3.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <assert.h>
 #include <errno.h>
+#include <semaphore.h>
 #include <signal.h>
+#include <spawn.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+
+#include <sys/wait.h>
 
 #include <portaudio.h>
 
+#include "peakdetector/channels.h"
+#include "peakdetector/detector_c1.h"
+#include "peakdetector/eventlog.h"
+#include "peakdetector/eventsink.h"
+#include "peakdetector/livestats.h"
+#include "peakdetector/metrics.h"
+#include "peakdetector/ratealarm.h"
+#include "peakdetector/ratemeter.h"
+
+
+/* The sample rate (-r) and the frames per buffer (-f) are requested from
+   the devices; the rate actually negotiated by the first stream is then
+   used for all the times. */
+#define DEFAULT_SAMPLE_RATE (44100)
+
+static uint32_t sample_rate = DEFAULT_SAMPLE_RATE;
+
+/* With several channels (-c), one tube per channel: the callback splits the
+   frames by chunks of CHANNEL_CHUNK into a buffer per channel, each one
+   analysed by its own detector. */
+#define CHANNEL_CHUNK (1024)
+
+/* Sample formats of the devices (-s). The detectors work on the samples as
+   they come, but the threshold stays on the scale of 16-bit samples. */
+static const struct {
+	const char *name;
+	PaSampleFormat pa;
+	enum sample_format format;
+} sampleformats[] = {
+	{ "int8", paInt8, SAMPLE_INT8 },
+	{ "int16", paInt16, SAMPLE_INT16 },
+	{ "int24", paInt24, SAMPLE_INT24 },
+	{ "int32", paInt32, SAMPLE_INT32 },
+	{ "float", paFloat32, SAMPLE_FLOAT },
+};
+#define NB_SAMPLEFORMATS (sizeof sampleformats / sizeof sampleformats[0])
+
+/* Input streams requested from all the devices */
+struct streamconf {
+	unsigned channels;
+	PaSampleFormat format;
+	double sample_rate;
+	unsigned long frames;   /* per buffer (paFramesPerBufferUnspecified:
+				   chosen by the host) */
+};
+
+/* Several sound cards (-d) can be used at once, one tube per channel of each
+   one. The main thread merges their peaks in order, but waits at most
+   MERGE_DELAY seconds for a device late or stalled. */
+#define MAX_DEVICES (8)
+#define MERGE_DELAY (2)
+
+/* Count rates: displayed every RATE_REPORT seconds over each window, from a
+   rate meter with bins of RATE_BIN seconds. */
+#define RATE_BIN (1)
+#define RATE_REPORT (10)
+#define MAX_WINDOWS (8)
+#define MAX_WINDOW (7 * 86400) /* seconds, one bin of memory per second */
+
+/* Alarm on a rise of the count rate, see peakdetector/ratealarm.h */
+#define DEFAULT_FALSE_ALARM (30 * 86400) /* seconds between false alarms */
+#define ALARM_LEARNING (60)   /* seconds measuring the background rate */
+#define EXIT_ALARM (2)
+
+
+/* Lock-free handoff of the detected peaks.
+   The audio callback runs on a real-time thread: it must neither block nor
+   call stdio. It pushes the peaks into a single-producer single-consumer
+   ring, one per device, which is drained by the main thread. The semaphore,
+   shared by the rings of all the devices, wakes the main thread up as soon
+   as new peaks are available, or when the peaks of another device wait for
+   this one (sem_post() never blocks and is futex-based on Linux). If the
+   ring is full, peaks are dropped and accounted for in 'lost'. */
+
+#define RING_SIZE (4096) /* must be a power of 2 */
+
+struct peakring {
+	_Alignas(64) atomic_size_t head; /* written by the audio callback */
+	_Alignas(64) atomic_size_t tail; /* written by the consumer */
+	atomic_uint_fast64_t lost;
+	sem_t *wakeup;
+	struct event peaks[RING_SIZE];
+};
+
+static void
+ring_init(struct peakring *ring, sem_t *wakeup)
+{
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	atomic_init(&ring->lost, 0);
+	ring->wakeup = wakeup;
+}
+
+static void
+ring_push(struct peakring *ring, uint64_t spl, int32_t amplitude,
+	  uint32_t channel)
+{
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	if (head - tail == RING_SIZE) {
+		atomic_fetch_add_explicit(&ring->lost, 1, memory_order_relaxed);
+		return;
+	}
+	struct event *p = &ring->peaks[head & (RING_SIZE - 1)];
+	p->spl = spl;
+	p->amplitude = amplitude;
+	p->channel = channel;
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/* Wait at most timeout_ms for new peaks. Returns early on a signal. */
+static void
+ring_wait(sem_t *wakeup, long timeout_ms)
+{
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+	sem_timedwait(wakeup, &deadline);
+}
+
 
-#define SAMPLE_RATE (44100)
+/* An input device, with one tube per channel. An instance of this structure
+   is used with the callback function that processes the audio input of the
+   device: each device has its own detectors and ring. The fields updated by
+   the callback and read by the main thread are atomic. */
+struct device {
+	PaDeviceIndex index;
+	PaStream *stream;
+	unsigned channels;
+	unsigned first_tube;    /* tube of channel 0 */
+	struct detector *detectors[MAX_CHANNELS]; /* C1, one per channel,
+						     sending the peaks to the
+						     ring */
+	struct eventsink *ringsinks[MAX_CHANNELS];
+	double sample_rate;     /* negotiated with the host */
+	PaTime latency;         /* of the input, as reported by the host */
+	size_t width;           /* size of a sample */
+	unsigned char *planes;  /* CHANNEL_CHUNK samples of each channel, one
+				   channel after the other */
+	uint64_t offset;        /* time of the first sample, in samples since
+				   the start of the streams */
+	atomic_bool started;    /* offset is set */
+	atomic_uint_fast64_t sample_number; /* count the number of samples
+					       (= time, in 1/sample_rate s) */
+	atomic_uint_fast64_t complete; /* the peaks before this sample (on
+					  the common timeline) are all in the
+					  ring */
+	struct callbackstats stats; /* cost of the callbacks, overflows */
+	/* Where the device is on the clock: sample anchor_spl (on the common
+	   timeline) was captured at anchor_ns (CLOCK_MONOTONIC). Updated by
+	   each callback under the sequence lock anchor_seq, odd during an
+	   update, for the latency of the peaks. */
+	atomic_uint anchor_seq;
+	atomic_uint_fast64_t anchor_spl;
+	atomic_uint_fast64_t anchor_ns;
+	struct peakring ring;   /* peaks detected by the callback */
+};
+
+/* Ring sink: the sink of the detector of a channel, on the audio thread,
+   pushes the peaks into the ring of the device, with their tube and their
+   time since the start of the streams. The callback wakes the main thread
+   up once all the detectors are done with the buffer. */
+
+struct eventsinkdata {
+	struct device *dev;
+	uint32_t tube;
+};
+
+static void
+ringsink_write(const struct event *ev, size_t nb, struct eventsinkdata *data)
+{
+	struct device *dev = data->dev;
+	for (size_t i = 0; i < nb; i++)
+		ring_push(&dev->ring, dev->offset + ev[i].spl,
+			  ev[i].amplitude, data->tube);
+}
+
+static void
+ringsink_flush(struct eventsinkdata *data)
+{
+}
+
+static int
+terminate_ringsink(struct eventsink *sink)
+{
+	assert(sink != NULL);
+	assert(sink->data != NULL);
+	free(sink->data);
+	free(sink);
+	return 0;
+}
+
+static struct eventsink*
+init_ringsink(struct device *dev, uint32_t tube)
+{
+	struct eventsink *sink = calloc(1, sizeof(struct eventsink));
+	if (sink == NULL)
+		return NULL;
+	sink->data = calloc(1, sizeof(struct eventsinkdata));
+	if (sink->data == NULL) {
+		free(sink);
+		return NULL;
+	}
+
+	sink->name = "ring";
+	sink->write = &ringsink_write;
+	sink->flush = &ringsink_flush;
+	sink->terminate = &terminate_ringsink;
+	sink->data->dev = dev;
+	sink->data->tube = tube;
+	return sink;
+}
+
+/* Hand all the pending peaks to the sink (at most two arrays, as the ring
+   wraps around), return the number of peaks. */
+static uint64_t
+ring_drain(struct peakring *ring, struct eventsink *sink)
+{
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	size_t from = tail & (RING_SIZE - 1);
+	size_t nb = head - tail;
+	if (from + nb > RING_SIZE) {
+		sink->write(&ring->peaks[from], RING_SIZE - from, sink->data);
+		nb -= RING_SIZE - from;
+		from = 0;
+	}
+	if (nb)
+		sink->write(&ring->peaks[from], nb, sink->data);
+	atomic_store_explicit(&ring->tail, head, memory_order_release);
+	return head - tail;
+}
 
 
-/* This structure will hold data to and from the counting algorithm.
-   An instance of this structure is used with the callback function
-   that process the audio input. */
+/* This structure will hold the data of the main thread, which merges the
+   peaks of all the devices. */
 struct countdata {
-	PaTime start_time;
-	uint64_t count;
-	int threshold; // detection threshold to filter noise
-	int16_t last_values[2]; /* remember the last values between calls to the
-				   callback fct */
-	PaTime last_spl_time;   /* timestamp for the last sample processed */
-	uint64_t sample_number; /* count the number of samples (= time) */
+	struct device *devices;
+	size_t nb_devices;
+	struct channelmerge *merge; /* orders the peaks of all the tubes */
+	uint64_t merged;        /* the peaks before this sample are passed on
+				   to sink */
+	struct eventsink *sink; /* where the merge sends the peaks */
+	struct ratemeter *rates; /* fed by sink */
+	struct latencystats *latency; /* of the peaks written out */
+	struct ratesnapshot *snapshot; /* for the metrics server, or NULL */
+};
+static const struct countdata init_cd = {
+	NULL, 0, NULL, 0, NULL, NULL, NULL, NULL
 };
-static const struct countdata init_cd = {0.0, 0, 0, {0,0}, 0.0, 0};
 
 
 /* Signal Handling */
@@ -48,44 +294,85 @@ exithandler(int signal)
 	quit = 1;
 }
 
+static volatile sig_atomic_t dump = 0; // statistics asked for by SIGUSR1
 
-/* More or less an extremely crude derivative function... */
-static int8_t
-evolution(int32_t value1, int32_t value2, int threshold)
+static void
+dumphandler(int signal)
 {
-	int32_t ret = (value2 - value1) / threshold;
-	if (ret > INT8_MAX) {
-		ret = INT8_MAX;
-	}
-	if (ret < INT8_MIN) {
-		ret = INT8_MIN;
-	}
-	return (int8_t) ret;
+	dump = 1;
 }
 
 
-/* Naive peak detection (both positive and negative ones).
-   Note that, as this function is called for every value,
-   the call to evolution(a, b, th) is the same as the call
-   to evolution(b, c, th) of the previous call to peakp().
-   This could hence be optimized if needed.
- */
-static bool
-peakp(int16_t a, int16_t b, int16_t c, int th)
+/* Start of the streams (CLOCK_MONOTONIC), set before they are started */
+static double start_time;
+
+/* The merge of the main thread holds peaks until the devices reach them */
+static atomic_bool merge_held;
+
+static double
+monotonic(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Time of the first sample of a device since the start of the streams, in
+   samples: the time of the first callback, minus the time elapsed since
+   the ADC captured the first sample of its buffer. The devices are thus on
+   a common timeline, up to the drift of their clocks (a few tens of ppm). */
+static uint64_t
+first_sample_offset(const PaStreamCallbackTimeInfo *timeInfo, double rate)
+{
+	double t = monotonic();
+	/* not given by all the host APIs */
+	if (timeInfo->inputBufferAdcTime > 0
+	    && timeInfo->currentTime >= timeInfo->inputBufferAdcTime)
+		t -= timeInfo->currentTime - timeInfo->inputBufferAdcTime;
+	t = (t - start_time) * rate;
+	return t > 0 ? (uint64_t) (t + 0.5) : 0;
+}
+
+/* CLOCK_MONOTONIC time, in ns, at which the ADC captured the first sample
+   of the buffer: now minus the age of the buffer given by the host, which
+   is at least the buffer period (the whole buffer was captured). */
+static uint64_t
+buffer_adc_ns(const PaStreamCallbackTimeInfo *timeInfo, uint64_t now,
+	      double period)
 {
-	int8_t le = evolution(a, b, th);
-	int8_t ce = evolution(b, c, th);
+	double age = period;
+	if (timeInfo->inputBufferAdcTime > 0
+	    && timeInfo->currentTime - timeInfo->inputBufferAdcTime > age)
+		age = timeInfo->currentTime - timeInfo->inputBufferAdcTime;
+	return now - (uint64_t) (age * 1e9);
+}
 
-	/* Positive peaks */
-	if (le >= 0 && ce < 0 && b > th)
-		return true;
+static void
+anchor_store(struct device *dev, uint64_t spl, uint64_t ns)
+{
+	unsigned seq = atomic_load_explicit(&dev->anchor_seq,
+					    memory_order_relaxed);
+	atomic_store_explicit(&dev->anchor_seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&dev->anchor_spl, spl, memory_order_relaxed);
+	atomic_store_explicit(&dev->anchor_ns, ns, memory_order_relaxed);
+	atomic_store_explicit(&dev->anchor_seq, seq + 2, memory_order_release);
+}
 
-#if 0
-	/* Negative peaks */
-	if (le <= 0 && ce > 0 && b < -th)
-		return true;
-#endif
-	return false;
+static void
+anchor_load(struct device *dev, uint64_t *spl, uint64_t *ns)
+{
+	unsigned seq;
+	do {
+		seq = atomic_load_explicit(&dev->anchor_seq,
+					   memory_order_acquire);
+		*spl = atomic_load_explicit(&dev->anchor_spl,
+					    memory_order_relaxed);
+		*ns = atomic_load_explicit(&dev->anchor_ns,
+					   memory_order_relaxed);
+		atomic_thread_fence(memory_order_acquire);
+	} while ((seq & 1) || seq != atomic_load_explicit(
+			 &dev->anchor_seq, memory_order_relaxed));
 }
 
 static int
@@ -93,106 +380,404 @@ geiger_callback(const void *input, void *output, unsigned long frameCount,
 		const PaStreamCallbackTimeInfo* timeInfo,
 		PaStreamCallbackFlags status, void *ourData)
 {
-	static bool first = true;
-	struct countdata *data = (struct countdata*) ourData;
-	if (first) {
-		data->start_time = timeInfo->inputBufferAdcTime;
-		first = false;
-	}
+	struct device *data = (struct device*) ourData;
+	struct livestats_clock clk;
+	livestats_now(&clk);
+	const double period = frameCount / data->sample_rate;
 
-	int16_t *in = (int16_t*) input;
+	const unsigned char *in = input;
 	(void) output; /* Prevent unused variable warning. */
-
-	if (status & paInputOverflow)
-		fprintf(stderr, "Warning: input overflow\n");
+	const size_t head = atomic_load_explicit(&data->ring.head,
+						 memory_order_relaxed);
+
+	if (!atomic_load_explicit(&data->started, memory_order_relaxed)) {
+		data->offset = first_sample_offset(timeInfo,
+						   data->sample_rate);
+		atomic_store_explicit(&data->started, true,
+				      memory_order_release);
+	}
+	anchor_store(data, data->offset
+		     + atomic_load_explicit(&data->sample_number,
+					    memory_order_relaxed),
+		     buffer_adc_ns(timeInfo, clk.ns, period));
 
 	// fprintf(stderr, "fC: %lu\n", frameCount);
 
-	int16_t prev0 = data->last_values[0];
-	int16_t prev1 = data->last_values[1];
-	PaTime time = timeInfo->inputBufferAdcTime - data->start_time;
-	for (int i = 0; i < frameCount; i++) {
-		/* The actual sample rate seems to be only an approximation of
-		   SAMPLE_RATE, hence 'time + (double) i / SAMPLE_RATE' is only
-		   an estimation of the sampling time. */
-		if (peakp(prev0, prev1, in[i], data->threshold)) {
-			data->count++;
-			printf("%.4f\t%6d\n", time + (double) i / SAMPLE_RATE,
-			       prev1);
+	/* the peaks go to the ring, see init_ringsink() */
+	if (data->channels == 1) {
+		struct detector *d = data->detectors[0];
+		d->detector(in, frameCount, d->data);
+	} else {
+		void *chbuf[MAX_CHANNELS];
+		for (unsigned c = 0; c < data->channels; c++)
+			chbuf[c] = data->planes + c * CHANNEL_CHUNK
+				* data->width;
+		for (unsigned long f = 0; f < frameCount; f += CHANNEL_CHUNK) {
+			size_t nb = frameCount - f < CHANNEL_CHUNK ?
+				frameCount - f : CHANNEL_CHUNK;
+			deinterleave_samples(in + f * data->channels
+					     * data->width, nb, data->channels,
+					     data->width, chbuf);
+			for (unsigned c = 0; c < data->channels; c++) {
+				struct detector *d = data->detectors[c];
+				d->detector(chbuf[c], nb, d->data);
+			}
 		}
-		prev0 = prev1;
-		prev1 = in[i];
-		data->sample_number++;
 	}
-	data->last_values[0] = prev0;
-	data->last_values[1] = prev1;
-	data->last_spl_time = time + (frameCount - 1.0) / SAMPLE_RATE;
+	/* a detector may report a peak after its sample, once it is over */
+	uint64_t complete = UINT64_MAX;
+	for (unsigned c = 0; c < data->channels; c++) {
+		struct detector *d = data->detectors[c];
+		uint64_t p = d->pending(d->data);
+		if (p < complete)
+			complete = p;
+	}
+	atomic_store(&data->complete, data->offset + complete);
+	atomic_fetch_add_explicit(&data->sample_number, frameCount,
+				  memory_order_release);
+	if (atomic_load_explicit(&data->ring.head, memory_order_relaxed)
+	    != head || atomic_load(&merge_held))
+		sem_post(data->ring.wakeup);
+	callbackstats_add(&data->stats, &clk, frameCount, period,
+			  status & paInputOverflow);
 
 	return 0;
 }
 
 
-/* Rate smoothing over interv_duration seconds. The struct smooth_counter is
-   used with the smooth_rate function. As the smooth_rate display itself the
-   rate every interv_duration period, it doesn't return anything, but we could
-   imagine this function returning the rate. The rate implementation should
-   then probably be modified to use a sliding period. */
-
-struct smooth_counter {
-	const int interv_duration;
-	PaTime interv_start;
-	uint64_t interv_count;
-};
+/* Rates over the windows (in seconds) given with -w, or 10 s, 1 min and
+   1 h by default. */
+static double windows[MAX_WINDOWS] = {10, 60, 3600};
+static size_t nb_windows = 3;
 
-void
-smooth_rate(struct smooth_counter *sc, struct countdata *data)
+static void
+report_rates(struct countdata *data)
 {
-	sc->interv_count += data->count;
-	double duration = data->last_spl_time - sc->interv_start;
-	if (duration >= sc->interv_duration) {
+	for (size_t i = 0; i < nb_windows; i++) {
+		double seconds;
+		double rate = ratemeter_rate(data->rates, windows[i],
+					     &seconds);
 		fprintf(stderr, "current rate over %.1f seconds: %.1f CPM\n",
-			duration, 60 * sc->interv_count / duration);
+			seconds, 60 * rate);
+	}
+}
 
-		sc->interv_count = 0;
-		sc->interv_start = data->last_spl_time;
+/* Cost of the callbacks of each device, and latency of the peaks from the
+   ADC to the output: printed on SIGUSR1, and at the end. */
+static void
+report_stats(struct countdata *data)
+{
+	for (size_t k = 0; k < data->nb_devices; k++) {
+		char name[32];
+		snprintf(name, sizeof name, "device %d",
+			 data->devices[k].index + 1);
+		callbackstats_print(stderr, name, &data->devices[k].stats);
 	}
+	latencystats_print(stderr, "peaks", data->latency);
+}
+
+/* The metrics server (-m) has its own thread, which reads the counters of
+   the devices directly. The rate meter is only used by the main thread: it
+   publishes the rates after each round, under a sequence lock like the
+   anchors of the devices. */
+struct ratesnapshot {
+	atomic_uint seq;
+	atomic_uint_fast64_t total;     /* peaks counted */
+	_Atomic double cpm[MAX_WINDOWS];
+	_Atomic double seconds[MAX_WINDOWS]; /* actually covered */
+};
 
+static void
+publish_rates(struct ratesnapshot *snap, const struct ratemeter *rates)
+{
+	unsigned seq = atomic_load_explicit(&snap->seq, memory_order_relaxed);
+	atomic_store_explicit(&snap->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&snap->total, ratemeter_total(rates),
+			      memory_order_relaxed);
+	for (size_t i = 0; i < nb_windows; i++) {
+		double seconds;
+		double rate = ratemeter_rate(rates, windows[i], &seconds);
+		atomic_store_explicit(&snap->cpm[i], 60 * rate,
+				      memory_order_relaxed);
+		atomic_store_explicit(&snap->seconds[i], seconds,
+				      memory_order_relaxed);
+	}
+	atomic_store_explicit(&snap->seq, seq + 2, memory_order_release);
 }
 
+static uint64_t
+read_rates(struct ratesnapshot *snap, double *cpm, double *seconds)
+{
+	unsigned seq;
+	uint64_t total;
+	do {
+		seq = atomic_load_explicit(&snap->seq, memory_order_acquire);
+		total = atomic_load_explicit(&snap->total,
+					     memory_order_relaxed);
+		for (size_t i = 0; i < nb_windows; i++) {
+			cpm[i] = atomic_load_explicit(&snap->cpm[i],
+						      memory_order_relaxed);
+			seconds[i] = atomic_load_explicit(
+				&snap->seconds[i], memory_order_relaxed);
+		}
+		atomic_thread_fence(memory_order_acquire);
+	} while ((seq & 1) || seq != atomic_load_explicit(
+			 &snap->seq, memory_order_relaxed));
+	return total;
+}
 
+/* Per device metrics */
+enum devmetric {
+	DEV_SAMPLES,
+	DEV_SAMPLE_RATE,
+	DEV_OVERFLOWS,
+	DEV_LOST,
+	DEV_CALLBACKS,
+	DEV_CALLBACK_SECONDS,
+	DEV_CALLBACK_MAX,
+	DEV_CALLBACK_CYCLES,
+	NB_DEVMETRICS
+};
+
+static const struct {
+	const char *name;
+	const char *type;
+	const char *help;
+} devmetrics[NB_DEVMETRICS] = {
+	{ "geiger_samples_total", "counter", "Samples captured" },
+	{ "geiger_sample_rate_hertz", "gauge", "Sample rate of the device" },
+	{ "geiger_input_overflows_total", "counter",
+	  "Input overflows reported by the host" },
+	{ "geiger_peaks_lost_total", "counter",
+	  "Peaks lost because the main thread was late" },
+	{ "geiger_callbacks_total", "counter", "Audio callbacks" },
+	{ "geiger_callback_seconds_total", "counter",
+	  "Time spent in the audio callbacks" },
+	{ "geiger_callback_max_seconds", "gauge",
+	  "Longest audio callback" },
+	{ "geiger_callback_cycles_total", "counter",
+	  "Time-stamp counter cycles spent in the audio callbacks" },
+};
+
+static double
+devmetric(const struct device *dev, enum devmetric m)
+{
+	const struct callbackstats *st = &dev->stats;
+	switch (m) {
+	case DEV_SAMPLES:
+		return atomic_load(&dev->sample_number);
+	case DEV_SAMPLE_RATE:
+		return dev->sample_rate;
+	case DEV_OVERFLOWS:
+		return atomic_load(&st->overflows);
+	case DEV_LOST:
+		return atomic_load(&dev->ring.lost);
+	case DEV_CALLBACKS:
+		return atomic_load(&st->callbacks);
+	case DEV_CALLBACK_SECONDS:
+		return atomic_load(&st->ns) * 1e-9;
+	case DEV_CALLBACK_MAX:
+		return atomic_load(&st->max_ns) * 1e-9;
+	case DEV_CALLBACK_CYCLES:
+		return atomic_load(&st->cycles);
+	default:
+		return 0;
+	}
+}
 
-/* This is a placeholder for a function called regularly that could be used
-   to process or display the new data. Only sample code currently. */
+/* Metrics server callback, on its own thread */
 static void
-process_new_data(struct countdata *data)
+write_metrics(FILE *out, void *ctx)
 {
-	static uint64_t total_count;
-	static PaTime prev_time;
+	struct countdata *data = ctx;
+	char labels[64];
+
+	double cpm[MAX_WINDOWS], seconds[MAX_WINDOWS];
+	uint64_t total = read_rates(data->snapshot, cpm, seconds);
+	metrics_family(out, "geiger_peaks_total", "counter",
+		       "Peaks counted, all the tubes together");
+	metrics_value(out, "geiger_peaks_total", "", total);
+	metrics_family(out, "geiger_rate_cpm", "gauge",
+		       "Count rate over the last window seconds");
+	for (size_t i = 0; i < nb_windows; i++) {
+		snprintf(labels, sizeof labels, "window=\"%g\"", windows[i]);
+		metrics_value(out, "geiger_rate_cpm", labels, cpm[i]);
+	}
+	metrics_family(out, "geiger_rate_seconds", "gauge",
+		       "Time actually covered by each window");
+	for (size_t i = 0; i < nb_windows; i++) {
+		snprintf(labels, sizeof labels, "window=\"%g\"", windows[i]);
+		metrics_value(out, "geiger_rate_seconds", labels, seconds[i]);
+	}
+
+	for (enum devmetric m = 0; m < NB_DEVMETRICS; m++) {
+		metrics_family(out, devmetrics[m].name, devmetrics[m].type,
+			       devmetrics[m].help);
+		for (size_t k = 0; k < data->nb_devices; k++) {
+			const struct device *dev = &data->devices[k];
+			snprintf(labels, sizeof labels, "device=\"%d\"",
+				 dev->index + 1);
+			metrics_value(out, devmetrics[m].name, labels,
+				      devmetric(dev, m));
+		}
+	}
+	/* the load of the callbacks, in buffer periods: bins of 1/1024 */
+	metrics_family(out, "geiger_callback_load", "histogram",
+		       "Duration of the audio callbacks over their buffer "
+		       "period");
+	for (size_t k = 0; k < data->nb_devices; k++) {
+		const struct device *dev = &data->devices[k];
+		const struct callbackstats *st = &dev->stats;
+		const uint64_t n = atomic_load(&st->callbacks);
+		const double period = n ? atomic_load(&st->frames)
+			/ (double) n / dev->sample_rate : 0;
+		snprintf(labels, sizeof labels, "device=\"%d\"",
+			 dev->index + 1);
+		metrics_histogram(out, "geiger_callback_load", labels,
+				  st->load, LIVESTATS_BINS, 1.0 / 1024,
+				  period > 0 ? atomic_load(&st->ns) * 1e-9
+				  / period : 0);
+	}
+	metrics_family(out, "geiger_peak_latency_seconds", "histogram",
+		       "Time from the capture of a peak to its output");
+	metrics_histogram(out, "geiger_peak_latency_seconds", "",
+			  data->latency->bins, LIVESTATS_BINS, 1e-3,
+			  atomic_load(&data->latency->us) * 1e-6);
+}
 
+/* Time at which the sample of a peak was captured, from the last anchor of
+   its device; the tubes of a device follow each other. */
+static uint64_t
+peak_adc_time(const struct event *ev, void *ctx)
+{
+	struct countdata *data = ctx;
+	struct device *dev =
+		&data->devices[ev->channel / data->devices[0].channels];
+	uint64_t spl, ns;
+	anchor_load(dev, &spl, &ns);
+	const double dt = ((double) ev->spl - (double) spl)
+		/ dev->sample_rate;
+	return (uint64_t) (ns + dt * 1e9);
+}
 
-	static struct smooth_counter c10 = {10, 0, 0};
-	smooth_rate(&c10, data);
 
-	static struct smooth_counter c60 = {60, 0, 0};
-	smooth_rate(&c60, data);
 
-	static struct smooth_counter c3600 = {3600, 0, 0};
-	smooth_rate(&c3600, data);
+/* The alarm (-a) is raised or cleared by the main thread, as the peaks
+   are drained from the ring. The command given with -x is then run by the
+   shell, without waiting for it, with GEIGER_ALARM set to "raised" or
+   "cleared", GEIGER_TIME to the time of the peak in seconds and GEIGER_CPM
+   to the rate over the first window. With -e, geiger stops at the first
+   alarm, with the exit status EXIT_ALARM. */
 
+extern char **environ;
 
+struct alarmconf {
+	const char *command;
+	bool exit;
+	bool raised;            /* at least once */
+	struct ratemeter *rates;
+};
 
-	if (data->count == 0)
+static void
+alarm_notify(const struct ratealarm *al, enum ratealarm_change change,
+	     uint64_t spl, void *ctx)
+{
+	struct alarmconf *conf = ctx;
+	const bool raised = change == RATEALARM_RAISED;
+	const double seconds = (double) spl / sample_rate;
+	const double cpm = 60 * ratemeter_rate(conf->rates, windows[0], NULL);
+	fprintf(stderr, "ALARM %s at %.3f s: %.1f CPM, background %.1f CPM\n",
+		raised ? "raised" : "cleared", seconds, cpm,
+		60 * al->background);
+	if (raised) {
+		conf->raised = true;
+		if (conf->exit)
+			quit = 1;
+	}
+	if (conf->command == NULL)
 		return;
-	total_count += data->count;
 
+	char buf[32];
+	setenv("GEIGER_ALARM", raised ? "raised" : "cleared", 1);
+	snprintf(buf, sizeof buf, "%.3f", seconds);
+	setenv("GEIGER_TIME", buf, 1);
+	snprintf(buf, sizeof buf, "%.1f", cpm);
+	setenv("GEIGER_CPM", buf, 1);
+	char *argv[] = { "sh", "-c", (char *) conf->command, NULL };
+	pid_t pid;
+	int err = posix_spawn(&pid, "/bin/sh", NULL, NULL, argv, environ);
+	if (err)
+		fprintf(stderr, "Unable to run the alarm command: %s\n",
+			strerror(err));
+}
 
-	// rate between two calls (unless there is no new impulsion).
-	// fprintf(stderr, "current rate: %.0f CPM\n",
-	//	60 * data->count / (data->last_spl_time - prev_time));
 
+/* Called regularly by the main thread: passes the new peaks of the devices
+   on to the sink, and reports the warnings and the rates. */
+static void
+process_new_data(struct countdata *data)
+{
+	static uint64_t overflows[MAX_DEVICES];
+	static uint64_t lost[MAX_DEVICES];
+	static uint64_t report_spl;
+
+	/* All the devices are complete up to this sample (a stalled device
+	   does not hold the others back by more than MERGE_DELAY): their peaks
+	   before it will be in the merge once the rings are drained, and can
+	   be passed on in this round. */
+	uint64_t next = UINT64_MAX, latest = 0;
+	for (size_t k = 0; k < data->nb_devices; k++) {
+		struct device *dev = &data->devices[k];
+		uint64_t p = 0;
+		if (atomic_load_explicit(&dev->started, memory_order_acquire))
+			p = atomic_load(&dev->complete);
+		if (p < next)
+			next = p;
+		if (p > latest)
+			latest = p;
+	}
+	if (latest - next > (uint64_t) MERGE_DELAY * sample_rate)
+		next = latest - (uint64_t) MERGE_DELAY * sample_rate;
+	for (size_t k = 0; k < data->nb_devices; k++)
+		ring_drain(&data->devices[k].ring,
+			   channelmerge_input(data->merge));
+	if (next > data->merged)
+		data->merged = next;
+	uint64_t spl = data->merged;
+	channelmerge_flush(data->merge, spl);
+	/* the callbacks wake us up until the devices reach the peaks left */
+	atomic_store(&merge_held, channelmerge_held(data->merge) > 0);
+	data->sink->flush(data->sink->data);
+	ratemeter_advance(data->rates, spl);
+	if (data->snapshot != NULL)
+		publish_rates(data->snapshot, data->rates);
+	/* the alarm commands which are over */
+	while (waitpid(-1, NULL, WNOHANG) > 0)
+		;
+
+	for (size_t k = 0; k < data->nb_devices; k++) {
+		struct device *dev = &data->devices[k];
+		uint64_t n = atomic_load(&dev->stats.overflows);
+		if (n != overflows[k]) {
+			fprintf(stderr, "Warning: input overflow on device %d "
+				"(%lu)\n", dev->index + 1,
+				(long unsigned int) n);
+			overflows[k] = n;
+		}
+		n = atomic_load(&dev->ring.lost);
+		if (n != lost[k]) {
+			fprintf(stderr, "Warning: %lu peak(s) lost on device "
+				"%d\n", (long unsigned int) (n - lost[k]),
+				dev->index + 1);
+			lost[k] = n;
+		}
+	}
 
-	prev_time = data->last_spl_time;
-	data->count = 0;
+	if (spl - report_spl >= (uint64_t) RATE_REPORT * sample_rate) {
+		report_rates(data);
+		report_spl = spl;
+	}
 }
 
 
@@ -206,15 +791,16 @@ list_sound_devices(void)
 	for (int i = 0; i < nb_dev; i++) {
 		const PaDeviceInfo* dev = Pa_GetDeviceInfo(i);
 		assert(dev != NULL);
-		fprintf(stderr, "device %d: %s; %d input channel(s)\n", i + 1,
-			dev->name, dev->maxInputChannels);
+		fprintf(stderr, "device %d: %s; %d input channel(s), %.0f Hz"
+			"\n", i + 1, dev->name, dev->maxInputChannels,
+			dev->defaultSampleRate);
 	}
 }
 
 static void
 global_init(void)
 {
-	{ /* Redirecting SIGINT & SIGTERM */
+	{ /* Redirecting SIGINT, SIGTERM & SIGUSR1 */
 		void (*oldh)();
 		oldh = signal(SIGINT, &exithandler);
 		if (oldh == SIG_ERR) {
@@ -228,6 +814,12 @@ global_init(void)
 				" %s\n", strerror(errno));
 			exit(EXIT_FAILURE);
 		}
+		oldh = signal(SIGUSR1, &dumphandler);
+		if (oldh == SIG_ERR) {
+			fprintf(stderr, "signal failed to redirect USR1 signal:"
+				" %s\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
 	}
 
 	/* Initialize portaudio */
@@ -251,41 +843,381 @@ global_finishup(void)
 	}
 }
 
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: geiger [-d device ...] [-c channels] "
+		"[-s format] [-r rate] [-f frames]\n\t      [-o eventlog] "
+		"[-m address] [-w window ...] [-a factor [-A seconds]\n\t      "
+		"[-b cps] [-x command] [-e]]\n");
+	fprintf(stderr, "\t -d: capture from this device, as listed (up to "
+		"%d devices, default: 1)\n", MAX_DEVICES);
+	fprintf(stderr, "\t -c: one tube per input channel of each device (at "
+		"most %d), the peaks\n\t     are tagged with their tube; the "
+		"rates and the alarm are for all the\n\t     tubes\n",
+		MAX_CHANNELS);
+	fprintf(stderr, "\t -s: sample format of the devices:");
+	for (size_t i = 0; i < NB_SAMPLEFORMATS; i++)
+		fprintf(stderr, " %s", sampleformats[i].name);
+	fprintf(stderr, "\n\t     (default: int16); the threshold stays on "
+		"the 16-bit scale\n");
+	fprintf(stderr, "\t -r: sample rate, in Hz (default: %d)\n",
+		DEFAULT_SAMPLE_RATE);
+	fprintf(stderr, "\t -f: frames per buffer (default: chosen by the "
+		"host): more for less CPU,\n\t     fewer for less latency\n");
+	fprintf(stderr, "\t -o: write the peaks to a binary event log "
+		"(- for stdout)\n");
+	fprintf(stderr, "\t -m: serve Prometheus metrics over HTTP on port, "
+		"host:port, or a Unix\n\t     socket if address is a path\n");
+	fprintf(stderr, "\t -w: display the count rate over the last window "
+		"seconds (up to %d\n\t     windows of at most %d s, default: "
+		"10, 60 and 3600)\n", MAX_WINDOWS, MAX_WINDOW);
+	fprintf(stderr, "\t -a: alarm when the count rate rises by factor\n");
+	fprintf(stderr, "\t -A: mean time between false alarms, at least "
+		"(%d s)\n", DEFAULT_FALSE_ALARM);
+	fprintf(stderr, "\t -b: background rate (default: measured over the "
+		"first %d s)\n", ALARM_LEARNING);
+	fprintf(stderr, "\t -x: run command at each change of the alarm\n");
+	fprintf(stderr, "\t -e: exit at the first alarm, with the status %d\n",
+		EXIT_ALARM);
+	fprintf(stderr, "SIGUSR1 prints the cost of the callbacks and the "
+		"latency of the peaks.\n");
+}
+
+/* Open the input stream of a device, and set up its detectors at the rate
+   negotiated with the host. The stream is started later. */
+static bool
+device_init(struct device *dev, PaDeviceIndex index, unsigned first_tube,
+	    const struct streamconf *conf, const struct parameters *params,
+	    sem_t *wakeup)
+{
+	const PaDeviceInfo *info = Pa_GetDeviceInfo(index);
+	if (info == NULL) {
+		fprintf(stderr, "No device %d\n", index + 1);
+		return false;
+	}
+	const unsigned channels = conf->channels;
+	if ((int) channels > info->maxInputChannels) {
+		fprintf(stderr, "Device %d has only %d input channel(s)\n",
+			index + 1, info->maxInputChannels);
+		return false;
+	}
+	dev->index = index;
+	dev->channels = channels;
+	dev->width = sample_size(params->sample_format);
+	dev->first_tube = first_tube;
+	atomic_init(&dev->started, false);
+	atomic_init(&dev->sample_number, 0);
+	atomic_init(&dev->complete, 0);
+	callbackstats_init(&dev->stats);
+	atomic_init(&dev->anchor_seq, 0);
+	atomic_init(&dev->anchor_spl, 0);
+	atomic_init(&dev->anchor_ns, 0);
+	ring_init(&dev->ring, wakeup);
+
+	PaStreamParameters stream_params = {
+		index, channels, conf->format, info->defaultLowInputLatency,
+		NULL
+	};
+	PaError perr = Pa_OpenStream(&dev->stream, &stream_params, NULL,
+				     conf->sample_rate, conf->frames, paNoFlag,
+				     geiger_callback, dev);
+	if (perr != paNoError) {
+		fprintf(stderr, "Pa_OpenStream failed on device %d: %s\n",
+			index + 1, Pa_GetErrorText(perr));
+		return false;
+	}
+	/* the host may not give exactly the rate requested */
+	const PaStreamInfo *sinfo = Pa_GetStreamInfo(dev->stream);
+	dev->sample_rate = sinfo != NULL && sinfo->sampleRate > 0
+		? sinfo->sampleRate : conf->sample_rate;
+	dev->latency = sinfo != NULL ? sinfo->inputLatency : 0;
+
+	for (unsigned c = 0; c < channels; c++) {
+		dev->ringsinks[c] = init_ringsink(dev, first_tube + c);
+		if (dev->ringsinks[c] != NULL)
+			dev->detectors[c] = init_detector_c1(
+				(uint32_t) (dev->sample_rate + 0.5), params,
+				dev->ringsinks[c]);
+		if (dev->detectors[c] == NULL) {
+			fprintf(stderr, "Detector initialization failed\n");
+			return false;
+		}
+	}
+	if (channels > 1) {
+		dev->planes = calloc(channels, CHANNEL_CHUNK * dev->width);
+		if (dev->planes == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			return false;
+		}
+	}
+	return true;
+}
+
+static void
+device_free(struct device *dev)
+{
+	for (unsigned c = 0; c < dev->channels; c++) {
+		if (dev->detectors[c] != NULL)
+			dev->detectors[c]->terminate(dev->detectors[c]);
+		if (dev->ringsinks[c] != NULL)
+			dev->ringsinks[c]->terminate(dev->ringsinks[c]);
+	}
+	free(dev->planes);
+}
+
 int
 main(int argc, char *argv[])
 {
-	PaDeviceIndex dev_used = 0; /* To be initialized: will allow selection
-				       of the soundcard / audio device used. */
+	PaDeviceIndex devs_used[MAX_DEVICES] = {0}; /* given with -d, the
+						       first device by
+						       default */
+	size_t nb_devices = 1;
 	int threshold = 5; /* The detection threshold should be set to a "good"
 			      default value, with a way for the user to specify
 			      a different value. */
 
+	char *logname = NULL;
+	const char *metrics_address = NULL;
+	unsigned channels = 1;
+	size_t format = 1; /* in sampleformats, int16 */
+	double rate = DEFAULT_SAMPLE_RATE;
+	unsigned long frames = paFramesPerBufferUnspecified;
+	double alarm_factor = 0;
+	double false_alarm = DEFAULT_FALSE_ALARM;
+	double background = 0;
+	struct alarmconf alarmconf = { NULL, false, false, NULL };
+	{
+		int ch;
+		size_t nb_w = 0;
+		size_t nb_d = 0;
+		while ((ch = getopt(argc, argv,
+				    "d:c:s:r:f:o:m:w:a:A:b:x:e")) != -1) {
+			switch (ch) {
+			case 'd': {
+				int d = strtol(optarg, NULL, 10);
+				if (d < 1 || nb_d == MAX_DEVICES) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				devs_used[nb_d++] = d - 1;
+				break;
+			}
+			case 'c':
+				channels = strtoul(optarg, NULL, 10);
+				if (channels < 1 || channels > MAX_CHANNELS) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 's':
+				for (format = 0; format < NB_SAMPLEFORMATS;
+				     format++)
+					if (!strcmp(optarg,
+						    sampleformats[format].name))
+						break;
+				if (format == NB_SAMPLEFORMATS) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'r':
+				rate = strtod(optarg, NULL);
+				if (!(rate >= 1)) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'f':
+				frames = strtoul(optarg, NULL, 10);
+				if (frames == 0) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'o':
+				logname = optarg;
+				break;
+			case 'm':
+				metrics_address = optarg;
+				break;
+			case 'w': {
+				double w = strtod(optarg, NULL);
+				if (!(w >= RATE_BIN && w <= MAX_WINDOW)
+				    || nb_w == MAX_WINDOWS) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				windows[nb_w++] = w;
+				break;
+			}
+			case 'a':
+				alarm_factor = strtod(optarg, NULL);
+				if (!(alarm_factor > 1)) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'A':
+				false_alarm = strtod(optarg, NULL);
+				if (!(false_alarm > 0)) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'b':
+				background = strtod(optarg, NULL);
+				if (!(background > 0)) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'x':
+				alarmconf.command = optarg;
+				break;
+			case 'e':
+				alarmconf.exit = true;
+				break;
+			default:
+				usage();
+				exit(EXIT_FAILURE);
+			}
+		}
+		if (optind != argc) {
+			usage();
+			exit(EXIT_FAILURE);
+		}
+		if (nb_w)
+			nb_windows = nb_w;
+		if (nb_d)
+			nb_devices = nb_d;
+		if (alarm_factor == 0 && (alarmconf.command || alarmconf.exit)) {
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+
 	global_init();
 
 	/* For fun: display the available audiodevices (= soundcards?) */
 	list_sound_devices();
 
 	PaError perr;
-	PaStream *stream;
+	static sem_t wakeup;
+	if (sem_init(&wakeup, 0, 0)) {
+		fprintf(stderr, "sem_init failed: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	static struct device devices[MAX_DEVICES];
 	struct countdata cdata = init_cd;
-	cdata.threshold = threshold;
-	{ /* Open the input stream. */
-		PaTime latency = Pa_GetDeviceInfo(dev_used)->defaultLowInputLatency;
-		PaStreamParameters stream_params = { dev_used, 1, paInt16,
-						     latency, NULL };
-
-		perr = Pa_OpenStream(&stream, &stream_params, NULL, SAMPLE_RATE,
-				     paFramesPerBufferUnspecified, paNoFlag,
-				     geiger_callback, &cdata);
-		if (perr != paNoError) {
-			fprintf(stderr, "Pa_OpenStream failed: %s\n",
-				Pa_GetErrorText(perr));
+	cdata.devices = devices;
+	cdata.nb_devices = nb_devices;
+	const unsigned tubes = nb_devices * channels;
+	const struct parameters params = {
+		.noise_threshold = threshold,
+		.sample_format = sampleformats[format].format,
+	};
+	const struct streamconf conf = {
+		channels, sampleformats[format].pa, rate, frames
+	};
+	for (size_t k = 0; k < nb_devices; k++)
+		if (!device_init(&devices[k], devs_used[k], k * channels,
+				 &conf, &params, &wakeup))
+			return EXIT_FAILURE;
+	/* The peaks of all the devices are on the timeline of the first one */
+	sample_rate = (uint32_t) (devices[0].sample_rate + 0.5);
+	for (size_t k = 0; k < nb_devices; k++) {
+		struct device *dev = &devices[k];
+		fprintf(stderr, "device %d: %.1f Hz, ", dev->index + 1,
+			dev->sample_rate);
+		if (frames != paFramesPerBufferUnspecified)
+			fprintf(stderr, "%lu frames per buffer (%.1f ms), ",
+				frames, 1e3 * frames / dev->sample_rate);
+		fprintf(stderr, "input latency %.1f ms\n", 1e3 * dev->latency);
+		if ((uint32_t) (dev->sample_rate + 0.5) != sample_rate) {
+			fprintf(stderr, "Device %d does not run at %u Hz like "
+				"device %d\n", dev->index + 1, sample_rate,
+				devices[0].index + 1);
 			return EXIT_FAILURE;
 		}
-
-		perr = Pa_StartStream(stream);
+	}
+	FILE *logfile = NULL;
+	if (logname == NULL) {
+		cdata.sink = tubes > 1
+			? init_channeltextsink(stdout, sample_rate)
+			: init_textsink(stdout, sample_rate);
+	} else {
+		if (!strcmp(logname, "-"))
+			logfile = stdout;
+		else
+			logfile = fopen(logname, "wb");
+		if (logfile == NULL) {
+			fprintf(stderr, "Unable to open %s: %s\n", logname,
+				strerror(errno));
+			return EXIT_FAILURE;
+		}
+		struct eventlog_header hdr = {
+			.sample_rate = sample_rate,
+			.start_time = time(NULL),
+			.threshold = threshold,
+			.dead_time = 0,
+			.channels = tubes,
+			.detector = "C1",
+		};
+		cdata.sink = init_eventlogsink(logfile, &hdr);
+	}
+	static struct latencystats latency;
+	latencystats_init(&latency);
+	cdata.latency = &latency;
+	if (cdata.sink != NULL)
+		cdata.sink = init_latencysink(cdata.sink, &latency,
+					      &peak_adc_time, &cdata);
+	double max_window = 0;
+	for (size_t i = 0; i < nb_windows; i++)
+		if (windows[i] > max_window)
+			max_window = windows[i];
+	cdata.rates = ratemeter_new(sample_rate, RATE_BIN, max_window);
+	if (cdata.rates == NULL) {
+		fprintf(stderr, "Output initialization failed\n");
+		return EXIT_FAILURE;
+	}
+	if (cdata.sink != NULL)
+		cdata.sink = init_ratesink(cdata.sink, cdata.rates);
+	static struct ratealarm alarm;
+	if (alarm_factor > 0) {
+		if (ratealarm_init(&alarm, sample_rate, alarm_factor,
+				   false_alarm, background, ALARM_LEARNING)) {
+			fprintf(stderr, "Incorrect alarm parameters\n");
+			return EXIT_FAILURE;
+		}
+		alarmconf.rates = cdata.rates;
+		if (cdata.sink != NULL)
+			cdata.sink = init_alarmsink(cdata.sink, &alarm,
+						    &alarm_notify, &alarmconf);
+	}
+	if (cdata.sink != NULL)
+		cdata.merge = channelmerge_new(cdata.sink, tubes);
+	if (cdata.merge == NULL) {
+		fprintf(stderr, "Output initialization failed\n");
+		return EXIT_FAILURE;
+	}
+	static struct ratesnapshot snapshot;
+	struct metricsserver *metrics = NULL;
+	if (metrics_address != NULL) {
+		atomic_init(&snapshot.seq, 0);
+		cdata.snapshot = &snapshot;
+		publish_rates(&snapshot, cdata.rates);
+		metrics = metrics_start(metrics_address, &write_metrics,
+					&cdata);
+		if (metrics == NULL)
+			return EXIT_FAILURE;
+	}
+	start_time = monotonic();
+	for (size_t k = 0; k < nb_devices; k++) {
+		perr = Pa_StartStream(devices[k].stream);
 		if (perr != paNoError) {
-			fprintf(stderr, "Pa_StartStream failed: %s\n",
+			fprintf(stderr, "Pa_StartStream failed on device %d: "
+				"%s\n", devices[k].index + 1,
 				Pa_GetErrorText(perr));
 			return EXIT_FAILURE;
 		}
@@ -297,8 +1229,12 @@ main(int argc, char *argv[])
 	time_t t0 = time(NULL);
 
 	while(!quit) {
-		Pa_Sleep(500);
+		ring_wait(&wakeup, 500);
 		process_new_data(&cdata);
+		if (dump) {
+			dump = 0;
+			report_stats(&cdata);
+		}
 	}
 
 	time_t t1 = time(NULL);
@@ -306,27 +1242,48 @@ main(int argc, char *argv[])
 	/* Dump some last accounting data, close the stream, finishup & exit. */
 
 	double time = difftime(t1, t0);
+	for (size_t k = 0; k < nb_devices; k++) {
+		uint64_t sample_number =
+			atomic_load(&devices[k].sample_number);
+		if (nb_devices > 1)
+			fprintf(stderr, "device %d: ", devices[k].index + 1);
+		fprintf(stderr, "%lu samples processed in %.0f seconds "
+			"(%f spl/s)\n", (long unsigned int) sample_number,
+			time, sample_number/time);
+	}
+	report_rates(&cdata);
+	report_stats(&cdata);
+	metrics_stop(metrics);
 
-	fprintf(stderr, "%lu samples processed in %.0f seconds (%f spl/s)\n",
-		(long unsigned int) cdata.sample_number, time,
-		cdata.sample_number/time);
+	for (size_t k = 0; k < nb_devices; k++) {
+		struct device *dev = &devices[k];
+		perr = Pa_StopStream(dev->stream);
+		if (perr != paNoError) {
+			fprintf(stderr, "Pa_StopStream failed: %s\n",
+				Pa_GetErrorText(perr));
+			return EXIT_FAILURE;
+		}
 
-	perr = Pa_StopStream(stream);
-	if (perr != paNoError) {
-		fprintf(stderr, "Pa_StopStream failed: %s\n",
-			Pa_GetErrorText(perr));
-		return EXIT_FAILURE;
+		perr = Pa_CloseStream(dev->stream);
+		dev->stream = NULL;
+		if (perr != paNoError) {
+			fprintf(stderr, "Pa_CloseStream failed: %s\n",
+				Pa_GetErrorText(perr));
+			return EXIT_FAILURE;
+		}
 	}
 
-	perr = Pa_CloseStream(stream);
-	stream = NULL;
-	if (perr != paNoError) {
-		fprintf(stderr, "Pa_CloseStream failed: %s\n",
-			Pa_GetErrorText(perr));
-		return EXIT_FAILURE;
-	}
+	process_new_data(&cdata);
+	channelmerge_flush(cdata.merge, UINT64_MAX);
+	channelmerge_free(cdata.merge);
+	for (size_t k = 0; k < nb_devices; k++)
+		device_free(&devices[k]);
+	cdata.sink->terminate(cdata.sink);
+	ratemeter_free(cdata.rates);
+	if (logfile != NULL && logfile != stdout)
+		fclose(logfile);
 
 	global_finishup();
 
-	return EXIT_SUCCESS;
+	return alarmconf.exit && alarmconf.raised ? EXIT_ALARM : EXIT_SUCCESS;
 }
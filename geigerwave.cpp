@@ -1,10 +1,11 @@
+#include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 
 #define DEFAULT_THRESHOLD	(1000)
-#define DEFAULT_LEAVING_TIME_THRESHOLD (0.0001)	// 100µs
 
 /*************************************
  * Structure pour le fichier WAVE
@@ -25,8 +26,19 @@ typedef unsigned __int64 uint64_t;
 #include <errno.h>
 #include <stdint.h>
 #include <stdbool.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 
+#include "peakdetector/engine.hpp"
+#include "peakdetector/eventlog.h"
+#include "peakdetector/eventsink.h"
+#include "peakdetector/peakdetector.h"
+#include "peakdetector/segments.h"
+
 /*! 
 * def unsigned long word 
 * Variable de 4 octets 
@@ -93,69 +105,111 @@ typedef struct WAVE
 	} data;  
 } WAVE;  
 
-
-#define INT8_MAX	(127)
-#define INT8_MIN	(-128)
-
-/* More or less an extremely crude derivative function... */
-static int8_t
-evolution(int32_t value1, int32_t value2, int threshold)
-{
-	int32_t ret = (value2 - value1) / threshold;
-	if (ret > INT8_MAX) {
-		ret = INT8_MAX;
-	}
-	if (ret < INT8_MIN) {
-		ret = INT8_MIN;
-	}
-	return (int8_t) ret;
-}
-
-
-/* Naive peak detection (both positive and negative ones).
-   Note that, as this function is called for every value,
-   the call to evolution(a, b, th) is the same as the call
-   to evolution(b, c, th) of the previous call to peakp().
-   This could hence be optimized if needed.
- */
-static bool
-peakp(int16_t a, int16_t b, int16_t c, int th)
+// l'analyse ne lit que des échantillons PCM 16 bits : les autres formats
+// (8, 24 ou 32 bits, flottants) sont analysés tels quels par
+// "peakdetector PEAK", qui applique le même algorithme
+static bool IsPCM16(const WAVE &Header, const char *zFilename)
 {
-	int8_t le = evolution(a, b, th);
-	int8_t ce = evolution(b, c, th);
-
-	/* Positive peaks */
-	if (le >= 0 && ce < 0 && b > th)
-		return true;
-
-#if 0
-	/* Negative peaks */
-	if (le <= 0 && ce > 0 && b < -th)
+	if (Header.fmt.AudioFormat==1 && Header.fmt.BitsPerSample==16)
+	{
 		return true;
-#endif
+	}
+	fprintf(stderr,"Le fichier \"%s\" n'est pas en PCM 16 bits (format %u, %u bits) : utiliser peakdetector PEAK.\n",
+		zFilename,(unsigned)Header.fmt.AudioFormat,(unsigned)Header.fmt.BitsPerSample);
 	return false;
 }
 
 
-static bool ProcessFile(const char *zFilename, const int nThreshold);
+// Taille par défaut des blocs lus en mode flux (en échantillons)
+#define DEFAULT_STREAM_BLOCK_SIZE	(65536)
+
+static bool ProcessFile(const char *zFilename, const int nThreshold,
+						const int32_t nBlockSize, const char *zLogFilename,
+						const int nJobs, const bool bTiming);
 
 int main(int argc, char *argv[])
 {
-	if (argc<2)
+	// -b : analyse en flux, par blocs de la taille donnée
+	// -o : écrit les évènements dans un journal binaire (voir eventlog.h)
+	// -j : analyse le fichier par segments, sur plusieurs threads
+	// -t : mesure la durée de l'analyse (voir "make bench")
+	int32_t nBlockSize=0;
+	const char *zLogFilename=NULL;
+	int nJobs=1;
+	bool bTiming=false;
+	int nArg=1;
+	while (nArg<argc && argv[nArg][0]=='-' && argv[nArg][1]!='\0')
+	{
+		if (!strcmp(argv[nArg],"-t"))
+		{
+			bTiming=true;
+			nArg++;
+			continue;
+		}
+		if (nArg+1>=argc)
+		{
+			nArg=argc+1;
+			break;
+		}
+		if (!strcmp(argv[nArg],"-b"))
+		{
+			if ((nBlockSize=atoi(argv[nArg+1]))<=0)
+			{
+				nArg=argc+1;
+				break;
+			}
+		}
+		else if (!strcmp(argv[nArg],"-o"))
+		{
+			zLogFilename=argv[nArg+1];
+		}
+		else if (!strcmp(argv[nArg],"-j"))
+		{
+			if ((nJobs=atoi(argv[nArg+1]))<=0)
+			{
+				nArg=argc+1;
+				break;
+			}
+		}
+		else
+		{
+			nArg=argc+1;
+			break;
+		}
+		nArg+=2;
+	}
+	if (nArg<argc-1 || nArg>argc)
 	{
-		fprintf(stderr,"usage : %s <fichier wave>\n",argv[0]);
+		fprintf(stderr,"usage : %s [-b taille_bloc | -j threads] [-o journal] [-t] [<fichier wave>|-]\n",argv[0]);
 		return EXIT_FAILURE;
 	}
+	// comme peakdetector, on lit l'entrée standard par défaut
+	const char *zFilename=(nArg<argc) ? argv[nArg] : "-";
+	// l'entrée standard ne peut pas être projetée en mémoire
+	if (!strcmp(zFilename,"-") && nBlockSize==0)
+	{
+		nBlockSize=DEFAULT_STREAM_BLOCK_SIZE;
+	}
 	// TODO : permettre de configurer le seuil à la ligne de commande
-	const int nThreshold=200;
-	ProcessFile(argv[1],nThreshold);
+	const int nThreshold=DEFAULT_THRESHOLD;
+	// le flux est analysé au fur et à mesure, sur un seul thread
+	if (nBlockSize>0 && nJobs>1)
+	{
+		fprintf(stderr,"L'option -j demande un fichier projeté en mémoire.\n");
+		return EXIT_FAILURE;
+	}
+	if (!ProcessFile(zFilename,nThreshold,nBlockSize,zLogFilename,nJobs,bTiming))
+	{
+		return EXIT_FAILURE;
+	}
 
 	return EXIT_SUCCESS;
 }
 
+#if defined WIN32 && defined _MSC_VER
 static bool ReadWaveFile(const char *zFilename,
 						 int16_t *&pData,
-						 int32_t &nSampleCount,
+						 uint64_t &nSampleCount,
 						 int32_t &nSampleRate)
 {
 	FILE *file=NULL;
@@ -183,20 +237,25 @@ static bool ReadWaveFile(const char *zFilename,
 				zFilename);
 			break;
 		}
+		if (!IsPCM16(Header,zFilename))
+		{
+			nError=EINVAL;
+			break;
+		}
 
-		nSampleCount=(int)(Header.data.Subchunk2Size + 1) / (int)Header.fmt.Blockalign;
-		pData=(short *)malloc(nSampleCount*sizeof(short));
+		nSampleCount=(Header.data.Subchunk2Size + 1ULL) / Header.fmt.Blockalign;
+		pData=(short *)malloc((size_t)nSampleCount*sizeof(short));
 		if (!pData)
 		{
 			nError=errno;
-			fprintf(stderr,"Erreur pendant l'allocation du buffer (%d echantillons).",
-				nSampleCount);
+			fprintf(stderr,"Erreur pendant l'allocation du buffer (%llu echantillons).",
+				(unsigned long long)nSampleCount);
 			break;
 		}
 		nSampleRate=Header.fmt.SampleRate;
 
 		//remplissage du tableau d'échantillons data[] de la structure WAVE  
-		nSampleCount=fread(pData, sizeof(short), nSampleCount, file);  
+		nSampleCount=fread(pData, sizeof(short), (size_t)nSampleCount, file);  
 		// tout est ok!
 	} while (false);
 
@@ -216,6 +275,131 @@ static bool ReadWaveFile(const char *zFilename,
 
 	return nError==0;
 }
+#else
+// Taille de la zone lue à l'avance au début du fichier
+#define WAVE_READAHEAD_SIZE	(16 << 20)
+
+/* Projette le fichier en mémoire : les échantillons sont lus directement
+ * dans le cache de pages, sans copie, au fur et à mesure de l'analyse.
+ * pData pointe dans la projection, à libérer avec UnmapWaveFile().
+ */
+static bool MapWaveFile(const char *zFilename,
+						const int16_t *&pData,
+						uint64_t &nSampleCount,
+						int32_t &nSampleRate,
+						void *&pMap,
+						size_t &nMapSize)
+{
+	int fd=-1;
+	int nError=0;
+
+	pMap=MAP_FAILED;
+	nMapSize=0;
+
+	// dummy loop
+	do
+	{
+		// on ouvre le fichier
+		fd=open(zFilename,O_RDONLY);
+		if (fd<0)
+		{
+			nError=errno;
+			fprintf(stderr,"Le fichier \"%s\" n'a pas pu etre ouvert.\n",
+				zFilename);
+			break;
+		}
+
+		struct stat Stat;
+		if (fstat(fd,&Stat)<0)
+		{
+			nError=errno;
+			break;
+		}
+		if ((size_t)Stat.st_size<sizeof(WAVE))
+		{
+			nError=EINVAL;
+			fprintf(stderr,"Erreur pendant la lecture de l'entete du fichier \"%s\".",
+				zFilename);
+			break;
+		}
+		nMapSize=Stat.st_size;
+
+		pMap=mmap(NULL,nMapSize,PROT_READ,MAP_PRIVATE,fd,0);
+		if (pMap==MAP_FAILED)
+		{
+			nError=errno;
+			fprintf(stderr,"Le fichier \"%s\" n'a pas pu etre projete en memoire.\n",
+				zFilename);
+			break;
+		}
+
+		// le fichier est lu une seule fois, du début à la fin :
+		// lecture anticipée agressive, et les pages déjà lues
+		// peuvent être libérées au plus tôt
+		madvise(pMap,nMapSize,MADV_SEQUENTIAL);
+		madvise(pMap,nMapSize<WAVE_READAHEAD_SIZE ? nMapSize : WAVE_READAHEAD_SIZE,
+			MADV_WILLNEED);
+#ifdef POSIX_FADV_SEQUENTIAL
+		posix_fadvise(fd,0,0,POSIX_FADV_SEQUENTIAL);
+#endif
+
+		// on lit l'entête
+		const WAVE *pHeader=(const WAVE *)pMap;
+		if (pHeader->fmt.Blockalign==0)
+		{
+			nError=EINVAL;
+			fprintf(stderr,"Erreur pendant la lecture de l'entete du fichier \"%s\".",
+				zFilename);
+			break;
+		}
+		if (!IsPCM16(*pHeader,zFilename))
+		{
+			nError=EINVAL;
+			break;
+		}
+
+		// les échantillons suivent l'entête, dans la limite du fichier
+		uint64_t nCount=(pHeader->data.Subchunk2Size + 1ULL) / pHeader->fmt.Blockalign;
+		const uint64_t nAvailable=(nMapSize - sizeof(WAVE)) / sizeof(int16_t);
+		if (nCount>nAvailable)
+		{
+			nCount=nAvailable;
+		}
+		nSampleCount=nCount;
+		nSampleRate=pHeader->fmt.SampleRate;
+		pData=(const int16_t *)((const char *)pMap + sizeof(WAVE));
+		// tout est ok!
+	} while (false);
+
+	// si erreur, on laisse un petit message
+	if (nError)
+	{
+		fprintf(stderr,"Erreur %d (%s)\n",
+			nError,strerror(nError));
+		if (pMap!=MAP_FAILED)
+		{
+			munmap(pMap,nMapSize);
+			pMap=MAP_FAILED;
+		}
+	}
+
+	// la projection reste valide après la fermeture du fichier
+	if (fd>=0)
+	{
+		close(fd);
+	}
+
+	return nError==0;
+}
+
+static void UnmapWaveFile(void *pMap, size_t nMapSize)
+{
+	if (pMap!=MAP_FAILED)
+	{
+		munmap(pMap,nMapSize);
+	}
+}
+#endif
 
 
 class IAnalyser
@@ -223,234 +407,496 @@ class IAnalyser
 public:
 	virtual ~IAnalyser() {};
 	virtual bool ProcessData(const int16_t *pData,
-						const int32_t nSampleCount,
+						const size_t nSampleCount,
 						const int32_t nSampleRate) = 0;
 
-	static IAnalyser *New();
+	// état entre deux appels, pour l'analyse par segments (voir
+	// peakdetector/segments.h)
+	virtual void GetState(struct detectorstate *pState) const = 0;
+	virtual void SetState(const struct detectorstate *pState) = 0;
+	static bool SameState(const struct detectorstate *pA,
+						  const struct detectorstate *pB);
+
+	// les événements détectés sont envoyés à pSink
+	static IAnalyser *New(struct eventsink *pSink,
+						  const struct parameters *pParams);
 };
 
+/*************************************
+ * Les algorithmes de détection sont ceux de peakdetector/engine.hpp, communs
+ * à peakdetector, geiger et geigerwave : CPeakDetector y est l'algorithme
+ * "peak", l'ancien CCountData y est C1.
+ */
 #if 0
-/* This structure will hold data to and from the counting algorithm.
-An instance of this structure is used with the callback function
-that process the audio input. */
-class CCountData : public IAnalyser
+typedef detection::c1<int16_t,detection::positive> TAlgorithm;
+#else
+typedef detection::peak<int16_t,detection::absolute> TAlgorithm;
+#endif
+
+class CPeakDetector : public IAnalyser
 {
 public:
-	double start_time;
-	uint64_t count;
-	int threshold; // detection threshold to filter noise
-	int16_t last_values[2]; /* remember the last values between calls to the
-					callback fct */
-	double last_spl_time;   /* timestamp for the last sample processed */
-	uint64_t sample_number; /* count the number of samples (= time) */
-
-	CCountData();
-	virtual ~CCountData();
+	CPeakDetector(struct eventsink *pSink, const struct parameters *pParams);
+	virtual ~CPeakDetector();
 	virtual bool ProcessData(const int16_t *pData,
-						const int32_t nSampleCount,
+						const size_t nSampleCount,
 						const int32_t nSampleRate);
+	virtual void GetState(struct detectorstate *pState) const;
+	virtual void SetState(const struct detectorstate *pState);
+
+private:
+	typedef detection::engine<TAlgorithm> TEngine;
+	TEngine m_Engine;
+	friend bool IAnalyser::SameState(const struct detectorstate *pA,
+									 const struct detectorstate *pB);
 };
 
-CCountData::CCountData()
-	: start_time(0.0)
-	, count(0)
-	, threshold(DEFAULT_THRESHOLD)
-	, last_spl_time(0.0)
-	, sample_number(0)
+CPeakDetector::CPeakDetector(struct eventsink *pSink,
+							 const struct parameters *pParams)
+	// la fréquence d'échantillonnage n'est connue qu'avec les données
+	: m_Engine(0,pParams,pSink)
 {
-	last_values[0]=last_values[1]=0;
 }
 
-CCountData::~CCountData()
+CPeakDetector::~CPeakDetector()
 {
 }
 
-bool CCountData::ProcessData(const int16_t *pData,
-						const int32_t nSampleCount,
+bool CPeakDetector::ProcessData(const int16_t *pData,
+						const size_t nSampleCount,
 						const int32_t nSampleRate)
 {
-	int16_t prev0 = last_values[0];
-	int16_t prev1 = last_values[1];
-	double time = start_time;
-	for (int i = 0; i < nSampleCount; i++)
+	// la fréquence d'échantillonnage est donnée à chaque bloc
+	m_Engine.set_sample_rate(nSampleRate);
+	m_Engine.process(pData,nSampleCount);
+	return true;
+}
+
+void CPeakDetector::GetState(struct detectorstate *pState) const
+{
+	m_Engine.getstate(pState);
+}
+
+void CPeakDetector::SetState(const struct detectorstate *pState)
+{
+	m_Engine.setstate(pState);
+}
+
+bool IAnalyser::SameState(const struct detectorstate *pA,
+						  const struct detectorstate *pB)
+{
+	return CPeakDetector::TEngine::samestate(pA,pB);
+}
+
+IAnalyser *IAnalyser::New(struct eventsink *pSink,
+						  const struct parameters *pParams)
+{
+	return new CPeakDetector(pSink,pParams);
+}
+
+/*************************************
+ * Analyse par segments en parallèle (voir peakdetector/segments.h) : les
+ * échantillons sont déjà en mémoire, et l'analyseur est vu comme un
+ * détecteur de peakdetector.
+ */
+struct detectordata
+{
+	IAnalyser *pAnalyser;
+	int32_t nSampleRate;
+};
+
+static int AnalyserProcess(const void *pData, size_t nSize,
+						   struct detectordata *pDetectorData)
+{
+	return pDetectorData->pAnalyser->ProcessData((const int16_t *)pData,nSize,
+		pDetectorData->nSampleRate) ? 0 : -1;
+}
+
+static int AnalyserTerminate(struct detector *pDetector)
+{
+	delete pDetector->data->pAnalyser;
+	free(pDetector->data);
+	free(pDetector);
+	return 0;
+}
+
+static void AnalyserGetState(const struct detectordata *pDetectorData,
+							 struct detectorstate *pState)
+{
+	pDetectorData->pAnalyser->GetState(pState);
+}
+
+static void AnalyserSetState(struct detectordata *pDetectorData,
+							 const struct detectorstate *pState)
+{
+	pDetectorData->pAnalyser->SetState(pState);
+}
+
+static struct detector *NewAnalyserDetector(uint32_t nSampleRate,
+											const struct parameters *pParams,
+											struct eventsink *pSink)
+{
+	struct detector *pDetector=(struct detector *)calloc(1,sizeof(struct detector));
+	if (!pDetector)
 	{
-	//	fprintf(stderr, "%d ", in[i]);
-		/* The actual sample rate seems to be only an approximation of
-		   SAMPLE_RATE, hence 'time + (double) i / SAMPLE_RATE' is only
-		   an estimation of the sampling time. */
-		if (peakp(prev0, prev1, pData[i], threshold))
-		{
-			count++;
-			printf("%.4f\t%6d\n", time + (double) i / nSampleRate,
-			       prev1);
-		}
-		prev0 = prev1;
-		prev1 = pData[i];
-		sample_number++;
+		return NULL;
 	}
-	last_values[0] = prev0;
-	last_values[1] = prev1;
-	last_spl_time = time + (nSampleCount - 1.0) / nSampleRate;
+	pDetector->data=(struct detectordata *)calloc(1,sizeof(struct detectordata));
+	if (!pDetector->data)
+	{
+		free(pDetector);
+		return NULL;
+	}
+	pDetector->name=(char *)"IAnalyser";
+	pDetector->detector=&AnalyserProcess;
+	pDetector->terminate=&AnalyserTerminate;
+	pDetector->getstate=&AnalyserGetState;
+	pDetector->setstate=&AnalyserSetState;
+	pDetector->samestate=&IAnalyser::SameState;
+	pDetector->data->pAnalyser=IAnalyser::New(pSink,pParams);
+	pDetector->data->nSampleRate=nSampleRate;
+	return pDetector;
+}
 
+// les échantillons sont lus directement dans la mémoire
+struct segmentsourcedata
+{
+	const int16_t *pData;
+};
+
+struct segmentreader
+{
+	const int16_t *pData;
+};
+
+static struct segmentreader *MemoryOpen(struct segmentsourcedata *pSourceData)
+{
+	struct segmentreader *pReader=(struct segmentreader *)malloc(sizeof(struct segmentreader));
+	if (pReader)
+	{
+		pReader->pData=pSourceData->pData;
+	}
+	return pReader;
+}
+
+static size_t MemoryRead(struct segmentreader *pReader, uint64_t nSpl,
+						 size_t nSize, const void **ppSamples)
+{
+	*ppSamples=pReader->pData+nSpl;
+	return nSize;
+}
+
+static void MemoryClose(struct segmentreader *pReader)
+{
+	free(pReader);
+}
+
+static bool ProcessSegments(const int16_t *pData,
+							const uint64_t nSampleCount,
+							const int32_t nSampleRate,
+							const struct parameters *pParams,
+							struct eventsink *pSink,
+							const int nJobs)
+{
+	struct segmentsourcedata SourceData={pData};
+	struct segmentsource Source;
+	Source.nb_samples=nSampleCount;
+	Source.open=&MemoryOpen;
+	Source.read=&MemoryRead;
+	Source.close=&MemoryClose;
+	Source.data=&SourceData;
+
+	struct segmentstats Stats;
+	if (analyse_segments(&Source,&NewAnalyserDetector,nSampleRate,pParams,
+		pSink,nJobs,&Stats))
+	{
+		return false;
+	}
+	fprintf(stderr,"%zu segments sur %d threads, %zu analyses refaites\n",
+		Stats.segments,nJobs,Stats.reruns);
 	return true;
 }
 
-IAnalyser *IAnalyser::New()
+/*************************************
+ * Sortie des évènements : texte sur la sortie standard, ou journal binaire
+ * si un nom de fichier est donné ("-" pour la sortie standard).
+ */
+static struct eventsink *CreateSink(const char *zLogFilename,
+									const int32_t nSampleRate,
+									const struct parameters *pParams,
+									const bool bLive,
+									FILE *&pLogFile)
 {
-	return new CCountData;
+	pLogFile=NULL;
+	if (!zLogFilename)
+	{
+		return init_textsink(stdout,nSampleRate);
+	}
+
+	pLogFile=strcmp(zLogFilename,"-") ? fopen(zLogFilename,"wb") : stdout;
+	if (!pLogFile)
+	{
+		fprintf(stderr,"Le fichier \"%s\" n'a pas pu etre ouvert.\n",
+			zLogFilename);
+		return NULL;
+	}
+	struct eventlog_header Header;
+	memset(&Header,0,sizeof(Header));
+	Header.sample_rate=nSampleRate;
+	// un flux lu sur l'entrée standard est supposé être en direct
+	Header.start_time=bLive ? time(NULL) : 0;
+	Header.threshold=pParams->noise_threshold;
+	Header.dead_time=0;
+	strcpy(Header.detector,"CPeakDetector");
+	struct eventsink *pSink=init_eventlogsink(pLogFile,&Header);
+	if (!pSink && pLogFile!=stdout)
+	{
+		fclose(pLogFile);
+		pLogFile=NULL;
+	}
+	return pSink;
 }
 
-#else
-class CPeakDetector : public IAnalyser
+static void DestroySink(struct eventsink *pSink, FILE *pLogFile)
 {
-public:
-	double m_fStartTime;
-	double m_fLastSplTime;   /* timestamp for the last sample processed */
-	uint64_t m_nCount;
-	uint64_t m_nSampleNumber;
-	int m_nThreshold; // detection threshold to filter noise
-	double m_fLeavingPeakTimeThreshold;
-	CPeakDetector();
-	virtual ~CPeakDetector();
-	virtual bool ProcessData(const int16_t *pData,
-						const int32_t nSampleCount,
-						const int32_t nSampleRate);
+	if (pSink)
+	{
+		pSink->terminate(pSink);
+	}
+	if (pLogFile && pLogFile!=stdout)
+	{
+		fclose(pLogFile);
+	}
+}
 
-private:
-	enum EState
-	{
-		EState_Noise,
-		EState_Peak,
-		EState_Leaving,
-	} m_eCurrentState;
-	double m_fLeavingPeakTime;
-	double m_fMaxPeakTime;
-	int m_nMaxPeakAmplitude;
-};
+/*************************************
+ * Mesure de la durée de l'analyse (option -t) : les évènements sont comptés
+ * au passage, le résultat est écrit sur la sortie d'erreur.
+ */
+static struct eventsink *CountEvents(struct eventsink *pSink,
+									 uint64_t *pnCount)
+{
+	if (!pSink || !pnCount)
+	{
+		return pSink;
+	}
+	// détruire le compteur détruit aussi pSink
+	struct eventsink *pCounter=init_countsink(pSink,pnCount);
+	if (!pCounter)
+	{
+		pSink->terminate(pSink);
+	}
+	return pCounter;
+}
 
-CPeakDetector::CPeakDetector()
-	: m_fStartTime(0.0)
-	, m_nCount(0)
-	, m_nThreshold(DEFAULT_THRESHOLD)
-	, m_fLastSplTime(0.0)
-	, m_nSampleNumber(0)
-	, m_eCurrentState(EState_Noise)
-	, m_fLeavingPeakTimeThreshold(DEFAULT_LEAVING_TIME_THRESHOLD)
+static double Now()
 {
+#if defined WIN32 && defined _MSC_VER
+	return (double)clock()/CLOCKS_PER_SEC;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec+ts.tv_nsec*1e-9;
+#endif
 }
 
-CPeakDetector::~CPeakDetector()
+static void PrintTiming(const uint64_t nSamples, const uint64_t nEvents,
+						const double dSeconds)
 {
+	fprintf(stderr,"CPeakDetector : %llu echantillons, %llu evenements en %.4f s"
+		" (%.1f Mech/s, %.0f evenements/s)\n",
+		(unsigned long long)nSamples,(unsigned long long)nEvents,dSeconds,
+		dSeconds>0 ? nSamples/dSeconds/1e6 : 0,
+		dSeconds>0 ? nEvents/dSeconds : 0);
 }
 
-bool CPeakDetector::ProcessData(const int16_t *pData,
-						const int32_t nSampleCount,
-						const int32_t nSampleRate)
+/* Analyse en flux : le fichier (ou l'entrée standard) est lu par blocs de
+ * nBlockSize échantillons dans un même buffer. La mémoire utilisée ne dépend
+ * pas de la longueur de l'enregistrement ; l'analyseur garde son état d'un
+ * bloc à l'autre, le résultat est donc le même qu'en une seule fois.
+ */
+static bool StreamWaveFile(const char *zFilename,
+						   const struct parameters *pParams,
+						   const int32_t nBlockSize,
+						   const char *zLogFilename,
+						   const bool bTiming)
 {
-	EState eCurrentState=m_eCurrentState;
-	const double fStartTime = m_fStartTime;
-	double fSampleTime=fStartTime;
+	const bool bStdin=!strcmp(zFilename,"-");
+	FILE *file=NULL;
+	int16_t *pBuffer=NULL;
+	struct eventsink *pSink=NULL;
+	FILE *pLogFile=NULL;
+	IAnalyser *pAnalyser=NULL;
+	uint64_t nSamples=0;
+	uint64_t nEvents=0;
+	const double dStart=Now();
+	int nError=0;
 
-	for (int i = 0; i < nSampleCount; i++)
+	// dummy loop
+	do
 	{
-		// on regarde si le sample actuel est dans la zone ou pas
-		const int nAbsSample=abs(pData[i]);
-		bool bAboveThreshold=nAbsSample>=m_nThreshold;
-		fSampleTime=fStartTime + (double) i / nSampleRate;
+		// on ouvre le fichier
+		file=bStdin ? stdin : fopen(zFilename,"rb");
+		if (!file)
+		{
+			nError=errno;
+			fprintf(stderr,"Le fichier \"%s\" n'a pas pu etre ouvert.\n",
+				zFilename);
+			break;
+		}
 
-	//	fprintf(stderr,"%.4lf\t%d\n", fSampleTime,pData[i]);
-		switch (eCurrentState)
+		WAVE Header;
+		// on lit l'entête
+		if (fread(&Header,sizeof(Header),1,file)!=1 || Header.fmt.Blockalign==0)
 		{
-			case EState_Noise:
-				if (bAboveThreshold)
-				{
-					// on vient de dépasser le seuil
-					// on a donc détecté un peak
-					
-					// on sauve les valeurs
-					m_fMaxPeakTime=fSampleTime;
-					m_nMaxPeakAmplitude=nAbsSample;
-
-					// on change l'état
-					eCurrentState=EState_Peak;
-				}
-				break;
+			nError=ferror(file) ? errno : EINVAL;
+			fprintf(stderr,"Erreur pendant la lecture de l'entete du fichier \"%s\".",
+				zFilename);
+			break;
+		}
+		if (!IsPCM16(Header,zFilename))
+		{
+			nError=EINVAL;
+			break;
+		}
+		const int32_t nSampleRate=Header.fmt.SampleRate;
+
+		// sur un tube, la taille des données n'est en général pas connue
+		uint64_t nRemaining=(Header.data.Subchunk2Size + 1ULL) / Header.fmt.Blockalign;
+		if (Header.data.Subchunk2Size==0 || Header.data.Subchunk2Size==0xFFFFFFFF)
+		{
+			nRemaining=UINT64_MAX;
+		}
 
-			case EState_Leaving:
-				// dans cette état, on a eu un pic et on est en dessous du seuil
-				// si on reste en dessous du seuil un certain temps, on considère qu'on a quitter le pic
-				// donc, on repasse en état Noise
-				// si on repasse au dessus du pic, le pic n'est pas terminé
-				// on revient dans l'état Peak
-				if (!bAboveThreshold)
-				{
-					// on est en dessous du seuil
-					// on regarde si ça fait longtemps
-					if ( (fSampleTime-m_fLeavingPeakTime) > m_fLeavingPeakTimeThreshold)
-					{
-						// le pic est passé
-						m_nCount++;
-
-						printf("%.4lf\t%6d\n", m_fMaxPeakTime, m_nMaxPeakAmplitude);
-						// on passe à l'état Noise
-						eCurrentState=EState_Noise;
-					}
-					break;
-				}
-				// on est repassé au dessus du seuil, on n'est donc pas sorti du pic
-				eCurrentState=EState_Peak;
-
-			case EState_Peak:
-				if (bAboveThreshold)
-				{
-					// tant qu'on est au dessus du seuil, on met seulement à jour les valeurs
-					// on cherche le plus gros peak
-					if (m_nMaxPeakAmplitude<nAbsSample)
-					{
-						m_fMaxPeakTime=fSampleTime;
-						m_nMaxPeakAmplitude=nAbsSample;
-					}
-				}
-				else
-				{
-					// on est redescendu en dessous du seuil
-					// on passe dans l'état Leaving
-					m_fLeavingPeakTime=fSampleTime;
-					eCurrentState=EState_Leaving;
-				}
+		pSink=CountEvents(CreateSink(zLogFilename,nSampleRate,pParams,bStdin,
+			pLogFile),
+			bTiming ? &nEvents : NULL);
+		if (!pSink)
+		{
+			nError=errno ? errno : EINVAL;
+			break;
+		}
+		pBuffer=(int16_t *)malloc(nBlockSize*sizeof(int16_t));
+		if (!pBuffer)
+		{
+			nError=errno;
+			fprintf(stderr,"Erreur pendant l'allocation du buffer (%d echantillons).",
+				nBlockSize);
+			break;
+		}
+		pAnalyser=IAnalyser::New(pSink,pParams);
+
+		while (nRemaining>0)
+		{
+			const size_t nWanted=(nRemaining<(uint64_t)nBlockSize) ? (size_t)nRemaining : nBlockSize;
+			const size_t nRead=fread(pBuffer,sizeof(int16_t),nWanted,file);
+			if (nRead==0)
+			{
 				break;
+			}
+			pAnalyser->ProcessData(pBuffer,nRead,nSampleRate);
+			nRemaining-=nRead;
+			nSamples+=nRead;
 		}
+		if (ferror(file))
+		{
+			nError=errno;
+			fprintf(stderr,"Erreur pendant la lecture du fichier \"%s\".",
+				zFilename);
+			break;
+		}
+		// tout est ok!
+	} while (false);
+
+	// si erreur, on laisse un petit message
+	if (nError)
+	{
+		fprintf(stderr,"Erreur %d (%s)\n",
+			nError,strerror(nError));
 	}
-	// on sauve l'état pour les échantillons suivants
-	m_eCurrentState=eCurrentState;
-	m_fStartTime=fSampleTime;
 
-	return true;
-}
+	// on nettoie
+	delete pAnalyser;
+	DestroySink(pSink,pLogFile);
+	free(pBuffer);
+	if (bTiming && nError==0)
+	{
+		PrintTiming(nSamples,nEvents,Now()-dStart);
+	}
+	if (file && !bStdin)
+	{
+		// on ferme le fichier
+		fclose(file);
+	}
 
-IAnalyser *IAnalyser::New()
-{
-	return new CPeakDetector;
+	return nError==0;
 }
-#endif
 
-static bool ProcessFile(const char *zFilename, const int nThreshold)
+static bool ProcessFile(const char *zFilename, const int nThreshold,
+						const int32_t nBlockSize, const char *zLogFilename,
+						const int nJobs, const bool bTiming)
 {
-	int16_t *pData;
-	int32_t nSampleCount;
+	// seul le seuil est réglable, sans temps mort, sur des échantillons 16 bits
+	struct parameters Params;
+	memset(&Params,0,sizeof(Params));
+	Params.noise_threshold=nThreshold;
+	Params.geiger_dead_time=0;
+	Params.dead_time_model=DEADTIME_NONE;
+	Params.sample_format=SAMPLE_INT16;
+
+	if (nBlockSize>0)
+	{
+		return StreamWaveFile(zFilename,&Params,nBlockSize,zLogFilename,bTiming);
+	}
+
+	uint64_t nSampleCount;
 	int32_t nSampleRate;
 
+#if defined WIN32 && defined _MSC_VER
+	int16_t *pData;
 	if (!ReadWaveFile(zFilename,pData,nSampleCount,nSampleRate))
 	{
 		return false;
 	}
+#else
+	const int16_t *pData;
+	void *pMap;
+	size_t nMapSize;
+	if (!MapWaveFile(zFilename,pData,nSampleCount,nSampleRate,pMap,nMapSize))
+	{
+		return false;
+	}
+#endif
 	
-	IAnalyser *pAnalyser=IAnalyser::New();
+	FILE *pLogFile;
+	uint64_t nEvents=0;
+	const double dStart=Now();
+	struct eventsink *pSink=CountEvents(
+		CreateSink(zLogFilename,nSampleRate,&Params,false,pLogFile),
+		bTiming ? &nEvents : NULL);
+	bool bOk=pSink!=NULL;
+	if (bOk && nJobs>1)
+	{
+		bOk=ProcessSegments(pData,nSampleCount,nSampleRate,&Params,pSink,nJobs);
+	}
+	else if (bOk)
+	{
+		IAnalyser *pAnalyser=IAnalyser::New(pSink,&Params);
 
-	pAnalyser->ProcessData(pData,nSampleCount,nSampleRate);
+		pAnalyser->ProcessData(pData,(size_t)nSampleCount,nSampleRate);
 
-	delete pAnalyser;
+		delete pAnalyser;
+	}
+	DestroySink(pSink,pLogFile);
+	if (bOk && bTiming)
+	{
+		PrintTiming(nSampleCount,nEvents,Now()-dStart);
+	}
 
+#if defined WIN32 && defined _MSC_VER
 	free(pData);
-	return true;
+#else
+	UnmapWaveFile(pMap,nMapSize);
+#endif
+	return bOk;
 }
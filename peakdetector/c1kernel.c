@@ -0,0 +1,118 @@
+/* Geiger counter listener prototype - 2012
+ * by "Cyrus Smith" for "Le Projet Olduva"
+ *
+ * See http://le-projet-olduvai.wikiforum.net/t6044-projet-de-logiciel-pour-compteur-geiger-muller
+ *
+ * This code is under GNU GPLv3.
+ *
+ * C1 peak detection kernel, shared by the C1 detector, geiger and geigerwave.
+ *
+ * The original algorithm uses a crude derivative:
+ *	evolution(v1, v2, th) = (v2 - v1) / th, saturated to an int8_t
+ * and (a, b, c) is a positive peak when
+ *	evolution(a, b, th) >= 0 && evolution(b, c, th) < 0 && b > th
+ * Only the sign of the derivative is used, and the saturation does not change
+ * it. As the division truncates toward zero, for th > 0:
+ *	(b - a) / th >= 0  <=>  b - a > -th
+ *	(c - b) / th < 0   <=>  c - b <= -th
+ * which is what is computed here, without any division, on whole buffers.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "c1kernel.h"
+
+static inline bool
+c1_peakp(int32_t a, int32_t b, int32_t c, int32_t th)
+{
+	return b - a > -th && c - b <= -th && b > th;
+}
+
+/* Set the n bits of bits at position i of the mask. */
+static inline void
+setbits(uint64_t *mask, size_t i, uint64_t bits, unsigned int n)
+{
+	const unsigned int shift = i % 64;
+	mask[i / 64] |= bits << shift;
+	if (shift + n > 64)
+		mask[i / 64 + 1] |= bits >> (64 - shift);
+}
+
+void
+c1_peakmask(const int16_t *in, size_t size, const int16_t last_values[2],
+	    int32_t threshold, uint64_t *mask)
+{
+	assert(threshold > 0);
+	memset(mask, 0, C1_MASK_WORDS(size) * sizeof *mask);
+	if (threshold > INT16_MAX)
+		return; /* b > threshold is impossible */
+
+	size_t i = 0;
+	/* The first two triplets use the values from the previous buffer. */
+	if (size > 0 && c1_peakp(last_values[0], last_values[1], in[0],
+				 threshold))
+		mask[0] |= 1;
+	if (size > 1 && c1_peakp(last_values[1], in[0], in[1], threshold))
+		mask[0] |= 2;
+	i = 2;
+
+	/* The differences are computed with saturation: as -threshold and
+	   1 - threshold are representable, the comparisons are unchanged. */
+#if defined(__AVX2__)
+	const __m256i mth = _mm256_set1_epi16((int16_t) -threshold);
+	const __m256i th1 = _mm256_set1_epi16((int16_t) (1 - threshold));
+	const __m256i th = _mm256_set1_epi16((int16_t) threshold);
+	for (; i + 32 <= size; i += 32) {
+		__m256i m[2];
+		for (int k = 0; k < 2; k++) {
+			const int16_t *p = in + i + 16 * k;
+			__m256i a = _mm256_loadu_si256((const __m256i *) (p - 2));
+			__m256i b = _mm256_loadu_si256((const __m256i *) (p - 1));
+			__m256i c = _mm256_loadu_si256((const __m256i *) p);
+			__m256i le = _mm256_cmpgt_epi16(_mm256_subs_epi16(b, a),
+							mth);
+			__m256i ce = _mm256_cmpgt_epi16(th1,
+							_mm256_subs_epi16(c, b));
+			m[k] = _mm256_and_si256(_mm256_and_si256(le, ce),
+						_mm256_cmpgt_epi16(b, th));
+		}
+		/* packs works on 128-bit lanes: put the bytes back in order */
+		__m256i packed = _mm256_permute4x64_epi64(
+			_mm256_packs_epi16(m[0], m[1]), 0xD8);
+		uint32_t bits = (uint32_t) _mm256_movemask_epi8(packed);
+		if (bits)
+			setbits(mask, i, bits, 32);
+	}
+#elif defined(__SSE2__)
+	const __m128i mth = _mm_set1_epi16((int16_t) -threshold);
+	const __m128i th1 = _mm_set1_epi16((int16_t) (1 - threshold));
+	const __m128i th = _mm_set1_epi16((int16_t) threshold);
+	for (; i + 16 <= size; i += 16) {
+		__m128i m[2];
+		for (int k = 0; k < 2; k++) {
+			const int16_t *p = in + i + 8 * k;
+			__m128i a = _mm_loadu_si128((const __m128i *) (p - 2));
+			__m128i b = _mm_loadu_si128((const __m128i *) (p - 1));
+			__m128i c = _mm_loadu_si128((const __m128i *) p);
+			__m128i le = _mm_cmpgt_epi16(_mm_subs_epi16(b, a), mth);
+			__m128i ce = _mm_cmplt_epi16(_mm_subs_epi16(c, b), th1);
+			m[k] = _mm_and_si128(_mm_and_si128(le, ce),
+					     _mm_cmpgt_epi16(b, th));
+		}
+		uint32_t bits = (uint32_t)
+			_mm_movemask_epi8(_mm_packs_epi16(m[0], m[1]));
+		if (bits)
+			setbits(mask, i, bits, 16);
+	}
+#endif
+	for (; i < size; i++) {
+		if (c1_peakp(in[i - 2], in[i - 1], in[i], threshold))
+			mask[i / 64] |= (uint64_t) 1 << (i % 64);
+	}
+}
@@ -0,0 +1,26 @@
+#ifndef _C1KERNEL_H_
+#define _C1KERNEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Number of 64-bit words of a mask covering size samples. */
+#define C1_MASK_WORDS(size) (((size) + 63) / 64)
+
+/* Look for the C1 peaks in in[0..size-1]. Bit i of mask is set when the
+   triplet (in[i-2], in[i-1], in[i]) is a peak, i.e. in[i-1] is the top of a
+   peak that is confirmed by in[i]. The values preceding in[0] are taken from
+   last_values. mask must hold C1_MASK_WORDS(size) words. */
+void c1_peakmask(const int16_t *in, size_t size,
+		 const int16_t last_values[2], int32_t threshold,
+		 uint64_t *mask);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_C1KERNEL_H_ */
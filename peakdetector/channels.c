@@ -0,0 +1,350 @@
+/* Geiger counter listener prototype - 2012
+ * by "Cyrus Smith" for "Le Projet Olduva"
+ *
+ * See http://le-projet-olduvai.wikiforum.net/t6044-projet-de-logiciel-pour-compteur-geiger-muller
+ *
+ * This code is under GNU GPLv3.
+ *
+ * Multi-channel recordings, see channels.h.
+ *
+ * The samples of a frame are interleaved in the recordings, but each
+ * detector wants the contiguous samples of its channel. On x86-64, the usual
+ * stereo and 4-channel cases are split with SSE2: a stereo frame is a 32-bit
+ * word, whose two halves are extracted with shifts and packed back to 16
+ * bits; a 4-channel frame is first split in two stereo pairs with 32-bit
+ * shuffles. The stereo frames of 32-bit samples (int32_t or float) are split
+ * with the same shuffles.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "channels.h"
+
+static void
+deinterleave_scalar(const int16_t *in, size_t from, size_t frames,
+		    unsigned channels, int16_t *const *out)
+{
+	for (size_t f = from; f < frames; f++)
+		for (unsigned c = 0; c < channels; c++)
+			out[c][f] = in[f * channels + c];
+}
+
+#if defined(__SSE2__)
+/* Low and high 16-bit halves of the 32-bit words of a and b, the 4 words of
+   a first. */
+static inline __m128i
+low_halves(__m128i a, __m128i b)
+{
+	return _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16),
+			       _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+}
+
+static inline __m128i
+high_halves(__m128i a, __m128i b)
+{
+	return _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+}
+
+/* 8 frames at a time */
+static size_t
+deinterleave2(const int16_t *in, size_t frames, int16_t *l, int16_t *r)
+{
+	size_t f;
+	for (f = 0; f + 8 <= frames; f += 8) {
+		const __m128i *p = (const __m128i *) (in + 2 * f);
+		const __m128i a = _mm_loadu_si128(p);
+		const __m128i b = _mm_loadu_si128(p + 1);
+		_mm_storeu_si128((__m128i *) (l + f), low_halves(a, b));
+		_mm_storeu_si128((__m128i *) (r + f), high_halves(a, b));
+	}
+	return f;
+}
+
+/* Stereo pairs (0, 1) and (2, 3) of two frames a, then of two frames b. */
+static inline void
+split_pairs(__m128i a, __m128i b, __m128i *p01, __m128i *p23)
+{
+	a = _mm_shuffle_epi32(a, _MM_SHUFFLE(3, 1, 2, 0));
+	b = _mm_shuffle_epi32(b, _MM_SHUFFLE(3, 1, 2, 0));
+	*p01 = _mm_unpacklo_epi64(a, b);
+	*p23 = _mm_unpackhi_epi64(a, b);
+}
+
+/* 8 frames at a time */
+static size_t
+deinterleave4(const int16_t *in, size_t frames, int16_t *const *out)
+{
+	size_t f;
+	for (f = 0; f + 8 <= frames; f += 8) {
+		const __m128i *p = (const __m128i *) (in + 4 * f);
+		__m128i x01, x23, y01, y23;
+		split_pairs(_mm_loadu_si128(p), _mm_loadu_si128(p + 1),
+			    &x01, &x23);
+		split_pairs(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3),
+			    &y01, &y23);
+		_mm_storeu_si128((__m128i *) (out[0] + f),
+				 low_halves(x01, y01));
+		_mm_storeu_si128((__m128i *) (out[1] + f),
+				 high_halves(x01, y01));
+		_mm_storeu_si128((__m128i *) (out[2] + f),
+				 low_halves(x23, y23));
+		_mm_storeu_si128((__m128i *) (out[3] + f),
+				 high_halves(x23, y23));
+	}
+	return f;
+}
+#endif
+
+void
+deinterleave(const int16_t *in, size_t frames, unsigned channels,
+	     int16_t *const *out)
+{
+	assert(channels > 0);
+	size_t f = 0;
+	if (channels == 1) {
+		memcpy(out[0], in, frames * sizeof *in);
+		return;
+	}
+#if defined(__SSE2__)
+	if (channels == 2)
+		f = deinterleave2(in, frames, out[0], out[1]);
+	else if (channels == 4)
+		f = deinterleave4(in, frames, out);
+#endif
+	deinterleave_scalar(in, f, frames, channels, out);
+}
+
+#if defined(__SSE2__)
+/* Stereo frames of 32-bit samples */
+static size_t
+deinterleave2_32(const uint32_t *in, size_t frames, uint32_t *l, uint32_t *r)
+{
+	size_t f = 0;
+	for (; f + 4 <= frames; f += 4) {
+		__m128 a = _mm_loadu_ps((const float *) (in + 2 * f));
+		__m128 b = _mm_loadu_ps((const float *) (in + 2 * f + 4));
+		_mm_storeu_ps((float *) (l + f),
+			      _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm_storeu_ps((float *) (r + f),
+			      _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+	}
+	return f;
+}
+#endif
+
+void
+deinterleave_samples(const void *in, size_t frames, unsigned channels,
+		     size_t size, void *const *out)
+{
+	assert(channels > 0);
+	if (channels == 1) {
+		memcpy(out[0], in, frames * size);
+		return;
+	}
+	if (size == sizeof(int16_t)) {
+		int16_t *planes[channels];
+		for (unsigned c = 0; c < channels; c++)
+			planes[c] = out[c];
+		deinterleave(in, frames, channels, planes);
+		return;
+	}
+
+	size_t f = 0;
+	if (size == sizeof(uint32_t)) {
+		const uint32_t *in32 = in;
+#if defined(__SSE2__)
+		if (channels == 2)
+			f = deinterleave2_32(in32, frames, out[0], out[1]);
+#endif
+		for (; f < frames; f++)
+			for (unsigned c = 0; c < channels; c++)
+				((uint32_t *) out[c])[f] =
+					in32[f * channels + c];
+		return;
+	}
+	const unsigned char *bytes = in;
+	for (; f < frames; f++)
+		for (unsigned c = 0; c < channels; c++)
+			memcpy((unsigned char *) out[c] + f * size,
+			       bytes + (f * channels + c) * size, size);
+}
+
+void
+interleave(const int16_t *const *in, size_t frames, unsigned channels,
+	   int16_t *out)
+{
+	assert(channels > 0);
+	for (size_t f = 0; f < frames; f++)
+		for (unsigned c = 0; c < channels; c++)
+			out[f * channels + c] = in[c][f];
+}
+
+
+/* Channel sink: tags the events of a detector and stores them in the merge */
+
+#define CHANNEL_TAGGED (UINT32_MAX) /* the events keep their channel */
+
+struct channelmerge {
+	struct eventsink *next;
+	unsigned channels;
+	struct eventsink **sinks;  /* channels, then the tagged input */
+	struct event *ev;  /* events not yet passed to next */
+	size_t nb;
+	size_t size;
+};
+
+struct eventsinkdata {
+	struct channelmerge *merge;
+	uint32_t channel;
+};
+
+static void
+channelsink_write(const struct event *ev, size_t nb,
+		  struct eventsinkdata *data)
+{
+	struct channelmerge *m = data->merge;
+	if (m->nb + nb > m->size) {
+		m->size = 2 * m->size > m->nb + nb ?
+			2 * m->size : m->nb + nb + 1024;
+		m->ev = realloc(m->ev, m->size * sizeof(struct event));
+		assert(m->ev != NULL);
+	}
+	memcpy(m->ev + m->nb, ev, nb * sizeof(struct event));
+	if (data->channel != CHANNEL_TAGGED)
+		for (size_t i = 0; i < nb; i++)
+			m->ev[m->nb + i].channel = data->channel;
+	m->nb += nb;
+}
+
+static void
+channelsink_flush(struct eventsinkdata *data)
+{
+}
+
+static int
+terminate_channelsink(struct eventsink *sink)
+{
+	assert(sink != NULL);
+	assert(sink->data != NULL);
+	free(sink->data);
+	free(sink);
+	return 0;
+}
+
+static struct eventsink*
+init_channelsink(struct channelmerge *merge, uint32_t channel)
+{
+	struct eventsink *sink = calloc(1, sizeof(struct eventsink));
+	if (sink == NULL)
+		return NULL;
+	sink->data = calloc(1, sizeof(struct eventsinkdata));
+	if (sink->data == NULL) {
+		free(sink);
+		return NULL;
+	}
+
+	sink->name = "channel";
+	sink->write = &channelsink_write;
+	sink->flush = &channelsink_flush;
+	sink->terminate = &terminate_channelsink;
+	sink->data->merge = merge;
+	sink->data->channel = channel;
+	return sink;
+}
+
+
+/* Merge */
+
+struct channelmerge*
+channelmerge_new(struct eventsink *next, unsigned channels)
+{
+	assert(next != NULL);
+	assert(channels > 0);
+	struct channelmerge *m = calloc(1, sizeof(struct channelmerge));
+	if (m == NULL)
+		return NULL;
+	m->next = next;
+	m->channels = channels;
+	m->sinks = calloc(channels + 1, sizeof(struct eventsink *));
+	if (m->sinks == NULL) {
+		free(m);
+		return NULL;
+	}
+	for (unsigned c = 0; c <= channels; c++) {
+		m->sinks[c] = init_channelsink(m, c < channels ? c
+					       : CHANNEL_TAGGED);
+		if (m->sinks[c] == NULL) {
+			channelmerge_free(m);
+			return NULL;
+		}
+	}
+	return m;
+}
+
+struct eventsink*
+channelmerge_sink(struct channelmerge *m, unsigned channel)
+{
+	assert(m != NULL);
+	assert(channel < m->channels);
+	return m->sinks[channel];
+}
+
+struct eventsink*
+channelmerge_input(struct channelmerge *m)
+{
+	assert(m != NULL);
+	return m->sinks[m->channels];
+}
+
+static int
+compare_events(const void *a, const void *b)
+{
+	const struct event *ea = a, *eb = b;
+	if (ea->spl != eb->spl)
+		return ea->spl < eb->spl ? -1 : 1;
+	return (ea->channel > eb->channel) - (ea->channel < eb->channel);
+}
+
+void
+channelmerge_flush(struct channelmerge *m, uint64_t spl)
+{
+	assert(m != NULL);
+	if (m->nb == 0)
+		return;
+	qsort(m->ev, m->nb, sizeof(struct event), &compare_events);
+	size_t n = 0;
+	while (n < m->nb && m->ev[n].spl < spl)
+		n++;
+	if (n == 0)
+		return;
+	m->next->write(m->ev, n, m->next->data);
+	memmove(m->ev, m->ev + n, (m->nb - n) * sizeof(struct event));
+	m->nb -= n;
+}
+
+size_t
+channelmerge_held(const struct channelmerge *m)
+{
+	assert(m != NULL);
+	return m->nb;
+}
+
+void
+channelmerge_free(struct channelmerge *m)
+{
+	if (m == NULL)
+		return;
+	if (m->sinks != NULL)
+		for (unsigned c = 0; c <= m->channels; c++)
+			if (m->sinks[c] != NULL)
+				m->sinks[c]->terminate(m->sinks[c]);
+	free(m->sinks);
+	free(m->ev);
+	free(m);
+}
@@ -0,0 +1,68 @@
+#ifndef _CHANNELS_H_
+#define _CHANNELS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "eventsink.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Multi-channel recordings: each channel has its own detector, and the
+ * events of all the detectors are tagged with their channel and merged into
+ * a single stream of events.
+ */
+
+#define MAX_CHANNELS (16)
+
+/* Split frames interleaved frames of channels samples into the channels
+   arrays out[0..channels-1], of at least frames samples each. */
+void deinterleave(const int16_t *in, size_t frames, unsigned channels,
+		  int16_t *const *out);
+
+/* The reverse: write frames frames of channels samples to out. */
+void interleave(const int16_t *const *in, size_t frames, unsigned channels,
+		int16_t *out);
+
+/* deinterleave() for samples of any format, of size bytes each (see
+   sample_size() in peakdetector.h). */
+void deinterleave_samples(const void *in, size_t frames, unsigned channels,
+			  size_t size, void *const *out);
+
+struct channelmerge;
+
+/* Merge of the events of channels detectors into next. The events are kept
+   until channelmerge_flush() passes them to next, ordered by time. The
+   number of channels is not limited to MAX_CHANNELS. */
+struct channelmerge* channelmerge_new(struct eventsink *next,
+				      unsigned channels);
+
+/* Sink of the detector of a channel: it sets the channel of its events.
+   Owned by the merge. */
+struct eventsink* channelmerge_sink(struct channelmerge *merge,
+				    unsigned channel);
+
+/* Sink of events already tagged with their channel, from any channel.
+   Owned by the merge. */
+struct eventsink* channelmerge_input(struct channelmerge *merge);
+
+/* Pass the events before sample spl to next. They reach next in order only
+   if no detector can still report an event before spl: a detector may
+   report an event well after its sample, PEAK only once the pulse is over.
+   Use the lowest pending() of the detectors (see struct detector), and
+   UINT64_MAX at the end of the stream. */
+void channelmerge_flush(struct channelmerge *merge, uint64_t spl);
+
+/* Number of events kept by the merge, not yet passed to next. */
+size_t channelmerge_held(const struct channelmerge *merge);
+
+/* Free the merge and the sinks of the channels, but not next. */
+void channelmerge_free(struct channelmerge *merge);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_CHANNELS_H_ */
@@ -0,0 +1,191 @@
+#!/bin/sh
+# Geiger counter listener prototype - 2012
+# by "Cyrus Smith" for "Le Projet Olduvai"
+#
+# This code is under GNU GPLv3.
+#
+# Accuracy regression test of the detectors, run by "make check":
+#    $ sh check.sh [geigerwave]
+#
+# 1. On synthetic recordings (geigergen), each detector must find the pulses
+#    within CHECK_TOL seconds, with at most the given ratios of misses and of
+#    false positives: a little above what the detectors do today.
+# 2. The stream (stdin) and parallel (-j) analyses must give exactly the
+#    events of the analysis of the file.
+# 3. On multi-channel recordings, each channel must give exactly the events
+#    of the analysis of that channel alone, and the merged text output must
+#    stay in order.
+# 4. The 8, 24 and 32-bit integer and float recordings of a signal must give
+#    exactly the events of its 16-bit recording (geigergen -f, with -Q 8
+#    for the 8-bit samples).
+# 5. If check_ref/ exists ("make checkref", with a known good build), the
+#    events must be exactly the ones recorded there: an optimization of a
+#    kernel must not change anything.
+# 6. If TARSO_WAV is the recording of test_data/geiger_tarso.wav.txt, the
+#    detectors are compared with that list (report only).
+
+GEIGERWAVE=$1
+CHECK_TOL=${CHECK_TOL:-0.001}
+REF=check_ref
+failed=0
+
+fail() {
+	echo "FAILED: $*"
+	failed=$((failed + 1))
+}
+
+# signal name, geigergen options
+signal() {
+	[ -f $1.wav ] || ./geigergen $2 -t $1.txt $1.wav 2>/dev/null \
+		|| { fail "geigergen $2"; return 1; }
+}
+
+# detector, signal, output event log
+run() {
+	case $1 in
+	CPeakDetector) $GEIGERWAVE -o $3 $2.wav 2>/dev/null ;;
+	*) ./peakdetector -o $3 $1 $2.wav 2>/dev/null ;;
+	esac
+}
+
+# detector, signal, miss ratio, false positive ratio
+accuracy() {
+	[ $1 = CPeakDetector ] && [ -z "$GEIGERWAVE" ] && return
+	echo "== $1 on $2"
+	out=$2.$1.gevl
+	if ! run $1 $2 $out; then
+		fail "$1 on $2"
+		return
+	fi
+	./evcompare -t $CHECK_TOL -m $3 -f $4 $2.txt $out \
+		|| fail "$1 on $2: accuracy"
+
+	# the same events by the other ways to analyse a recording
+	case $1 in
+	CPeakDetector)
+		$GEIGERWAVE -j 3 -o check.gevl $2.wav 2>/dev/null \
+			&& ./evcompare -x -q $out check.gevl \
+			|| fail "$1 on $2: -j 3"
+		$GEIGERWAVE -o check.gevl < $2.wav 2>/dev/null \
+			&& ./evcompare -x -q $out check.gevl \
+			|| fail "$1 on $2: stdin"
+		;;
+	*)
+		./peakdetector -j 3 -o check.gevl $1 $2.wav 2>/dev/null \
+			&& ./evcompare -x -q $out check.gevl \
+			|| fail "$1 on $2: -j 3"
+		./peakdetector -o check.gevl $1 < $2.wav 2>/dev/null \
+			&& ./evcompare -x -q $out check.gevl \
+			|| fail "$1 on $2: stdin"
+		;;
+	esac
+
+	if [ -d $REF ]; then
+		if [ -f $REF/$out ]; then
+			./evcompare -x -q $REF/$out $out \
+				|| fail "$1 on $2: differs from $REF"
+		else
+			cp $out $REF/$out
+		fi
+	fi
+}
+
+# signal name, channels, seed, geigergen options: the recording, and each of
+# its channels alone (name_0, name_1...)
+multisignal() {
+	signal $1 "$4 -S $3 -C $2" || return 1
+	c=0
+	while [ $c -lt $2 ]; do
+		signal $1_$c "$4 -S $(($3 + c))" || return 1
+		c=$((c + 1))
+	done
+}
+
+# detector, signal name, channels
+channels() {
+	echo "== $1 on $2"
+	out=$2.$1.gevl
+	if ! ./peakdetector -o $out $1 $2.wav 2>/dev/null; then
+		fail "$1 on $2"
+		return
+	fi
+	c=0
+	while [ $c -lt $3 ]; do
+		./peakdetector -o check.gevl $1 $2_$c.wav 2>/dev/null \
+			&& ./evcompare -x -q -c $c check.gevl $out \
+			|| fail "$1 on $2: channel $c"
+		c=$((c + 1))
+	done
+	./peakdetector $1 < $2.wav 2>/dev/null | sort -c -s -n -k1,1 \
+		2>/dev/null || fail "$1 on $2: events out of order"
+}
+
+# detector, signal name, format: the events of name_format.wav must be
+# those of name.wav
+sameformat() {
+	echo "== $1 on $2 ($3)"
+	./peakdetector -o check.gevl $1 $2.wav 2>/dev/null \
+		&& ./peakdetector -o check_format.gevl $1 $2_$3.wav \
+			2>/dev/null \
+		&& ./evcompare -x -q check.gevl check_format.gevl \
+		|| fail "$1 on $2 ($3)"
+}
+
+# 20 pulses/s, some piled up
+signal check_20 "-d 300 -c 20 -S 11" || exit 1
+accuracy C1 check_20 0.07 0.2
+accuracy PPP check_20 0.02 0.04
+accuracy CPeakDetector check_20 0.02 0.01
+
+# 300 pulses/s with the dead time of the tube, more noise, and mains hum
+signal check_300 "-d 300 -c 300 -T 0.001 -n 60 -m 200 -S 12" || exit 1
+accuracy C1 check_300 0.05 0.45
+accuracy PPP check_300 0.01 0.25
+accuracy CPeakDetector check_300 0.01 0.01
+
+# two and three tubes with long pulses, which PEAK reports well after their
+# highest sample
+multisignal check_2ch 2 21 "-d 60 -c 300 -R 0.0001 -D 0.002" || exit 1
+multisignal check_3ch 3 31 "-d 60 -c 100 -R 0.0001 -D 0.002" || exit 1
+for d in C1 PPP PEAK; do
+	channels $d check_2ch 2
+	channels $d check_3ch 3
+done
+
+# the sample formats, on a signal of 8 bits, and on two tubes
+opts="-d 60 -c 300 -n 60 -m 200 -S 41 -Q 8"
+signal check_fmt "$opts" || exit 1
+for f in int8 int24 int32 float; do
+	signal check_fmt_$f "$opts -f $f" || exit 1
+done
+opts="-d 60 -c 300 -R 0.0001 -D 0.002 -S 21 -C 2"
+for f in int24 int32 float; do
+	signal check_2ch_$f "$opts -f $f" || exit 1
+done
+for d in C1 PPP PEAK; do
+	for f in int8 int24 int32 float; do
+		sameformat $d check_fmt $f
+	done
+	for f in int24 int32 float; do
+		sameformat $d check_2ch $f
+	done
+done
+
+if [ -n "$TARSO_WAV" ]; then
+	for d in C1 PPP CPeakDetector; do
+		[ $d = CPeakDetector ] && [ -z "$GEIGERWAVE" ] && continue
+		echo "== $d on $TARSO_WAV"
+		case $d in
+		CPeakDetector) $GEIGERWAVE -o check.gevl $TARSO_WAV 2>/dev/null ;;
+		*) ./peakdetector -o check.gevl $d $TARSO_WAV 2>/dev/null ;;
+		esac && ./evcompare -t $CHECK_TOL ../test_data/geiger_tarso.wav.txt \
+			check.gevl || fail "$d on $TARSO_WAV"
+	done
+fi
+rm -f check.gevl check_format.gevl
+
+if [ $failed -ne 0 ]; then
+	echo "$failed check(s) failed"
+	exit 1
+fi
+echo "All checks passed"
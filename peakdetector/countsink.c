@@ -0,0 +1,69 @@
+/* Geiger counter listener prototype - 2012
+ * by "Cyrus Smith" for "Le Projet Olduva"
+ *
+ * See http://le-projet-olduvai.wikiforum.net/t6044-projet-de-logiciel-pour-compteur-geiger-muller
+ *
+ * This code is under GNU GPLv3.
+ *
+ * Counting sink: counts the events, and passes them to another sink if
+ * any. Used for the statistics of the batch mode and by the benchmarks.
+ */
+
+#include <assert.h>
+
+#include "eventsink.h"
+
+struct eventsinkdata {
+	struct eventsink *next;
+	uint64_t *count;
+};
+
+static void
+countsink_write(const struct event *ev, size_t nb, struct eventsinkdata *data)
+{
+	*data->count += nb;
+	if (data->next != NULL)
+		data->next->write(ev, nb, data->next->data);
+}
+
+static void
+countsink_flush(struct eventsinkdata *data)
+{
+	if (data->next != NULL)
+		data->next->flush(data->next->data);
+}
+
+static int
+terminate_countsink(struct eventsink *sink)
+{
+	assert(sink != NULL);
+	assert(sink->data != NULL);
+	int ret = 0;
+	if (sink->data->next != NULL)
+		ret = sink->data->next->terminate(sink->data->next);
+	free(sink->data);
+	free(sink);
+	return ret;
+}
+
+struct eventsink*
+init_countsink(struct eventsink *next, uint64_t *count)
+{
+	assert(count != NULL);
+	struct eventsink *sink = calloc(1, sizeof(struct eventsink));
+	if (sink == NULL)
+		return NULL;
+	sink->data = calloc(1, sizeof(struct eventsinkdata));
+	if (sink->data == NULL) {
+		free(sink);
+		return NULL;
+	}
+
+	sink->name = "count";
+	sink->write = &countsink_write;
+	sink->flush = &countsink_flush;
+	sink->terminate = &terminate_countsink;
+	sink->data->next = next;
+	sink->data->count = count;
+	return sink;
+}
@@ -0,0 +1,49 @@
+/* Geiger counter listener prototype - 2012
+ * by "Cyrus Smith" for "Le Projet Olduva"
+ *
+ * See http://le-projet-olduvai.wikiforum.net/t6044-projet-de-logiciel-pour-compteur-geiger-muller
+ *
+ * This code is under GNU GPLv3.
+ *
+ * Correction of the count rate for the Geiger dead time (see
+ * deadtime_true_rate() in peakdetector.h). With a dead time tau, a true
+ * rate n gives the measured rate
+ *	m = n / (1 + n tau)       with the non-paralyzable model,
+ *	m = n exp(-n tau)         with the paralyzable model.
+ * The first one is inverted directly; the second one has two solutions,
+ * the lower one is taken, by Newton's method.
+ */
+
+#include <math.h>
+
+#include "peakdetector.h"
+
+#define NEWTON_ITER (100)
+
+double
+deadtime_true_rate(double rate, double dead_time, enum deadtime_model model)
+{
+	if (model == DEADTIME_NONE || dead_time <= 0 || rate <= 0)
+		return rate;
+
+	const double x = rate * dead_time;
+	if (model == DEADTIME_NONPARALYZABLE)
+		return x < 1 ? rate / (1 - x) : INFINITY;
+
+	/* m tau = n tau exp(-n tau) is at most 1/e, for n tau = 1 */
+	if (x > exp(-1))
+		return INFINITY;
+	/* f(y) = y exp(-y) - x is increasing and concave for y < 1: from
+	   y = x, below the solution, the iterations increase towards it. */
+	double y = x;
+	for (int i = 0; i < NEWTON_ITER; i++) {
+		const double e = exp(-y);
+		if (y >= 1 || y * e >= x)
+			break;
+		const double next = y - (y * e - x) / (e * (1 - y));
+		if (next <= y)
+			break;
+		y = next;
+	}
+	return (y < 1 ? y : 1) / dead_time;
+}
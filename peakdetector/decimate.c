@@ -0,0 +1,142 @@
+/* Geiger counter listener prototype - 2012
+ * by "Cyrus Smith" for "Le Projet Olduva"
+ *
+ * See http://le-projet-olduvai.wikiforum.net/t6044-projet-de-logiciel-pour-compteur-geiger-muller
+ *
+ * This code is under GNU GPLv3.
+ *
+ * Max-abs decimation, used by streamfilter and by the filter stage of
+ * peakdetector.
+ *
+ * The max of an interval is computed with SSE2 (or AVX2 when built with
+ * -mavx2) on whole vectors: the last vector of an interval overlaps the
+ * previous one instead of leaving a scalar tail, which does not change a
+ * max. A horizontal max then reduces the vector. The absolute value wraps
+ * like the scalar abs() to int16_t: abs(-32768) stays negative and is thus
+ * ignored, as it always was.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "decimate.h"
+
+int
+decimator_init(struct decimator *dec, uint32_t samplerate, double Tg)
+{
+	assert(dec != NULL);
+	memset(dec, 0, sizeof *dec);
+	const double Tg2 = Tg/2;
+	dec->nb_points_inter = Tg2 * samplerate;
+	if (dec->nb_points_inter == 0)
+		return -1;
+	return 0;
+}
+
+uint32_t
+decimator_rate(const struct decimator *dec, uint32_t samplerate)
+{
+	return samplerate / dec->nb_points_inter;
+}
+
+static int16_t
+maxabs_scalar(const int16_t *in, size_t size, int16_t cmax)
+{
+	for (size_t i = 0; i < size; i++) {
+		const int16_t inval = abs(in[i]);
+		if (inval > cmax)
+			cmax = inval;
+	}
+	return cmax;
+}
+
+#if defined(__SSE2__)
+static inline __m128i
+abs_epi16(__m128i a)
+{
+	return _mm_max_epi16(a, _mm_sub_epi16(_mm_setzero_si128(), a));
+}
+
+static inline int16_t
+hmax_epi16(__m128i a)
+{
+	a = _mm_max_epi16(a, _mm_shuffle_epi32(a, _MM_SHUFFLE(1, 0, 3, 2)));
+	a = _mm_max_epi16(a, _mm_shuffle_epi32(a, _MM_SHUFFLE(2, 3, 0, 1)));
+	a = _mm_max_epi16(a, _mm_srli_epi32(a, 16));
+	return (int16_t) _mm_cvtsi128_si32(a);
+}
+#endif
+
+/* Max of cmax and of abs(in[i]) over size samples. */
+static inline int16_t
+maxabs(const int16_t *in, size_t size, int16_t cmax)
+{
+#if defined(__AVX2__)
+	if (size >= 16) {
+		const __m256i zero = _mm256_setzero_si256();
+		__m256i acc = _mm256_set1_epi16(cmax);
+		size_t i;
+		for (i = 0; i + 16 <= size; i += 16) {
+			__m256i a = _mm256_loadu_si256((const __m256i *)
+						       (in + i));
+			a = _mm256_max_epi16(a, _mm256_sub_epi16(zero, a));
+			acc = _mm256_max_epi16(acc, a);
+		}
+		if (i < size) {
+			__m256i a = _mm256_loadu_si256((const __m256i *)
+						       (in + size - 16));
+			a = _mm256_max_epi16(a, _mm256_sub_epi16(zero, a));
+			acc = _mm256_max_epi16(acc, a);
+		}
+		return hmax_epi16(_mm_max_epi16(
+			_mm256_castsi256_si128(acc),
+			_mm256_extracti128_si256(acc, 1)));
+	}
+#endif
+#if defined(__SSE2__)
+	if (size >= 8) {
+		__m128i acc = _mm_set1_epi16(cmax);
+		size_t i;
+		for (i = 0; i + 8 <= size; i += 8)
+			acc = _mm_max_epi16(acc, abs_epi16(_mm_loadu_si128(
+				(const __m128i *) (in + i))));
+		if (i < size)
+			acc = _mm_max_epi16(acc, abs_epi16(_mm_loadu_si128(
+				(const __m128i *) (in + size - 8))));
+		return hmax_epi16(acc);
+	}
+#endif
+	return maxabs_scalar(in, size, cmax);
+}
+
+size_t
+decimate(struct decimator *dec, const int16_t *in, size_t size, int16_t *out)
+{
+	const uint32_t nb_points_inter = dec->nb_points_inter;
+	size_t nb = 0;
+	size_t i = 0;
+
+	/* Interval in progress since the previous call */
+	if (dec->nbpoints) {
+		const size_t missing = nb_points_inter - dec->nbpoints;
+		if (size < missing) {
+			dec->cmax = maxabs(in, size, dec->cmax);
+			dec->nbpoints += size;
+			return 0;
+		}
+		/* out[0] <= in[0], already read */
+		out[nb++] = maxabs(in, missing, dec->cmax);
+		i = missing;
+	}
+
+	for (; i + nb_points_inter <= size; i += nb_points_inter)
+		out[nb++] = maxabs(in + i, nb_points_inter, 0);
+
+	dec->cmax = maxabs(in + i, size - i, 0);
+	dec->nbpoints = size - i;
+	return nb;
+}
@@ -0,0 +1,35 @@
+#ifndef _DECIMATE_H_
+#define _DECIMATE_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Max-abs decimation, as done by streamfilter: given the Geiger dead time
+   Tg, the stream is cut in intervals of Tg/2, and each interval is replaced
+   by the max of abs(sample) on it. An interval may span several calls. */
+struct decimator {
+	uint32_t nb_points_inter; /* input samples per interval */
+	uint32_t nbpoints;        /* samples of the interval in progress */
+	int16_t cmax;             /* max of the interval in progress */
+};
+
+/* Returns -1 if Tg/2 is shorter than one sample. */
+int decimator_init(struct decimator *dec, uint32_t samplerate, double Tg);
+
+/* Sample rate of the output. */
+uint32_t decimator_rate(const struct decimator *dec, uint32_t samplerate);
+
+/* Decimate size samples from in to out, returns the number of samples
+   written (at most size). out may be in. */
+size_t decimate(struct decimator *dec, const int16_t *in, size_t size,
+		int16_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_DECIMATE_H_ */
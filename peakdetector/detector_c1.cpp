@@ -0,0 +1,24 @@
+/* Geiger counter listener prototype - 2012
+ * by "Cyrus Smith" for "Le Projet Olduva"
+ *
+ * See http://le-projet-olduvai.wikiforum.net/t6044-projet-de-logiciel-pour-compteur-geiger-muller
+ *
+ * This code is under GNU GPLv3.
+ *
+ * This is a simple detection algorithm based on the detection of an increase
+ * of the amplitude following by a decrease, that is then considered as a peak.
+ * A noise threshold is used to filter out small peaks.
+ *
+ * The algorithm itself is in engine.hpp; this is its C interface.
+ */
+
+#include "detector_c1.h"
+#include "engine.hpp"
+
+struct detector*
+init_detector_c1(uint32_t sample_rate, const struct parameters *params,
+		 struct eventsink *sink)
+{
+	return detection::new_detector<detection::c1,
+		detection::positive>("C1", sample_rate, params, sink);
+}
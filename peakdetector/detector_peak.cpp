@@ -0,0 +1,24 @@
+/* Geiger counter listener prototype - 2012
+ * by "Cyrus Smith" for "Le Projet Olduva"
+ *
+ * See http://le-projet-olduvai.wikiforum.net/t6044-projet-de-logiciel-pour-compteur-geiger-muller
+ *
+ * This code is under GNU GPLv3.
+ *
+ * The algorithm of CPeakDetector (geigerwave): a pulse lasts as long as the
+ * absolute value of the samples stays above the threshold, and is reported at
+ * its highest sample.
+ *
+ * The algorithm itself is in engine.hpp; this is its C interface.
+ */
+
+#include "detector_peak.h"
+#include "engine.hpp"
+
+struct detector*
+init_detector_peak(uint32_t sample_rate, const struct parameters *params,
+		   struct eventsink *sink)
+{
+	return detection::new_detector<detection::peak,
+		detection::absolute>("PEAK", sample_rate, params, sink);
+}
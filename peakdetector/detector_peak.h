@@ -0,0 +1,20 @@
+#ifndef _DETECTOR_PEAK_H_
+#define _DETECTOR_PEAK_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "eventsink.h"
+#include "peakdetector.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct detector* init_detector_peak(uint32_t sample_rate, const struct parameters *params, struct eventsink *sink);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_DETECTOR_PEAK_H_ */
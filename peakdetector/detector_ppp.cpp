@@ -0,0 +1,20 @@
+/* Geiger counter listener prototype - 2012
+ * by "Cyrus Smith" for "Le Projet Olduva"
+ *
+ * See http://le-projet-olduvai.wikiforum.net/t6044-projet-de-logiciel-pour-compteur-geiger-muller
+ *
+ * This is an implementation of the PPP algorithm (PapaPoilut's Peak)
+ *
+ * The algorithm itself is in engine.hpp; this is its C interface.
+ */
+
+#include "detector_ppp.h"
+#include "engine.hpp"
+
+struct detector*
+init_detector_ppp(uint32_t sample_rate, const struct parameters *params,
+		  struct eventsink *sink)
+{
+	return detection::new_detector<detection::ppp,
+		detection::positive>("PPP", sample_rate, params, sink);
+}
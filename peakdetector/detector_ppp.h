@@ -4,8 +4,17 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "eventsink.h"
 #include "peakdetector.h"
 
-struct detector* init_detector_ppp(uint32_t sample_rate, const struct parameters *params, void (*callback)(double, int16_t));
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct detector* init_detector_ppp(uint32_t sample_rate, const struct parameters *params, struct eventsink *sink);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif /* !_DETECTOR_PPP_H_ */
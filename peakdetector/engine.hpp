@@ -0,0 +1,771 @@
+#ifndef _ENGINE_HPP_
+#define _ENGINE_HPP_
+
+/* Detection engine, shared by peakdetector, geiger and geigerwave.
+ *
+ * Each detection algorithm is a class template on the sample type and the
+ * polarity of the pulses, driven by the engine template: everything is
+ * known at compile time, and the inner loops are inlined in a single
+ * function for each detector. C programs use the engine through the usual
+ * struct detector (see new_detector() and detector_c1.cpp); C++ programs
+ * can also use the classes directly.
+ *
+ * Only the C++ language is used, not its library: the objects are built
+ * with -fno-exceptions -fno-rtti and can be linked into C programs.
+ *
+ * The Geiger dead time of the parameters is enforced by the engine on the
+ * events of any algorithm, in samples (see dead_time).
+ *
+ * The samples are processed in their own format (8, 16, 24 or 32-bit
+ * integers, or floats), without any conversion pass: see sample_traits.
+ */
+
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "c1kernel.h"
+#include "eventsink.h"
+#include "peakdetector.h"
+#include "quietscan.h"
+
+namespace detection {
+
+/* Which pulses are detected: going up, going down, or both (the absolute
+   value of the samples). */
+enum polarity {
+	positive,
+	negative,
+	absolute,
+};
+
+/* A packed 24-bit sample, little-endian (WAV files, paInt24) */
+struct int24 {
+	unsigned char b[3];
+};
+
+/* How the algorithms see a sample: value_type holds any value of a sample,
+   its opposite and the differences of two samples, and load() gives the
+   value of a sample.
+   The thresholds and the amplitudes of the events are on the scale of
+   16-bit samples, whatever the format: threshold() converts a threshold to
+   a value, amplitude() a value to an amplitude (rounded down). An 8-bit
+   sample is thus loaded on this scale, while the wider formats keep their
+   resolution. quiet_level() is the level given to the quiet scan to find the
+   first value above th. */
+template <typename Sample> struct sample_traits;
+
+template <> struct sample_traits<int8_t> {
+	typedef int32_t value_type;
+	static value_type load(int8_t s) { return s * 256; }
+	static value_type threshold(unsigned th) { return th; }
+	static int32_t amplitude(value_type v) { return v; }
+	static value_type quiet_level(value_type th) { return th + 1; }
+};
+
+template <> struct sample_traits<int16_t> {
+	typedef int32_t value_type;
+	static value_type load(int16_t s) { return s; }
+	static value_type threshold(unsigned th) { return th; }
+	static int32_t amplitude(value_type v) { return v; }
+	static value_type quiet_level(value_type th) { return th + 1; }
+};
+
+template <> struct sample_traits<int24> {
+	typedef int32_t value_type;
+	static value_type
+	load(int24 s)
+	{
+		const uint32_t u = (uint32_t) s.b[0] << 8
+			| (uint32_t) s.b[1] << 16 | (uint32_t) s.b[2] << 24;
+		return (int32_t) u >> 8;
+	}
+	static value_type threshold(unsigned th) { return th * 256; }
+	static int32_t amplitude(value_type v) { return v >> 8; }
+	static value_type quiet_level(value_type th) { return th + 1; }
+};
+
+template <> struct sample_traits<int32_t> {
+	typedef int64_t value_type;
+	static value_type load(int32_t s) { return s; }
+	static value_type threshold(unsigned th) { return (int64_t) th << 16; }
+	static int32_t amplitude(value_type v) { return (int32_t) (v >> 16); }
+	static value_type quiet_level(value_type th) { return th + 1; }
+};
+
+/* full scale at 1.0 */
+template <> struct sample_traits<float> {
+	typedef float value_type;
+	static value_type load(float s) { return s; }
+	static value_type threshold(unsigned th) { return th / 32768.f; }
+	static int32_t
+	amplitude(value_type v)
+	{
+		const float a = v * 32768.f;
+		if (a >= 2147483647.f)
+			return INT32_MAX;
+		return a <= -2147483648.f ? INT32_MIN : (int32_t) a;
+	}
+	static value_type quiet_level(value_type th) { return th; }
+};
+
+/* The value of a sample seen by the algorithms */
+template <typename Sample, polarity Pol>
+inline typename sample_traits<Sample>::value_type
+value(Sample s)
+{
+	typedef typename sample_traits<Sample>::value_type value_type;
+	const value_type v = sample_traits<Sample>::load(s);
+	if (Pol == positive)
+		return v;
+	if (Pol == negative)
+		return -v;
+	return v < 0 ? -v : v;
+}
+
+/* The amplitude of an event reported with the value of sample s */
+template <typename Sample>
+inline int32_t
+amplitude(Sample s)
+{
+	return sample_traits<Sample>::amplitude(sample_traits<Sample>::load(s));
+}
+
+/* Index of the first sample whose absolute value is >= level, or size: the
+   quiet samples cannot start a pulse, whatever the polarity. Each format has
+   its own SIMD kernel (see quietscan.c). */
+inline size_t
+quiet_scan(const int8_t *in, size_t size, int32_t level)
+{
+	/* s * 256 >= level */
+	return quietscan_int8(in, size, level > 0 ? (level + 255) / 256 : 0);
+}
+
+inline size_t
+quiet_scan(const int16_t *in, size_t size, int32_t level)
+{
+	return quietscan(in, size, level);
+}
+
+inline size_t
+quiet_scan(const int24 *in, size_t size, int32_t level)
+{
+	return quietscan_int24((const uint8_t *) in, size, level);
+}
+
+inline size_t
+quiet_scan(const int32_t *in, size_t size, int64_t level)
+{
+	return quietscan_int32(in, size, level);
+}
+
+inline size_t
+quiet_scan(const float *in, size_t size, float level)
+{
+	return quietscan_float(in, size, level);
+}
+
+template <bool B> struct flag {};
+
+template <typename A, typename B> struct same_type {
+	static const bool value = false;
+};
+template <typename A> struct same_type<A, A> {
+	static const bool value = true;
+};
+
+
+/* C1: an increase of the amplitude followed by a decrease is a peak.
+ *
+ * (a, b, c) is a peak when b - a > -th, c - b <= -th and b > th (see
+ * c1kernel.c). The peak is reported one sample after c, with the value of
+ * b. Blocks of quiet samples are skipped; for 16-bit samples and positive
+ * pulses, the peaks of a block are found at once by c1_peakmask().
+ */
+template <typename Sample, polarity Pol>
+class c1 {
+public:
+	typedef Sample sample_type;
+	typedef typename sample_traits<Sample>::value_type value_type;
+
+	struct state {
+		Sample last_values[2];  /* last samples of the previous call */
+	};
+
+	c1(uint32_t sample_rate, const struct parameters *params)
+		: threshold_(sample_traits<Sample>::threshold(
+				     params->noise_threshold)),
+		  st_()
+	{
+		(void) sample_rate;
+	}
+
+	void set_sample_rate(uint32_t sample_rate) { (void) sample_rate; }
+
+	template <class Output>
+	void
+	process(const Sample *in, size_t size, uint64_t first_spl, Output &out)
+	{
+		for (size_t i = 0; i < size; i += C1_BLOCK) {
+			const Sample *blk = in + i;
+			const size_t len = (size - i < C1_BLOCK) ?
+				size - i : C1_BLOCK;
+
+			/* A peak needs its middle value above the threshold:
+			   blocks of quiet samples are skipped, only the last
+			   values are kept. */
+			if (value<Sample, Pol>(st_.last_values[1]) > threshold_
+			    || quiet_scan(blk, len, sample_traits<Sample>::
+					  quiet_level(threshold_)) < len)
+				peaks(blk, len, first_spl + i, out,
+				      flag<simd>());
+
+			st_.last_values[0] = (len > 1) ? blk[len - 2]
+				: st_.last_values[1];
+			st_.last_values[1] = blk[len - 1];
+		}
+	}
+
+	const state &get() const { return st_; }
+	void set(const state &st) { st_ = st; }
+
+	static bool
+	same(const state &a, const state &b)
+	{
+		return memcmp(a.last_values, b.last_values,
+			      sizeof a.last_values) == 0;
+	}
+
+	/* a peak is reported after its last sample */
+	static uint64_t
+	pending(const state &st, uint64_t spl)
+	{
+		(void) st;
+		return spl;
+	}
+
+private:
+	enum { C1_BLOCK = 4096 };  /* samples of one peak mask */
+	static const bool simd = same_type<Sample, int16_t>::value
+		&& Pol == positive;
+
+	static bool
+	peakp(value_type a, value_type b, value_type c, value_type th)
+	{
+		return b - a > -th && c - b <= -th && b > th;
+	}
+
+	template <class Output>
+	void
+	peaks(const Sample *blk, size_t len, uint64_t first_spl, Output &out,
+	      flag<true>)
+	{
+		uint64_t mask[C1_MASK_WORDS(C1_BLOCK)];
+		c1_peakmask((const int16_t *) blk, len,
+			    (const int16_t *) st_.last_values, threshold_,
+			    mask);
+		for (size_t w = 0; w < C1_MASK_WORDS(len); w++) {
+			for (uint64_t m = mask[w]; m; m &= m - 1) {
+				const size_t j = w * 64 + __builtin_ctzll(m);
+				out.emit(first_spl + j + 1, j ? blk[j - 1]
+					 : st_.last_values[1]);
+			}
+		}
+	}
+
+	template <class Output>
+	void
+	peaks(const Sample *blk, size_t len, uint64_t first_spl, Output &out,
+	      flag<false>)
+	{
+		Sample prev0 = st_.last_values[0];
+		Sample prev1 = st_.last_values[1];
+		for (size_t j = 0; j < len; j++) {
+			if (peakp(value<Sample, Pol>(prev0),
+				  value<Sample, Pol>(prev1),
+				  value<Sample, Pol>(blk[j]), threshold_))
+				out.emit(first_spl + j + 1, amplitude(prev1));
+			prev0 = prev1;
+			prev1 = blk[j];
+		}
+	}
+
+	value_type threshold_;
+	state st_;
+};
+
+
+/* PPP (PapaPoilut's Peak): a pulse starts when a sample goes above the
+   threshold, and ends when one goes below. The pulse is reported one sample
+   after its first sample, with the value of that sample. */
+template <typename Sample, polarity Pol>
+class ppp {
+public:
+	typedef Sample sample_type;
+	typedef typename sample_traits<Sample>::value_type value_type;
+
+	struct state {
+		bool in_peak;
+	};
+
+	ppp(uint32_t sample_rate, const struct parameters *params)
+		: threshold_(sample_traits<Sample>::threshold(
+				     params->noise_threshold)),
+		  st_()
+	{
+		(void) sample_rate;
+	}
+
+	void set_sample_rate(uint32_t sample_rate) { (void) sample_rate; }
+
+	template <class Output>
+	void
+	process(const Sample *in, size_t size, uint64_t first_spl, Output &out)
+	{
+		bool in_peak = st_.in_peak;
+		size_t i = 0;
+		while (i < size) {
+			/* Outside of a peak, nothing happens until a sample
+			   goes above the threshold: skip the quiet samples. */
+			if (!in_peak) {
+				i += quiet_scan(in + i, size - i,
+						sample_traits<Sample>::
+						quiet_level(threshold_));
+				if (i == size)
+					break;
+			}
+			const value_type v = value<Sample, Pol>(in[i]);
+			if (in_peak && v < threshold_) {
+				in_peak = false;
+			} else if (!in_peak && v > threshold_) {
+				in_peak = true;
+				out.emit(first_spl + i + 1, amplitude(in[i]));
+			}
+			i++;
+		}
+		st_.in_peak = in_peak;
+	}
+
+	/* a pulse is reported after its first sample */
+	static uint64_t
+	pending(const state &st, uint64_t spl)
+	{
+		(void) st;
+		return spl;
+	}
+
+	const state &get() const { return st_; }
+	void set(const state &st) { st_ = st; }
+
+	static bool
+	same(const state &a, const state &b)
+	{
+		return a.in_peak == b.in_peak;
+	}
+
+private:
+	value_type threshold_;
+	state st_;
+};
+
+
+/* Peak (CPeakDetector of geigerwave): a pulse starts at the first sample at
+   or above the threshold, and ends once the samples stay below it for more
+   than leaving_time seconds. It is reported at its highest sample, with
+   the value of that sample. The leaving time is converted to samples once:
+   the samples are only counted, whatever the length of the stream. */
+template <typename Sample, polarity Pol>
+class peak {
+public:
+	typedef Sample sample_type;
+	typedef sample_traits<Sample> traits;
+	typedef typename traits::value_type value_type;
+
+	enum phase {
+		noise,
+		in_peak,
+		leaving,
+	};
+
+	struct state {
+		int phase;
+		value_type max_value;
+		uint64_t max_spl;
+		uint64_t leaving_spl;  /* when the samples went below */
+	};
+
+	static constexpr double default_leaving_time = 0.0001;
+
+	peak(uint32_t sample_rate, const struct parameters *params)
+		: threshold_(traits::threshold(params->noise_threshold))
+	{
+		set_sample_rate(sample_rate);
+		memset(&st_, 0, sizeof st_);
+	}
+
+	/* below the threshold for more than leaving_time seconds: more than
+	   leaving_spl_ samples */
+	void
+	set_sample_rate(uint32_t sample_rate)
+	{
+		leaving_spl_ = (uint64_t) (default_leaving_time * sample_rate);
+	}
+
+	template <class Output>
+	void
+	process(const Sample *in, size_t size, uint64_t first_spl, Output &out)
+	{
+		int ph = st_.phase;
+		for (size_t i = 0; i < size; i++) {
+			/* Outside of a peak, nothing happens until a sample
+			   reaches the threshold: skip to the next one. */
+			if (ph == noise) {
+				i += quiet_scan(in + i, size - i, threshold_);
+				if (i >= size)
+					break;
+			}
+
+			const value_type v = value<Sample, Pol>(in[i]);
+			const bool above = v >= threshold_;
+			const uint64_t spl = first_spl + i;
+
+			switch (ph) {
+			case noise:
+				if (above) {
+					st_.max_spl = spl;
+					st_.max_value = v;
+					ph = in_peak;
+				}
+				break;
+
+			case leaving:
+				/* Below the threshold for long enough: the
+				   peak is over. Above it again: back in the
+				   peak. */
+				if (!above) {
+					if (spl - st_.leaving_spl
+					    > leaving_spl_) {
+						out.emit(st_.max_spl,
+							 max_amplitude());
+						ph = noise;
+					}
+					break;
+				}
+				ph = in_peak;
+				/* FALLTHROUGH */
+
+			case in_peak:
+				if (above) {
+					if (st_.max_value < v) {
+						st_.max_spl = spl;
+						st_.max_value = v;
+					}
+				} else {
+					st_.leaving_spl = spl;
+					ph = leaving;
+				}
+				break;
+			}
+		}
+		st_.phase = ph;
+	}
+
+	/* a pulse is reported at its highest sample, once it is over */
+	static uint64_t
+	pending(const state &st, uint64_t spl)
+	{
+		return st.phase == noise ? spl : st.max_spl;
+	}
+
+	const state &get() const { return st_; }
+	void set(const state &st) { st_ = st; }
+
+	static bool
+	same(const state &a, const state &b)
+	{
+		if (a.phase != b.phase)
+			return false;
+		/* outside of a peak, the rest is overwritten before use */
+		if (a.phase == noise)
+			return true;
+		if (a.max_spl != b.max_spl
+		    || a.max_value != b.max_value)
+			return false;
+		/* the leaving time is only used when leaving */
+		return a.phase != leaving || a.leaving_spl == b.leaving_spl;
+	}
+
+private:
+	int32_t
+	max_amplitude() const
+	{
+		return traits::amplitude(st_.max_value);
+	}
+
+	value_type threshold_;
+	uint64_t leaving_spl_;
+	state st_;
+};
+
+
+/* Dead time of the tube: an event less than spl samples after the last
+ * one is dropped. The dead time is converted to samples once, the events
+ * are only compared to the end of the dead window:
+ *  - non-paralyzable: the window starts at each accepted event;
+ *  - paralyzable: any event, even dropped, starts a new window.
+ * Without dead time, spl is 0 and every event is accepted.
+ */
+class dead_time {
+public:
+	dead_time(uint32_t sample_rate, const struct parameters *params)
+		: seconds_(params->dead_time_model == DEADTIME_NONE ? 0
+			   : params->geiger_dead_time)
+		, paralyzable_(params->dead_time_model == DEADTIME_PARALYZABLE)
+		, end_(0)
+	{
+		set_sample_rate(sample_rate);
+	}
+
+	void
+	set_sample_rate(uint32_t sample_rate)
+	{
+		spl_ = (uint64_t) (seconds_ * sample_rate + 0.5);
+	}
+
+	bool
+	accept(uint64_t spl)
+	{
+		const bool ok = spl >= end_;
+		if (ok || paralyzable_)
+			end_ = spl + spl_;
+		return ok;
+	}
+
+	/* first sample of the next accepted event, at least */
+	uint64_t end() const { return end_; }
+	void set_end(uint64_t end) { end_ = end; }
+
+private:
+	double seconds_;
+	bool paralyzable_;
+	uint64_t spl_;
+	uint64_t end_;
+};
+
+
+/* The engine runs an algorithm over the successive buffers of a stream,
+   counts the samples, applies the dead time, and passes the events to a
+   sink by batches. */
+template <class Algo>
+class engine {
+public:
+	typedef typename Algo::sample_type sample_type;
+
+	engine(uint32_t sample_rate, const struct parameters *params,
+	       struct eventsink *sink)
+		: algo_(sample_rate, params)
+		, dead_time_(sample_rate, params)
+		, sample_number_(0)
+		, sink_(sink)
+	{
+		batch_.nb = 0;
+	}
+
+	void
+	process(const sample_type *in, size_t size)
+	{
+		algo_.process(in, size, sample_number_, *this);
+		sample_number_ += size;
+		eventbatch_flush(&batch_, sink_);
+	}
+
+	/* called by the algorithm */
+	void
+	emit(uint64_t spl, int32_t amplitude)
+	{
+		if (dead_time_.accept(spl))
+			eventbatch_push(&batch_, sink_, spl, amplitude);
+	}
+
+	void set_sample_rate(uint32_t sample_rate)
+	{
+		algo_.set_sample_rate(sample_rate);
+		dead_time_.set_sample_rate(sample_rate);
+	}
+
+	uint64_t sample_number() const { return sample_number_; }
+
+	uint64_t
+	pending() const
+	{
+		return Algo::pending(algo_.get(), sample_number_);
+	}
+
+	/* Snapshot of the state, for the analysis by segments: the state of
+	   the algorithm, then the end of the dead window in the last bytes. */
+	void
+	getstate(struct detectorstate *st) const
+	{
+		static_assert(sizeof(typename Algo::state) + sizeof(uint64_t)
+			      <= sizeof st->opaque,
+			      "detector state too large");
+		memset(st, 0, sizeof *st);
+		st->sample_number = sample_number_;
+		memcpy(st->opaque, &algo_.get(), sizeof(typename Algo::state));
+		const uint64_t end = dead_time_.end();
+		memcpy(st->opaque + dead_end_offset, &end, sizeof end);
+	}
+
+	void
+	setstate(const struct detectorstate *st)
+	{
+		typename Algo::state s;
+		memcpy(&s, st->opaque, sizeof s);
+		uint64_t end;
+		memcpy(&end, st->opaque + dead_end_offset, sizeof end);
+		sample_number_ = st->sample_number;
+		algo_.set(s);
+		dead_time_.set_end(end);
+	}
+
+	static bool
+	samestate(const struct detectorstate *a, const struct detectorstate *b)
+	{
+		typename Algo::state sa, sb;
+		memcpy(&sa, a->opaque, sizeof sa);
+		memcpy(&sb, b->opaque, sizeof sb);
+		uint64_t ea, eb;
+		memcpy(&ea, a->opaque + dead_end_offset, sizeof ea);
+		memcpy(&eb, b->opaque + dead_end_offset, sizeof eb);
+		/* a dead window already over does not matter any more */
+		const uint64_t spl = a->sample_number;
+		return a->sample_number == b->sample_number
+			&& Algo::same(sa, sb)
+			&& (ea == eb || (ea <= spl && eb <= spl));
+	}
+
+private:
+	static const size_t dead_end_offset =
+		sizeof(detectorstate::opaque) - sizeof(uint64_t);
+
+	Algo algo_;
+	dead_time dead_time_;
+	uint64_t sample_number_;
+	struct eventsink *sink_;
+	struct eventbatch batch_;
+};
+
+
+/* C interface: a struct detector running an engine, whose data points to
+   the engine itself. */
+
+template <class Engine>
+inline Engine *
+engine_of(struct detectordata *data)
+{
+	return reinterpret_cast<Engine *>(data);
+}
+
+template <class Engine>
+int
+detector_process(const void *in, size_t size, struct detectordata *data)
+{
+	engine_of<Engine>(data)->process(
+		static_cast<const typename Engine::sample_type *>(in), size);
+	return 0;
+}
+
+template <class Engine>
+int
+detector_terminate(struct detector *d)
+{
+	engine_of<Engine>(d->data)->~Engine();
+	free(d->data);
+	free(d);
+	return 0;
+}
+
+template <class Engine>
+void
+detector_getstate(const struct detectordata *data, struct detectorstate *st)
+{
+	reinterpret_cast<const Engine *>(data)->getstate(st);
+}
+
+template <class Engine>
+uint64_t
+detector_pending(const struct detectordata *data)
+{
+	return reinterpret_cast<const Engine *>(data)->pending();
+}
+
+template <class Engine>
+void
+detector_setstate(struct detectordata *data, const struct detectorstate *st)
+{
+	engine_of<Engine>(data)->setstate(st);
+}
+
+template <class Algo>
+struct detector *
+new_detector(const char *name, uint32_t sample_rate,
+	     const struct parameters *params, struct eventsink *sink)
+{
+	typedef engine<Algo> engine_type;
+	if (params == NULL || sink == NULL)
+		return NULL;
+	struct detector *d = (struct detector *)
+		calloc(1, sizeof(struct detector));
+	if (d == NULL)
+		return NULL;
+	void *mem = calloc(1, sizeof(engine_type));
+	if (mem == NULL) {
+		free(d);
+		return NULL;
+	}
+
+	d->name = const_cast<char *>(name);
+	d->detector = &detector_process<engine_type>;
+	d->terminate = &detector_terminate<engine_type>;
+	d->getstate = &detector_getstate<engine_type>;
+	d->setstate = &detector_setstate<engine_type>;
+	d->samestate = &engine_type::samestate;
+	d->pending = &detector_pending<engine_type>;
+	d->data = reinterpret_cast<struct detectordata *>(
+		new (mem) engine_type(sample_rate, params, sink));
+	return d;
+}
+
+/* A struct detector running the algorithm Algo with the polarity Pol, on
+   the samples of the format of the parameters. */
+template <template <typename, polarity> class Algo, polarity Pol>
+struct detector *
+new_detector(const char *name, uint32_t sample_rate,
+	     const struct parameters *params, struct eventsink *sink)
+{
+	if (params == NULL)
+		return NULL;
+	switch (params->sample_format) {
+	case SAMPLE_INT8:
+		return new_detector<Algo<int8_t, Pol> >(name, sample_rate,
+							params, sink);
+	case SAMPLE_INT16:
+		return new_detector<Algo<int16_t, Pol> >(name, sample_rate,
+							 params, sink);
+	case SAMPLE_INT24:
+		return new_detector<Algo<int24, Pol> >(name, sample_rate,
+						       params, sink);
+	case SAMPLE_INT32:
+		return new_detector<Algo<int32_t, Pol> >(name, sample_rate,
+							 params, sink);
+	case SAMPLE_FLOAT:
+		return new_detector<Algo<float, Pol> >(name, sample_rate,
+						       params, sink);
+	}
+	return NULL;
+}
+
+} /* namespace detection */
+
+#endif /* !_ENGINE_HPP_ */
@@ -0,0 +1,617 @@
+/* Geiger counter listener prototype - 2012
+ * by "Cyrus Smith" for "Le Projet Olduva"
+ *
+ * See http://le-projet-olduvai.wikiforum.net/t6044-projet-de-logiciel-pour-compteur-geiger-muller
+ *
+ * This code is under GNU GPLv3.
+ *
+ * This program computes the count rates and the dose from the events of a
+ * detector, as they come:
+ *    $ peakdetector C1 file.wav | evanalyse -c tubes.conf -t SBM-20
+ *    $ evanalyse -w 60 -w 86400 month.gevl
+ * It replaces basic_analyser.pl. The input is read once, in a single pass,
+ * and the memory does not depend on its length: the rates come from a rate
+ * meter (see ratemeter.h), the dose is summed second by second.
+ *
+ * The input is a text list in the format of the detectors (the time in
+ * seconds first, other columns and lines starting with '#' are ignored) or
+ * a binary event log. The text is parsed by hand, without stdio nor
+ * strtod(): both formats are read at the speed of the disk.
+ *
+ * Every period (10 s by default) of the recording, a line gives the time,
+ * the total of events, the rate over each window (in CPM), the dose rate
+ * over the first window and the dose since the start. A summary follows at
+ * the end.
+ *
+ * The dose rate is computed from the count rate, corrected for the dead
+ * time of the tube if any, by the calibration of the tube: a factor (CPM
+ * for 1 uSv/h), or a table of points interpolated linearly. See tubes.conf
+ * for the format of the configuration file. Without it, the calibration of
+ * basic_analyser.pl is used: 11 CPS for 1 mR/h, i.e. 66 CPM for 1 uSv/h.
+ *
+ * With -a, a rise of the count rate raises an alarm (see ratealarm.h),
+ * reported in the output as it happens; the exit status is then 2.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "eventlog.h"
+#include "peakdetector.h"
+#include "ratealarm.h"
+#include "ratemeter.h"
+
+#define TEXT_RATE (1000000)   /* time unit of the text input: 1 us */
+#define TEXT_DIGITS (6)       /* decimals of the seconds kept */
+#define READ_SIZE (1 << 20)   /* bytes of text read at once */
+#define RATE_BIN (1)          /* seconds per bin of the rate meter */
+#define DOSE_BIN (1)          /* seconds over which the dose rate is taken */
+#define MAX_WINDOWS (8)
+#define MAX_POINTS (64)       /* of a calibration table */
+#define DEFAULT_CPM_PER_USVH (66)
+#define DEFAULT_FALSE_ALARM (30 * 86400) /* seconds between false alarms */
+#define DEFAULT_LEARNING (60) /* seconds measuring the background rate */
+#define EXIT_ALARM (2)
+
+
+/* Calibration of a tube */
+
+struct calibration {
+	char name[64];
+	double cpm_per_usvh;  /* linear calibration, or 0 with a table */
+	size_t nb_points;     /* table, by increasing count rates */
+	double cpm[MAX_POINTS];
+	double usvh[MAX_POINTS];
+	double dead_time;
+	enum deadtime_model model;
+};
+
+/* Dose rate in uSv/h for a count rate in CPM */
+static double
+dose_rate(const struct calibration *cal, double cpm)
+{
+	cpm = 60 * deadtime_true_rate(cpm / 60, cal->dead_time, cal->model);
+	if (cal->nb_points == 0)
+		return cpm / cal->cpm_per_usvh;
+
+	/* from 0 to the first point, then between the points, and the last
+	   segment goes on beyond the last point */
+	const double *x = cal->cpm, *y = cal->usvh;
+	if (cal->nb_points == 1 || cpm <= x[0])
+		return x[0] > 0 ? cpm * y[0] / x[0] : y[0];
+	size_t i = 1;
+	while (i < cal->nb_points - 1 && cpm > x[i])
+		i++;
+	return y[i - 1] + (cpm - x[i - 1]) * (y[i] - y[i - 1])
+		/ (x[i] - x[i - 1]);
+}
+
+static char *
+trim(char *s)
+{
+	while (isspace((unsigned char) *s))
+		s++;
+	size_t len = strlen(s);
+	while (len && isspace((unsigned char) s[len - 1]))
+		s[--len] = '\0';
+	return s;
+}
+
+static bool
+number(const char *s, double *v)
+{
+	char *end;
+	*v = strtod(s, &end);
+	return end != s && *trim(end) == '\0';
+}
+
+/* Read the calibration of tube (the first one if NULL) from filename */
+static bool
+load_calibration(const char *filename, const char *tube,
+		 struct calibration *cal)
+{
+	FILE *in = fopen(filename, "r");
+	if (in == NULL) {
+		fprintf(stderr, "Unable to open %s: %s\n", filename,
+			strerror(errno));
+		return false;
+	}
+
+	char line[256];
+	unsigned long n = 0;
+	bool found = false, in_tube = false, ok = true;
+	while (ok && fgets(line, sizeof line, in) != NULL) {
+		n++;
+		char *hash = strchr(line, '#');
+		if (hash != NULL)
+			*hash = '\0';
+		char *l = trim(line);
+		if (*l == '\0')
+			continue;
+
+		if (*l == '[') {
+			char *end = strchr(l, ']');
+			if (end == NULL || end[1] != '\0') {
+				ok = false;
+				break;
+			}
+			*end = '\0';
+			l = trim(l + 1);
+			/* only the first section of that name */
+			in_tube = !found && (tube == NULL || !strcmp(l, tube));
+			if (in_tube) {
+				found = true;
+				snprintf(cal->name, sizeof cal->name, "%s", l);
+			}
+			continue;
+		}
+
+		char *eq = strchr(l, '=');
+		if (eq == NULL) {
+			ok = false;
+			break;
+		}
+		*eq = '\0';
+		const char *key = trim(l), *value = trim(eq + 1);
+		if (!in_tube)
+			continue;
+		if (!strcmp(key, "cpm_per_usvh")) {
+			ok = number(value, &cal->cpm_per_usvh)
+				&& cal->cpm_per_usvh > 0;
+		} else if (!strcmp(key, "point")) {
+			double x, y;
+			char *end;
+			x = strtod(value, &end);
+			ok = end != value && number(end, &y) && x >= 0
+				&& y >= 0 && cal->nb_points < MAX_POINTS
+				&& (cal->nb_points == 0
+				    || x > cal->cpm[cal->nb_points - 1]);
+			if (ok) {
+				cal->cpm[cal->nb_points] = x;
+				cal->usvh[cal->nb_points++] = y;
+			}
+		} else if (!strcmp(key, "dead_time")) {
+			ok = number(value, &cal->dead_time)
+				&& cal->dead_time >= 0;
+			if (ok && cal->model == DEADTIME_NONE)
+				cal->model = DEADTIME_NONPARALYZABLE;
+		} else if (!strcmp(key, "dead_time_model")) {
+			if (!strcmp(value, "nonparalyzable"))
+				cal->model = DEADTIME_NONPARALYZABLE;
+			else if (!strcmp(value, "paralyzable"))
+				cal->model = DEADTIME_PARALYZABLE;
+			else
+				ok = false;
+		} else {
+			ok = false;
+		}
+	}
+	if (!ok)
+		fprintf(stderr, "%s:%lu: syntax error\n", filename, n);
+	else if (ferror(in))
+		fprintf(stderr, "%s: read error: %s\n", filename,
+			strerror(errno));
+	else if (!found)
+		fprintf(stderr, "%s: no tube %s\n", filename,
+			tube ? tube : "");
+	else if (cal->cpm_per_usvh == 0 && cal->nb_points == 0)
+		fprintf(stderr, "%s: no calibration for tube %s\n", filename,
+			cal->name);
+	else if (cal->cpm_per_usvh > 0 && cal->nb_points > 0)
+		fprintf(stderr, "%s: both a factor and a table for tube %s\n",
+			filename, cal->name);
+	else {
+		fclose(in);
+		return true;
+	}
+	fclose(in);
+	return false;
+}
+
+
+/* Analysis */
+
+struct analysis {
+	const struct calibration *cal;
+	const double *windows;
+	size_t nb_windows;
+	double period;        /* seconds between two reports, 0 for none */
+	double alarm_factor;  /* rise of the rate raising an alarm, 0 for none */
+	double false_alarm;
+	double background;
+
+	uint32_t rate;        /* time unit of the events, per second */
+	struct ratemeter *rm;
+	uint64_t period_spl;
+	uint64_t next_report;
+	uint64_t dose_spl;    /* DOSE_BIN in time units */
+	uint64_t dose_bin;    /* current bin of the dose */
+	uint64_t dose_count;  /* events in the current bin */
+	double dose;          /* uSv, over the complete bins */
+	uint64_t last_spl;
+	struct ratealarm alarm;
+	unsigned long alarms; /* raised */
+};
+
+/* Set the time unit, once it is known */
+static bool
+analysis_start(struct analysis *a, uint32_t rate)
+{
+	double max_window = 0;
+	for (size_t i = 0; i < a->nb_windows; i++)
+		if (a->windows[i] > max_window)
+			max_window = a->windows[i];
+	a->rate = rate;
+	a->rm = ratemeter_new(rate, RATE_BIN, max_window);
+	if (a->rm == NULL) {
+		fprintf(stderr, "unable to allocate the rate meter\n");
+		return false;
+	}
+	a->period_spl = (uint64_t) (a->period * rate + 0.5);
+	a->next_report = a->period_spl;
+	a->dose_spl = (uint64_t) DOSE_BIN * rate;
+	if (a->alarm_factor > 0
+	    && ratealarm_init(&a->alarm, rate, a->alarm_factor,
+			      a->false_alarm, a->background,
+			      DEFAULT_LEARNING)) {
+		fprintf(stderr, "incorrect alarm parameters\n");
+		return false;
+	}
+
+	printf("# time (s)\tevents");
+	for (size_t i = 0; i < a->nb_windows; i++)
+		printf("\tCPM %g s", a->windows[i]);
+	printf("\tuSv/h\tdose (uSv)\n");
+	return true;
+}
+
+/* Close the bins of the dose before spl */
+static void
+dose_advance(struct analysis *a, uint64_t spl)
+{
+	const uint64_t bin = spl / a->dose_spl;
+	if (bin <= a->dose_bin)
+		return;
+	const double hours = DOSE_BIN / 3600.0;
+	a->dose += dose_rate(a->cal, a->dose_count * 60.0 / DOSE_BIN)
+		* hours;
+	/* a calibration table may give a dose rate without any count */
+	if (bin - a->dose_bin > 1)
+		a->dose += (bin - a->dose_bin - 1) * dose_rate(a->cal, 0)
+			* hours;
+	a->dose_bin = bin;
+	a->dose_count = 0;
+}
+
+static void
+report(struct analysis *a, uint64_t spl)
+{
+	ratemeter_advance(a->rm, spl);
+	dose_advance(a, spl);
+	printf("%.3f\t%llu", (double) spl / a->rate,
+	       (unsigned long long) ratemeter_total(a->rm));
+	double first = 0;
+	for (size_t i = 0; i < a->nb_windows; i++) {
+		const double cpm = 60 * ratemeter_rate(a->rm, a->windows[i],
+						       NULL);
+		if (i == 0)
+			first = cpm;
+		printf("\t%.1f", cpm);
+	}
+	printf("\t%.4f\t%.4f\n", dose_rate(a->cal, first), a->dose);
+}
+
+static inline void
+add_event(struct analysis *a, uint64_t spl)
+{
+	while (a->period_spl && spl >= a->next_report) {
+		report(a, a->next_report);
+		a->next_report += a->period_spl;
+	}
+	dose_advance(a, spl);
+	a->dose_count++;
+	ratemeter_add(a->rm, spl, 1);
+	if (a->alarm_factor > 0) {
+		const enum ratealarm_change c = ratealarm_event(&a->alarm, spl);
+		if (c == RATEALARM_RAISED) {
+			a->alarms++;
+			printf("# alarm raised at %.3f s: background %.1f CPM\n",
+			       (double) spl / a->rate,
+			       60 * a->alarm.background);
+		} else if (c == RATEALARM_CLEARED) {
+			printf("# alarm cleared at %.3f s\n",
+			       (double) spl / a->rate);
+		}
+	}
+	if (spl > a->last_spl)
+		a->last_spl = spl;
+}
+
+static void
+summary(struct analysis *a)
+{
+	/* the last bin of the dose, as far as it goes */
+	const double dose = a->dose + dose_rate(a->cal, a->dose_count * 60.0
+						/ DOSE_BIN) * DOSE_BIN / 3600.0;
+	const uint64_t total = ratemeter_total(a->rm);
+	const double seconds = (double) a->last_spl / a->rate;
+	printf("# total: %llu events in %.3f s, %.1f CPM, dose %.4f uSv\n",
+	       (unsigned long long) total, seconds,
+	       seconds > 0 ? 60 * total / seconds : 0, dose);
+	if (a->alarm_factor > 0)
+		printf("# %lu alarm(s)\n", a->alarms);
+}
+
+static bool
+read_eventlog(FILE *in, const char *filename, struct analysis *a)
+{
+	struct eventlog_header hdr;
+	struct eventlogreader *reader = eventlog_open(in, &hdr);
+	if (reader == NULL || hdr.sample_rate == 0) {
+		fprintf(stderr, "%s: invalid event log\n", filename);
+		eventlog_close(reader);
+		return false;
+	}
+	if (!analysis_start(a, hdr.sample_rate)) {
+		eventlog_close(reader);
+		return false;
+	}
+
+	struct event ev[EVENTBATCH_SIZE];
+	long nb;
+	while ((nb = eventlog_read(reader, ev, EVENTBATCH_SIZE)) > 0)
+		for (long i = 0; i < nb; i++)
+			add_event(a, ev[i].spl);
+	eventlog_close(reader);
+	if (nb < 0) {
+		fprintf(stderr, "%s: truncated or corrupted event log\n",
+			filename);
+		return false;
+	}
+	return true;
+}
+
+/* Time of the event on the line [p, end), in microseconds. Returns 1 for
+   an event, 0 for a comment or an empty line, -1 otherwise. */
+static int
+parse_line(const char *p, const char *end, uint64_t *us)
+{
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+	if (p == end || *p == '#' || *p == '\r')
+		return 0;
+	uint64_t v = 0;
+	const char *digits = p;
+	while (p < end && *p >= '0' && *p <= '9')
+		v = 10 * v + (*p++ - '0');
+	int decimals = 0;
+	if (p < end && *p == '.') {
+		p++;
+		for (; p < end && *p >= '0' && *p <= '9'; p++) {
+			if (decimals < TEXT_DIGITS) {
+				v = 10 * v + (*p - '0');
+				decimals++;
+			}
+		}
+	}
+	if (p == digits || (p == digits + 1 && *digits == '.')
+	    || (p < end && *p != ' ' && *p != '\t' && *p != '\r'))
+		return -1;
+	for (; decimals < TEXT_DIGITS; decimals++)
+		v *= 10;
+	*us = v;
+	return 1;
+}
+
+static bool
+read_text(FILE *in, const char *filename, struct analysis *a)
+{
+	if (!analysis_start(a, TEXT_RATE))
+		return false;
+	char *buf = malloc(READ_SIZE + 1);
+	assert(buf != NULL);
+	size_t len = 0;
+	unsigned long line = 0, errors = 0;
+	bool eof = false, ok = true;
+	while (!eof) {
+		const size_t n = fread(buf + len, 1, READ_SIZE - len, in);
+		if (n == 0) {
+			eof = true;
+			if (len == 0)
+				break;
+			buf[len++] = '\n'; /* the last line has no end */
+		}
+		len += n;
+
+		const char *p = buf, *end = buf + len, *nl;
+		while ((nl = memchr(p, '\n', end - p)) != NULL) {
+			line++;
+			uint64_t us;
+			const int r = parse_line(p, nl, &us);
+			if (r > 0)
+				add_event(a, us);
+			else if (r < 0 && errors++ == 0)
+				fprintf(stderr, "%s:%lu: not an event\n",
+					filename, line);
+			p = nl + 1;
+		}
+		len = end - p;
+		if (len == READ_SIZE) {
+			fprintf(stderr, "%s:%lu: line too long\n", filename,
+				line + 1);
+			ok = false;
+			break;
+		}
+		memmove(buf, p, len);
+	}
+	free(buf);
+	if (errors)
+		fprintf(stderr, "%s: %lu lines ignored\n", filename, errors);
+	return ok;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: evanalyse [-c config] [-t tube] [-w window ...] "
+		"[-p period]\n\t\t [-a factor [-A seconds] [-b cps]] "
+		"[input]\n");
+	fprintf(stderr, "\t -c: read the calibration of the tube from config "
+		"(see tubes.conf)\n");
+	fprintf(stderr, "\t -t: name of the tube in config (default: the first "
+		"one)\n");
+	fprintf(stderr, "\t -w: count rate over the last window seconds (up to "
+		"%d windows,\n\t     default: 10, 60 and 3600)\n", MAX_WINDOWS);
+	fprintf(stderr, "\t -p: seconds of events between two reports (10, 0 "
+		"for the summary only)\n");
+	fprintf(stderr, "\t -a: alarm when the count rate rises by factor "
+		"(see ratealarm.h)\n");
+	fprintf(stderr, "\t -A: mean time between false alarms, at least "
+		"(%d s)\n", DEFAULT_FALSE_ALARM);
+	fprintf(stderr, "\t -b: background rate (default: measured over the "
+		"first %d s)\n", DEFAULT_LEARNING);
+	fprintf(stderr, "\t input: text list or binary event log (default: "
+		"stdin)\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *config = NULL;
+	const char *tube = NULL;
+	double windows[MAX_WINDOWS] = {10, 60, 3600};
+	size_t nb_windows = 0;
+	double period = 10;
+	double alarm_factor = 0;
+	double false_alarm = DEFAULT_FALSE_ALARM;
+	double background = 0;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "c:t:w:p:a:A:b:")) != -1) {
+		switch (opt) {
+		case 'c':
+			config = optarg;
+			break;
+		case 't':
+			tube = optarg;
+			break;
+		case 'w': {
+			const double w = strtod(optarg, NULL);
+			if (!(w >= RATE_BIN) || nb_windows == MAX_WINDOWS) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			windows[nb_windows++] = w;
+			break;
+		}
+		case 'p':
+			period = strtod(optarg, NULL);
+			if (!(period >= 0)) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'a':
+			alarm_factor = strtod(optarg, NULL);
+			if (!(alarm_factor > 1)) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'A':
+			false_alarm = strtod(optarg, NULL);
+			if (!(false_alarm > 0)) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'b':
+			/* in CPS, as the rates of peakdetector */
+			background = strtod(optarg, NULL);
+			if (!(background > 0)) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		default:
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (optind < argc - 1 || (tube != NULL && config == NULL)) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+	const char *filename = optind < argc ? argv[optind] : "-";
+
+	struct calibration cal = {
+		.name = "basic_analyser.pl",
+		.cpm_per_usvh = DEFAULT_CPM_PER_USVH,
+	};
+	if (config != NULL) {
+		memset(&cal, 0, sizeof cal);
+		if (!load_calibration(config, tube, &cal))
+			exit(EXIT_FAILURE);
+	}
+	if (cal.nb_points)
+		fprintf(stderr, "Tube %s: table of %zu points", cal.name,
+			cal.nb_points);
+	else
+		fprintf(stderr, "Tube %s: %g CPM for 1 uSv/h", cal.name,
+			cal.cpm_per_usvh);
+	if (cal.model != DEADTIME_NONE)
+		fprintf(stderr, ", dead time %g s (%s)", cal.dead_time,
+			cal.model == DEADTIME_PARALYZABLE ? "paralyzable"
+			: "non-paralyzable");
+	fprintf(stderr, "\n");
+
+	FILE *in = stdin;
+	if (strcmp(filename, "-")) {
+		in = fopen(filename, "rb");
+		if (in == NULL) {
+			fprintf(stderr, "Unable to open %s: %s\n", filename,
+				strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	struct analysis a = {
+		.cal = &cal,
+		.windows = windows,
+		.nb_windows = nb_windows ? nb_windows : 3,
+		.period = period,
+		.alarm_factor = alarm_factor,
+		.false_alarm = false_alarm,
+		.background = background,
+	};
+	/* an event log starts with "GEVL", a text list with a number or a
+	   comment */
+	const int c = getc(in);
+	if (c != EOF)
+		ungetc(c, in);
+	bool ok = c == 'G' ? read_eventlog(in, filename, &a)
+		: read_text(in, filename, &a);
+	if (ok && ferror(in)) {
+		fprintf(stderr, "%s: read error: %s\n", filename,
+			strerror(errno));
+		ok = false;
+	}
+	if (in != stdin)
+		fclose(in);
+	if (ok)
+		summary(&a);
+	ratemeter_free(a.rm);
+	if (!ok)
+		return EXIT_FAILURE;
+	return a.alarms ? EXIT_ALARM : EXIT_SUCCESS;
+}
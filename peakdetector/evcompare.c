@@ -0,0 +1,397 @@
+/* Geiger counter listener prototype - 2012
+ * by "Cyrus Smith" for "Le Projet Olduva"
+ *
+ * See http://le-projet-olduvai.wikiforum.net/t6044-projet-de-logiciel-pour-compteur-geiger-muller
+ *
+ * This code is under GNU GPLv3.
+ *
+ * This program compares the events found by a detector with a reference
+ * list: the ground truth written by geigergen, a list checked by hand such
+ * as test_data/geiger_tarso.wav.txt, or the output of another detector:
+ *    $ peakdetector PPP test.wav | evcompare truth.txt -
+ *
+ * Both lists are in the text format of the detectors (the time in seconds
+ * first, then the amplitude, other columns and lines starting with '#' are
+ * ignored) or binary event logs. The events are matched in a single pass
+ * over the two lists, channel by channel: a detected event within the
+ * tolerance of the next reference event of its channel is a hit, a
+ * reference event left behind is a miss, a detected event left behind is a
+ * false positive. For the hits, the report gives the timing jitter
+ * (detected time - reference time). The events of a text list are all on
+ * channel 0.
+ *
+ * The exit status is a failure when the misses or the false positives go
+ * over the given ratios, or, with -x, when the two lists are not exactly
+ * the same: this is the regression test of "make check".
+ *
+ * With -c, only one channel of the multi-channel event logs is compared; a
+ * single-channel list is taken whole, so that a channel of a recording can
+ * be compared with the analysis of that channel alone.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "eventlog.h"
+
+struct evrecord {
+	double time;
+	uint64_t spl;          /* of a binary event log */
+	int32_t amplitude;
+	uint32_t channel;      /* of a multi-channel event log */
+	bool piled;            /* pile-up column of the ground truth */
+};
+
+struct evlist {
+	size_t nb;
+	size_t size;
+	struct evrecord *ev;
+	bool binary;
+	uint32_t sample_rate;  /* of a binary event log */
+};
+
+static void
+evlist_push(struct evlist *l, double time, int32_t amplitude, bool piled,
+	    uint64_t spl, uint32_t channel)
+{
+	if (l->nb == l->size) {
+		l->size = l->size ? 2 * l->size : 1024;
+		l->ev = realloc(l->ev, l->size * sizeof(struct evrecord));
+		assert(l->ev != NULL);
+	}
+	struct evrecord *r = &l->ev[l->nb++];
+	r->time = time;
+	r->spl = spl;
+	r->amplitude = amplitude;
+	r->channel = channel;
+	r->piled = piled;
+}
+
+/* By channel, then by time: the order of the matching in compare() */
+static int
+evrecord_cmp(const void *a, const void *b)
+{
+	const struct evrecord *ra = a, *rb = b;
+	if (ra->channel != rb->channel)
+		return ra->channel < rb->channel ? -1 : 1;
+	if (ra->time != rb->time)
+		return ra->time < rb->time ? -1 : 1;
+	return (ra->amplitude > rb->amplitude)
+		- (ra->amplitude < rb->amplitude);
+}
+
+static bool
+load_eventlog(FILE *in, const char *filename, int channel, struct evlist *l)
+{
+	struct eventlog_header hdr;
+	struct eventlogreader *reader = eventlog_open(in, &hdr);
+	if (reader == NULL || hdr.sample_rate == 0) {
+		fprintf(stderr, "%s: invalid event log\n", filename);
+		eventlog_close(reader);
+		return false;
+	}
+	l->binary = true;
+	l->sample_rate = hdr.sample_rate;
+
+	struct event ev[EVENTBATCH_SIZE];
+	long nb;
+	/* a single channel, or the one selected, is channel 0 */
+	const bool all = channel < 0 && hdr.channels > 1;
+	if (hdr.channels <= 1)
+		channel = -1;
+	while ((nb = eventlog_read(reader, ev, EVENTBATCH_SIZE)) > 0)
+		for (long i = 0; i < nb; i++)
+			if (channel < 0 || ev[i].channel == (uint32_t) channel)
+				evlist_push(l, (double) ev[i].spl
+					    / hdr.sample_rate, ev[i].amplitude,
+					    false, ev[i].spl,
+					    all ? ev[i].channel : 0);
+	eventlog_close(reader);
+	/* the events of the channels at the same sample may come in any
+	   order */
+	qsort(l->ev, l->nb, sizeof(struct evrecord), &evrecord_cmp);
+	if (nb < 0) {
+		fprintf(stderr, "%s: truncated or corrupted event log\n",
+			filename);
+		return false;
+	}
+	return true;
+}
+
+static bool
+load_text(FILE *in, const char *filename, struct evlist *l)
+{
+	char line[256];
+	unsigned long n = 0;
+	bool sorted = true;
+	while (fgets(line, sizeof line, in) != NULL) {
+		n++;
+		if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+			continue;
+		double time;
+		long amplitude = 0;
+		int piled = 0;
+		if (sscanf(line, "%lf %ld %d", &time, &amplitude, &piled) < 1) {
+			fprintf(stderr, "%s:%lu: not an event\n", filename, n);
+			return false;
+		}
+		if (l->nb && time < l->ev[l->nb - 1].time)
+			sorted = false;
+		evlist_push(l, time, amplitude, piled != 0, 0, 0);
+	}
+	/* the lists made by hand may be a little out of order */
+	if (!sorted) {
+		fprintf(stderr, "%s: events not in order, sorted\n", filename);
+		qsort(l->ev, l->nb, sizeof(struct evrecord), &evrecord_cmp);
+	}
+	return true;
+}
+
+/* Load a text list or a binary event log ("-" for stdin), only the events
+   of channel if it is a multi-channel log and channel >= 0 */
+static bool
+load(const char *filename, int channel, struct evlist *l)
+{
+	memset(l, 0, sizeof *l);
+	FILE *in = stdin;
+	if (strcmp(filename, "-")) {
+		in = fopen(filename, "rb");
+		if (in == NULL) {
+			fprintf(stderr, "Unable to open %s: %s\n", filename,
+				strerror(errno));
+			return false;
+		}
+	}
+
+	/* an event log starts with "GEVL", a text list with a number or a
+	   comment */
+	const int c = getc(in);
+	bool ok;
+	if (c == EOF) {
+		ok = !ferror(in);
+	} else {
+		ungetc(c, in);
+		ok = c == 'G' ? load_eventlog(in, filename, channel, l)
+			: load_text(in, filename, l);
+	}
+	if (ok && ferror(in)) {
+		fprintf(stderr, "%s: read error: %s\n", filename,
+			strerror(errno));
+		ok = false;
+	}
+	if (in != stdin)
+		fclose(in);
+	return ok;
+}
+
+struct comparison {
+	size_t hits;
+	size_t misses;
+	size_t false_positives;
+	size_t piled;          /* reference events piled up */
+	size_t piled_misses;
+	size_t same;           /* hits at the same time with the same amplitude
+				  (on the same channel) */
+	double jitter_sum;
+	double jitter_sum2;
+	double jitter_max;
+};
+
+static void
+compare(const struct evlist *ref, const struct evlist *det, double tolerance,
+	struct comparison *c)
+{
+	memset(c, 0, sizeof *c);
+	/* exact comparison of the sample numbers when both are event logs */
+	const bool spl = ref->binary && det->binary
+		&& ref->sample_rate == det->sample_rate;
+
+	size_t i = 0, j = 0;
+	while (i < ref->nb && j < det->nb) {
+		const struct evrecord *r = &ref->ev[i], *d = &det->ev[j];
+		const double jitter = d->time - r->time;
+		if (r->channel != d->channel) {
+			/* the events left on the channel of the lowest one */
+			if (r->channel < d->channel) {
+				c->misses++;
+				if (r->piled)
+					c->piled_misses++;
+				i++;
+			} else {
+				c->false_positives++;
+				j++;
+			}
+		} else if (fabs(jitter) <= tolerance) {
+			c->hits++;
+			c->jitter_sum += jitter;
+			c->jitter_sum2 += jitter * jitter;
+			if (fabs(jitter) > c->jitter_max)
+				c->jitter_max = fabs(jitter);
+			if ((spl ? r->spl == d->spl : jitter == 0)
+			    && r->amplitude == d->amplitude
+			    && r->channel == d->channel)
+				c->same++;
+			i++;
+			j++;
+		} else if (jitter < 0) {
+			c->false_positives++;
+			j++;
+		} else {
+			c->misses++;
+			if (r->piled)
+				c->piled_misses++;
+			i++;
+		}
+	}
+	for (; i < ref->nb; i++) {
+		c->misses++;
+		if (ref->ev[i].piled)
+			c->piled_misses++;
+	}
+	c->false_positives += det->nb - j;
+	for (i = 0; i < ref->nb; i++)
+		if (ref->ev[i].piled)
+			c->piled++;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: evcompare [-t tolerance] [-m miss_ratio] "
+		"[-f fp_ratio] [-c channel] [-x] [-q]\n"
+		"                 reference detected\n");
+	fprintf(stderr, "\t -t: tolerance on the time of the events in s "
+		"(0.001)\n");
+	fprintf(stderr, "\t -m: fail if more than this ratio of the reference "
+		"events are missed\n");
+	fprintf(stderr, "\t -f: fail if more than this ratio of the detected "
+		"events are false positives\n");
+	fprintf(stderr, "\t -c: only compare this channel (from 0) of the "
+		"multi-channel event logs\n");
+	fprintf(stderr, "\t -x: fail unless both lists hold exactly the same "
+		"events\n");
+	fprintf(stderr, "\t -q: only report a failure\n");
+	fprintf(stderr, "\t reference, detected: text lists or binary event "
+		"logs, - for stdin\n");
+}
+
+static double
+ratio(const char *arg)
+{
+	char *end;
+	const double v = strtod(arg, &end);
+	if (end == arg || *end != '\0' || !(v >= 0 && v <= 1)) {
+		fprintf(stderr, "incorrect ratio: %s\n", arg);
+		usage();
+		exit(EXIT_FAILURE);
+	}
+	return v;
+}
+
+int
+main(int argc, char *argv[])
+{
+	double tolerance = 0.001;
+	double max_misses = 1;
+	double max_false_positives = 1;
+	bool exact = false;
+	bool quiet = false;
+	int channel = -1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "t:m:f:c:xq")) != -1) {
+		switch (opt) {
+		case 't':
+			tolerance = strtod(optarg, NULL);
+			if (!(tolerance >= 0)) {
+				fprintf(stderr, "incorrect time "
+					"specification\n");
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'm':
+			max_misses = ratio(optarg);
+			break;
+		case 'f':
+			max_false_positives = ratio(optarg);
+			break;
+		case 'c':
+			channel = strtol(optarg, NULL, 10);
+			if (channel < 0) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'x':
+			exact = true;
+			break;
+		case 'q':
+			quiet = true;
+			break;
+		default:
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (optind != argc - 2
+	    || (!strcmp(argv[optind], "-") && !strcmp(argv[optind + 1], "-"))) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+	const char *refname = argv[optind];
+	const char *detname = argv[optind + 1];
+
+	struct evlist ref, det;
+	if (!load(refname, channel, &ref))
+		exit(EXIT_FAILURE);
+	if (!load(detname, channel, &det)) {
+		free(ref.ev);
+		exit(EXIT_FAILURE);
+	}
+
+	struct comparison c;
+	compare(&ref, &det, exact ? 0 : tolerance, &c);
+
+	const double miss_ratio = ref.nb ? (double) c.misses / ref.nb : 0;
+	const double fp_ratio = det.nb
+		? (double) c.false_positives / det.nb : 0;
+	bool ok = miss_ratio <= max_misses && fp_ratio <= max_false_positives;
+	if (exact)
+		ok = ok && c.same == ref.nb && c.same == det.nb;
+
+	if (!quiet || !ok) {
+		printf("%s: %zu reference events, %s: %zu detected\n", refname,
+		       ref.nb, detname, det.nb);
+		printf("hits: %zu, misses: %zu (%.2f%%), false positives: %zu "
+		       "(%.2f%%)\n", c.hits, c.misses, 100 * miss_ratio,
+		       c.false_positives, 100 * fp_ratio);
+		if (c.piled)
+			printf("piled up: %zu, missed: %zu\n", c.piled,
+			       c.piled_misses);
+		if (c.hits) {
+			const double mean = c.jitter_sum / c.hits;
+			const double var = c.jitter_sum2 / c.hits - mean * mean;
+			printf("jitter: mean %.1f us, std dev %.1f us, "
+			       "max %.1f us\n", 1e6 * mean,
+			       1e6 * sqrt(var > 0 ? var : 0),
+			       1e6 * c.jitter_max);
+		}
+		if (exact)
+			printf("identical events: %zu\n", c.same);
+		printf("%s\n", ok ? "PASS" : "FAIL");
+	}
+
+	free(ref.ev);
+	free(det.ev);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,283 @@
+/* Geiger counter listener prototype - 2012
+ * by "Cyrus Smith" for "Le Projet Olduva"
+ *
+ * See http://le-projet-olduvai.wikiforum.net/t6044-projet-de-logiciel-pour-compteur-geiger-muller
+ *
+ * This code is under GNU GPLv3.
+ *
+ * Binary event log: writer (an event sink) and reader. See eventlog.h for
+ * the format. An event usually takes 4 to 6 bytes, instead of 15 for a text
+ * line, and is decoded without any parsing of decimal numbers.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "eventlog.h"
+
+#define EVENTLOG_MAGIC "GEVL"
+#define EVENTLOG_HEADER_SIZE (30)
+#define EVENTLOG_BUFSIZE (64 * 1024)
+#define EVENTLOG_EVENTMAX (17) /* longest encoded event */
+#define EVENTLOG_MAXCHANNELS (UINT8_MAX)
+
+
+static void
+put_le(unsigned char *p, uint64_t v, int size)
+{
+	for (int i = 0; i < size; i++)
+		p[i] = (v >> (8 * i)) & 0xff;
+}
+
+static uint64_t
+get_le(const unsigned char *p, int size)
+{
+	uint64_t v = 0;
+	for (int i = 0; i < size; i++)
+		v |= ((uint64_t) p[i]) << (8 * i);
+	return v;
+}
+
+static size_t
+put_varint(unsigned char *p, uint64_t v)
+{
+	size_t n = 0;
+	while (v >= 0x80) {
+		p[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+	return n;
+}
+
+static uint32_t
+zigzag(int32_t v)
+{
+	return ((uint32_t) v << 1) ^ (uint32_t) (v >> 31);
+}
+
+static int32_t
+unzigzag(uint32_t v)
+{
+	return (int32_t) (v >> 1) ^ -(int32_t) (v & 1);
+}
+
+
+/* Writer */
+
+struct eventsinkdata {
+	FILE *out;
+	unsigned channels;  /* 0 for version 1 */
+	uint64_t last_spl[EVENTLOG_MAXCHANNELS];
+	size_t len;
+	unsigned char buf[EVENTLOG_BUFSIZE];
+};
+
+static void
+eventlogsink_flush(struct eventsinkdata *data)
+{
+	if (data->len) {
+		fwrite(data->buf, 1, data->len, data->out);
+		data->len = 0;
+	}
+	fflush(data->out);
+}
+
+static void
+eventlogsink_write(const struct event *ev, size_t nb,
+		   struct eventsinkdata *data)
+{
+	for (size_t i = 0; i < nb; i++) {
+		if (data->len + EVENTLOG_EVENTMAX > EVENTLOG_BUFSIZE) {
+			fwrite(data->buf, 1, data->len, data->out);
+			data->len = 0;
+		}
+		const uint32_t c = ev[i].channel;
+		assert(data->channels ? c < data->channels : c == 0);
+		assert(ev[i].spl >= data->last_spl[c]);
+		if (data->channels)
+			data->len += put_varint(data->buf + data->len, c);
+		data->len += put_varint(data->buf + data->len,
+					ev[i].spl - data->last_spl[c]);
+		data->len += put_varint(data->buf + data->len,
+					zigzag(ev[i].amplitude));
+		data->last_spl[c] = ev[i].spl;
+	}
+}
+
+static int
+terminate_eventlogsink(struct eventsink *sink)
+{
+	assert(sink != NULL);
+	assert(sink->data != NULL);
+	eventlogsink_flush(sink->data);
+	free(sink->data);
+	free(sink);
+	return 0;
+}
+
+struct eventsink*
+init_eventlogsink(FILE *out, const struct eventlog_header *hdr)
+{
+	assert(out != NULL);
+	assert(hdr != NULL);
+	assert(hdr->channels <= EVENTLOG_MAXCHANNELS);
+	struct eventsink *sink = (struct eventsink*)
+		calloc(1, sizeof(struct eventsink));
+	if (sink == NULL)
+		return NULL;
+	sink->data = (struct eventsinkdata *)
+		calloc(1, sizeof(struct eventsinkdata));
+	if (sink->data == NULL) {
+		free(sink);
+		return NULL;
+	}
+
+	sink->name = "eventlog";
+	sink->write = &eventlogsink_write;
+	sink->flush = &eventlogsink_flush;
+	sink->terminate = &terminate_eventlogsink;
+	sink->data->out = out;
+
+	const char *end = memchr(hdr->detector, '\0', sizeof hdr->detector);
+	size_t namelen = end ? (size_t) (end - hdr->detector)
+		: sizeof hdr->detector;
+	if (namelen > UINT8_MAX)
+		namelen = UINT8_MAX;
+	uint64_t dead_time;
+	memcpy(&dead_time, &hdr->dead_time, sizeof dead_time);
+
+	/* A single channel keeps the format of version 1 */
+	unsigned char *p = sink->data->buf;
+	size_t len = EVENTLOG_HEADER_SIZE;
+	memcpy(p, EVENTLOG_MAGIC, 4);
+	p[4] = EVENTLOG_VERSION;
+	p[5] = namelen;
+	put_le(p + 6, hdr->sample_rate, 4);
+	put_le(p + 10, (uint64_t) hdr->start_time, 8);
+	put_le(p + 18, hdr->threshold, 4);
+	put_le(p + 22, dead_time, 8);
+	if (hdr->channels > 1) {
+		p[4] = EVENTLOG_VERSION_CHANNELS;
+		p[len++] = hdr->channels;
+		sink->data->channels = hdr->channels;
+	}
+	memcpy(p + len, hdr->detector, namelen);
+	sink->data->len = len + namelen;
+	return sink;
+}
+
+
+/* Reader */
+
+struct eventlogreader {
+	FILE *in;
+	unsigned channels;  /* 0 for version 1 */
+	uint64_t last_spl[EVENTLOG_MAXCHANNELS];
+	size_t pos;
+	size_t len;
+	unsigned char buf[EVENTLOG_BUFSIZE];
+};
+
+/* Make sure that the buffer holds at least EVENTLOG_EVENTMAX bytes, unless
+   the end of the file is reached. Returns the number of bytes available. */
+static size_t
+refill(struct eventlogreader *r)
+{
+	if (r->len - r->pos >= EVENTLOG_EVENTMAX)
+		return r->len - r->pos;
+	memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+	r->len -= r->pos;
+	r->pos = 0;
+	r->len += fread(r->buf + r->len, 1, sizeof r->buf - r->len, r->in);
+	return r->len;
+}
+
+/* Decode a varint from p, at most avail bytes. Returns its length, or 0 if
+   it is incomplete or too long. */
+static size_t
+get_varint(const unsigned char *p, size_t avail, uint64_t *v)
+{
+	*v = 0;
+	for (size_t n = 0; n < avail && n < 10; n++) {
+		*v |= ((uint64_t) (p[n] & 0x7f)) << (7 * n);
+		if (!(p[n] & 0x80))
+			return n + 1;
+	}
+	return 0;
+}
+
+struct eventlogreader*
+eventlog_open(FILE *in, struct eventlog_header *hdr)
+{
+	assert(in != NULL);
+	assert(hdr != NULL);
+	unsigned char h[EVENTLOG_HEADER_SIZE];
+	if (fread(h, 1, sizeof h, in) != sizeof h
+	    || memcmp(h, EVENTLOG_MAGIC, 4)
+	    || (h[4] != EVENTLOG_VERSION && h[4] != EVENTLOG_VERSION_CHANNELS))
+		return NULL;
+
+	memset(hdr, 0, sizeof *hdr);
+	hdr->sample_rate = get_le(h + 6, 4);
+	hdr->start_time = (int64_t) get_le(h + 10, 8);
+	hdr->threshold = get_le(h + 18, 4);
+	uint64_t dead_time = get_le(h + 22, 8);
+	memcpy(&hdr->dead_time, &dead_time, sizeof dead_time);
+	hdr->channels = 1;
+	if (h[4] == EVENTLOG_VERSION_CHANNELS) {
+		int c = fgetc(in);
+		if (c == EOF || c == 0)
+			return NULL;
+		hdr->channels = c;
+	}
+	if (fread(hdr->detector, 1, h[5], in) != h[5])
+		return NULL;
+
+	struct eventlogreader *r = (struct eventlogreader*)
+		calloc(1, sizeof(struct eventlogreader));
+	if (r == NULL)
+		return NULL;
+	r->in = in;
+	if (h[4] == EVENTLOG_VERSION_CHANNELS)
+		r->channels = hdr->channels;
+	return r;
+}
+
+long
+eventlog_read(struct eventlogreader *r, struct event *ev, size_t nb)
+{
+	assert(r != NULL);
+	size_t i;
+	for (i = 0; i < nb; i++) {
+		size_t avail = refill(r);
+		if (avail == 0)
+			break;
+		uint64_t channel = 0, delta, amplitude;
+		size_t n0 = 0;
+		if (r->channels) {
+			n0 = get_varint(r->buf + r->pos, avail, &channel);
+			if (!n0 || channel >= r->channels)
+				return -1;
+		}
+		size_t n1 = get_varint(r->buf + r->pos + n0, avail - n0,
+				       &delta);
+		size_t n2 = n1 ? get_varint(r->buf + r->pos + n0 + n1,
+					    avail - n0 - n1, &amplitude) : 0;
+		if (!n2 || amplitude > UINT32_MAX)
+			return -1;
+		r->pos += n0 + n1 + n2;
+		r->last_spl[channel] += delta;
+		ev[i].spl = r->last_spl[channel];
+		ev[i].amplitude = unzigzag(amplitude);
+		ev[i].channel = channel;
+	}
+	return i;
+}
+
+void
+eventlog_close(struct eventlogreader *r)
+{
+	free(r);
+}
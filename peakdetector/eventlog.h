@@ -0,0 +1,69 @@
+#ifndef _EVENTLOG_H_
+#define _EVENTLOG_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "eventsink.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Binary event log.
+ *
+ * All the integers are little-endian. The file starts with a header:
+ *	offset 0:  "GEVL"
+ *	offset 4:  version (uint8_t, 1, or 2 for several channels)
+ *	offset 5:  length n of the detector name (uint8_t)
+ *	offset 6:  sample rate (uint32_t)
+ *	offset 10: start time of the recording, Unix time (int64_t, 0 if
+ *		   unknown)
+ *	offset 18: detection threshold (uint32_t)
+ *	offset 22: Geiger dead time in seconds (IEEE 754 double, as uint64_t)
+ *	offset 30: detector name (n bytes, not NUL-terminated)
+ * followed by the events, each one being:
+ *	- the number of samples since the previous event (since sample 0 for
+ *	  the first one), as an unsigned LEB128 varint;
+ *	- the amplitude, zigzag-encoded as an unsigned LEB128 varint.
+ *
+ * In version 2, the number of channels (uint8_t) is at offset 30, and the
+ * detector name at offset 31. Each event starts with its channel, as an
+ * unsigned LEB128 varint, and the number of samples is counted since the
+ * previous event of the same channel.
+ */
+
+#define EVENTLOG_VERSION (1)
+#define EVENTLOG_VERSION_CHANNELS (2)
+
+struct eventlog_header {
+	uint32_t sample_rate;
+	int64_t start_time;
+	uint32_t threshold;
+	double dead_time;
+	uint32_t channels;   /* 0 or 1 for a single channel, at most 255 */
+	char detector[256];
+};
+
+/* Event sink writing a binary event log to out. The header is written at
+   once. */
+struct eventsink* init_eventlogsink(FILE *out,
+				    const struct eventlog_header *hdr);
+
+struct eventlogreader;
+
+/* Read the header of the event log from in. Returns NULL on error. */
+struct eventlogreader* eventlog_open(FILE *in, struct eventlog_header *hdr);
+
+/* Read at most nb events. Returns the number of events read, 0 at the end
+   of the log, or -1 if the log is truncated or corrupted. */
+long eventlog_read(struct eventlogreader *reader, struct event *ev,
+		   size_t nb);
+
+void eventlog_close(struct eventlogreader *reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_EVENTLOG_H_ */
@@ -0,0 +1,94 @@
+/* Geiger counter listener prototype - 2012
+ * by "Cyrus Smith" for "Le Projet Olduva"
+ *
+ * See http://le-projet-olduvai.wikiforum.net/t6044-projet-de-logiciel-pour-compteur-geiger-muller
+ *
+ * This code is under GNU GPLv3.
+ *
+ * This program converts a binary event log (see eventlog.h), as written by
+ * "peakdetector -o", "geigerwave -o" or "geiger -o", back to the usual text
+ * output of the detectors (with a third column, the channel, for a
+ * multi-channel recording):
+ *    $ eventlogcat events.gevl
+ * or
+ *    $ peakdetector -o - C1 file.wav | eventlogcat
+ *
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "eventlog.h"
+#include "eventsink.h"
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: eventlogcat [eventlog]\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	if (argc > 2) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	FILE *in = stdin;
+	if (argc == 2 && strcmp(argv[1], "-")) {
+		in = fopen(argv[1], "rb");
+		if (in == NULL) {
+			fprintf(stderr, "Unable to open %s: %s\n", argv[1],
+				strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	struct eventlog_header hdr;
+	struct eventlogreader *reader = eventlog_open(in, &hdr);
+	if (reader == NULL) {
+		fprintf(stderr, "Input is not an event log\n");
+		exit(EXIT_FAILURE);
+	}
+
+	fprintf(stderr, "Detection algorithm: %s\n", hdr.detector);
+	fprintf(stderr, "Sample rate: %u\n", hdr.sample_rate);
+	fprintf(stderr, "Threshold: %u, Geiger dead time: %g s\n",
+		hdr.threshold, hdr.dead_time);
+	if (hdr.channels > 1)
+		fprintf(stderr, "Channels: %u\n", hdr.channels);
+	if (hdr.start_time) {
+		time_t start = hdr.start_time;
+		fprintf(stderr, "Start time: %s", ctime(&start));
+	}
+
+	struct eventsink *sink = hdr.channels > 1
+		? init_channeltextsink(stdout, hdr.sample_rate)
+		: init_textsink(stdout, hdr.sample_rate);
+	if (sink == NULL) {
+		fprintf(stderr, "Output initialization failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	struct event ev[EVENTBATCH_SIZE];
+	long nb;
+	while ((nb = eventlog_read(reader, ev, EVENTBATCH_SIZE)) > 0)
+		sink->write(ev, nb, sink->data);
+
+	sink->terminate(sink);
+	eventlog_close(reader);
+	if (in != stdin)
+		fclose(in);
+
+	if (nb < 0) {
+		fprintf(stderr, "Truncated or corrupted event log\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
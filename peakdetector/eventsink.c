@@ -0,0 +1,162 @@
+/* Geiger counter listener prototype - 2012
+ * by "Cyrus Smith" for "Le Projet Olduva"
+ *
+ * See http://le-projet-olduvai.wikiforum.net/t6044-projet-de-logiciel-pour-compteur-geiger-muller
+ *
+ * This code is under GNU GPLv3.
+ *
+ * Event sinks: the detectors hand their events by arrays to a sink, instead
+ * of calling a function (and printf) for each of them.
+ *
+ * The text sink formats the events itself in a large buffer, written with a
+ * single fwrite() when full: at high count rates, printf and the stdio
+ * locking were taking most of the time.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "eventsink.h"
+
+#define TEXTSINK_BUFSIZE (64 * 1024)
+#define TEXTSINK_LINEMAX (64) /* longest line written for one event */
+
+struct eventsinkdata {
+	FILE *out;
+	uint32_t sample_rate;
+	bool channels;     /* third column */
+	size_t len;
+	char buf[TEXTSINK_BUFSIZE];
+};
+
+/* Write the digits of v at the end of p, return the new start. */
+static char*
+utoa_rev(char *p, uint64_t v)
+{
+	do {
+		*--p = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	return p;
+}
+
+/* Same output as printf("%.4f\t%6d\n", time, amplitude). The rounding to
+   4 decimals is done on integers, unless the value is too close to a tie:
+   snprintf() then decides. */
+static size_t
+format_event(char *out, double time, int32_t amplitude)
+{
+	const double v = time * 10000;
+	const double fl = floor(v);
+	if (!(v >= 0 && v < 1e15)
+	    || fabs(v - fl - 0.5) <= v * 1e-15 + 1e-9)
+		return snprintf(out, TEXTSINK_LINEMAX, "%.4f\t%6d\n",
+				time, (int) amplitude);
+
+	const uint64_t t = (uint64_t) fl + (v - fl > 0.5);
+	char tmp[TEXTSINK_LINEMAX];
+	char *end = tmp + sizeof tmp;
+	char *p = end;
+
+	*--p = '\n';
+	const int64_t a = amplitude;
+	char *q = utoa_rev(p, a < 0 ? -a : a);
+	if (a < 0)
+		*--q = '-';
+	while (p - q < 6)
+		*--q = ' ';
+	p = q;
+	*--p = '\t';
+	uint64_t dec = t % 10000;
+	for (int i = 0; i < 4; i++) {
+		*--p = '0' + dec % 10;
+		dec /= 10;
+	}
+	*--p = '.';
+	p = utoa_rev(p, t / 10000);
+
+	const size_t len = end - p;
+	memcpy(out, p, len);
+	return len;
+}
+
+static void
+textsink_flush(struct eventsinkdata *data)
+{
+	if (data->len) {
+		fwrite(data->buf, 1, data->len, data->out);
+		data->len = 0;
+	}
+	fflush(data->out);
+}
+
+static void
+textsink_write(const struct event *ev, size_t nb, struct eventsinkdata *data)
+{
+	for (size_t i = 0; i < nb; i++) {
+		if (data->len + TEXTSINK_LINEMAX > TEXTSINK_BUFSIZE) {
+			fwrite(data->buf, 1, data->len, data->out);
+			data->len = 0;
+		}
+		double time = ((double) ev[i].spl) / data->sample_rate;
+		data->len += format_event(data->buf + data->len, time,
+					  ev[i].amplitude);
+		if (data->channels) {
+			/* "\tchannel" before the newline */
+			char tmp[16];
+			char *end = tmp + sizeof tmp;
+			char *p = utoa_rev(end, ev[i].channel);
+			*--p = '\t';
+			data->len--;
+			memcpy(data->buf + data->len, p, end - p);
+			data->len += end - p;
+			data->buf[data->len++] = '\n';
+		}
+	}
+}
+
+static int
+terminate_textsink(struct eventsink *sink)
+{
+	assert(sink != NULL);
+	assert(sink->data != NULL);
+	textsink_flush(sink->data);
+	free(sink->data);
+	free(sink);
+	return 0;
+}
+
+struct eventsink*
+init_textsink(FILE *out, uint32_t sample_rate)
+{
+	assert(out != NULL);
+	struct eventsink *sink = (struct eventsink*)
+		calloc(1, sizeof(struct eventsink));
+	if (sink == NULL)
+		return NULL;
+	sink->data = (struct eventsinkdata *)
+		calloc(1, sizeof(struct eventsinkdata));
+	if (sink->data == NULL) {
+		free(sink);
+		return NULL;
+	}
+
+	sink->name = "text";
+	sink->write = &textsink_write;
+	sink->flush = &textsink_flush;
+	sink->terminate = &terminate_textsink;
+	sink->data->out = out;
+	sink->data->sample_rate = sample_rate;
+	return sink;
+}
+
+struct eventsink*
+init_channeltextsink(FILE *out, uint32_t sample_rate)
+{
+	struct eventsink *sink = init_textsink(out, sample_rate);
+	if (sink != NULL)
+		sink->data->channels = true;
+	return sink;
+}
@@ -0,0 +1,77 @@
+#ifndef _EVENTSINK_H_
+#define _EVENTSINK_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A detected event. Its time is spl / sample rate. */
+struct event {
+	uint64_t spl;      /* sample number the event is reported at */
+	int32_t amplitude;
+	uint32_t channel;  /* of a multi-channel recording, 0 otherwise */
+};
+
+struct eventsinkdata;
+
+/* An event sink receives the events by whole arrays. */
+struct eventsink {
+	char *name;
+	void (*write)(const struct event *ev, size_t nb,
+		      struct eventsinkdata *data);
+	void (*flush)(struct eventsinkdata *data);
+	int (*terminate)(struct eventsink *sink); /* flushes, then frees */
+	struct eventsinkdata *data;
+};
+
+/* Text output, one "time<TAB>amplitude" line per event. The output is
+   buffered and only written to out when the buffer is full or flushed. */
+struct eventsink* init_textsink(FILE *out, uint32_t sample_rate);
+
+/* Same, with a third column: "time<TAB>amplitude<TAB>channel". */
+struct eventsink* init_channeltextsink(FILE *out, uint32_t sample_rate);
+
+/* Counts the events in *count, and passes them to next (which may be NULL).
+   Terminating the counting sink also terminates next. */
+struct eventsink* init_countsink(struct eventsink *next, uint64_t *count);
+
+
+/* Preallocated buffer used by the detectors to pass their events to a sink
+   by batches. */
+#define EVENTBATCH_SIZE (256)
+
+struct eventbatch {
+	size_t nb;
+	struct event ev[EVENTBATCH_SIZE];
+};
+
+static inline void
+eventbatch_flush(struct eventbatch *batch, struct eventsink *sink)
+{
+	if (batch->nb) {
+		sink->write(batch->ev, batch->nb, sink->data);
+		batch->nb = 0;
+	}
+}
+
+static inline void
+eventbatch_push(struct eventbatch *batch, struct eventsink *sink,
+		uint64_t spl, int32_t amplitude)
+{
+	if (batch->nb == EVENTBATCH_SIZE)
+		eventbatch_flush(batch, sink);
+	batch->ev[batch->nb].spl = spl;
+	batch->ev[batch->nb].amplitude = amplitude;
+	batch->ev[batch->nb].channel = 0;
+	batch->nb++;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_EVENTSINK_H_ */
@@ -0,0 +1,275 @@
+/* Geiger counter listener prototype - 2012
+ * by "Cyrus Smith" for "Le Projet Olduva"
+ *
+ * See http://le-projet-olduvai.wikiforum.net/t6044-projet-de-logiciel-pour-compteur-geiger-muller
+ *
+ * This code is under GNU GPLv3.
+ *
+ * Throughput benchmark of the analysis stages: the detectors C1, PPP and
+ * PEAK (the algorithm of CPeakDetector), and the decimation of streamfilter.
+ * Each file is loaded in memory first, so that only the computation is
+ * timed; each stage runs several times and the fastest run is kept. The
+ * results are written as a table:
+ *    $ geigergen -d 600 -c 200 high.wav
+ *    $ geigerbench high.wav
+ *
+ * For the decimation, the events column gives the output samples.
+ *
+ * geigerwave itself is timed by "geigerwave -t", see "make bench".
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sndfile.h>
+
+#include "peakdetector.h"
+#include "decimate.h"
+#include "detector_c1.h"
+#include "detector_peak.h"
+#include "detector_ppp.h"
+
+/* Samples passed at once, as peakdetector does for files */
+#define BENCH_BLOCK (16384)
+
+static const char *detecnames[] = { "C1", "PPP", "PEAK" };
+
+struct detector* (*detecinit[])(uint32_t sample_rate,
+				const struct parameters *params,
+				struct eventsink *sink) = {
+	&init_detector_c1, &init_detector_ppp, &init_detector_peak
+};
+
+struct result {
+	uint64_t events;
+	double seconds;
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Load a whole 16-bit mono WAV file. Returns NULL on error. */
+static int16_t*
+load(const char *filename, uint64_t *nb, uint32_t *sample_rate)
+{
+	SF_INFO sinfo;
+	memset(&sinfo, 0, sizeof sinfo);
+	SNDFILE *stream = sf_open(filename, SFM_READ, &sinfo);
+	if (stream == NULL) {
+		fprintf(stderr, "%s: unable to open audio stream: %s\n",
+			filename, sf_strerror(NULL));
+		return NULL;
+	}
+	if (sinfo.channels != 1
+	    || sinfo.format != (SF_FORMAT_WAV | SF_FORMAT_PCM_16)) {
+		fprintf(stderr, "%s: input is not a 16-bit mono PCM WAV file\n",
+			filename);
+		sf_close(stream);
+		return NULL;
+	}
+
+	/* one more sample, to read the end of the file without growing */
+	size_t size = sinfo.frames > 0 ? sinfo.frames + 1 : BENCH_BLOCK;
+	int16_t *samples = malloc(size * sizeof(int16_t));
+	*nb = 0;
+	while (samples != NULL) {
+		if (*nb == size) {
+			size *= 2;
+			int16_t *s = realloc(samples, size * sizeof(int16_t));
+			if (s == NULL) {
+				free(samples);
+				samples = NULL;
+				break;
+			}
+			samples = s;
+		}
+		sf_count_t n = sf_readf_short(stream, samples + *nb,
+					      size - *nb);
+		if (n <= 0)
+			break;
+		*nb += n;
+	}
+	if (samples == NULL)
+		fprintf(stderr, "%s: not enough memory\n", filename);
+	else if (sf_error(stream) != SF_ERR_NO_ERROR) {
+		fprintf(stderr, "%s: read error: %s\n", filename,
+			sf_strerror(stream));
+		free(samples);
+		samples = NULL;
+	}
+	*sample_rate = sinfo.samplerate;
+	sf_close(stream);
+	return samples;
+}
+
+static bool
+run_detector(unsigned detector, const int16_t *samples, uint64_t nb,
+	     uint32_t sample_rate, const struct parameters *params,
+	     struct result *res)
+{
+	res->events = 0;
+	struct eventsink *counter = init_countsink(NULL, &res->events);
+	if (counter == NULL)
+		return false;
+	struct detector *d = detecinit[detector](sample_rate, params,
+						 counter);
+	if (d == NULL) {
+		counter->terminate(counter);
+		return false;
+	}
+
+	const double t0 = now();
+	for (uint64_t spl = 0; spl < nb; spl += BENCH_BLOCK) {
+		const size_t len = nb - spl < BENCH_BLOCK ? nb - spl
+			: BENCH_BLOCK;
+		d->detector(samples + spl, len, d->data);
+	}
+	d->terminate(d);
+	counter->terminate(counter);
+	res->seconds = now() - t0;
+	return true;
+}
+
+static bool
+run_decimate(double Tg, const int16_t *samples, uint64_t nb,
+	     uint32_t sample_rate, struct result *res)
+{
+	struct decimator dec;
+	if (decimator_init(&dec, sample_rate, Tg))
+		return false;
+
+	static int16_t out[BENCH_BLOCK];
+	uint64_t total = 0;
+	const double t0 = now();
+	for (uint64_t spl = 0; spl < nb; spl += BENCH_BLOCK) {
+		const size_t len = nb - spl < BENCH_BLOCK ? nb - spl
+			: BENCH_BLOCK;
+		total += decimate(&dec, samples + spl, len, out);
+	}
+	res->seconds = now() - t0;
+	/* the output samples, so that the loop is not optimized out */
+	res->events = total;
+	return true;
+}
+
+static void
+report(const char *filename, const char *stage, uint64_t nb,
+       const struct result *res, bool events)
+{
+	printf("%s\t%s\t%llu\t%llu\t%.4f\t%.1f\t", filename, stage,
+	       (unsigned long long) nb, (unsigned long long) res->events,
+	       res->seconds, res->seconds > 0 ? nb / res->seconds / 1e6 : 0);
+	if (events)
+		printf("%.0f\n", res->seconds > 0 ? res->events / res->seconds
+		       : 0);
+	else
+		printf("-\n");
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: geigerbench [-n runs] [-f Tg] file.wav...\n");
+	fprintf(stderr, "\t -n: runs of each stage, the fastest one is kept "
+		"(3)\n");
+	fprintf(stderr, "\t -f: Geiger dead time of the decimation in s "
+		"(0.001)\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	const struct parameters params = {500, 0.001};
+	unsigned runs = 3;
+	double Tg = 0.001;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:f:")) != -1) {
+		switch (opt) {
+		case 'n':
+			runs = atoi(optarg);
+			if (runs == 0) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'f':
+			Tg = strtod(optarg, NULL);
+			if (Tg * 10000 <= 0 || Tg > 1) {
+				fprintf(stderr, "incorrect time "
+					"specification\n");
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		default:
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (optind >= argc) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	printf("# file\tstage\tsamples\tevents\ttime (s)\tMspl/s\tevents/s\n");
+	int ret = EXIT_SUCCESS;
+	for (int i = optind; i < argc; i++) {
+		uint64_t nb;
+		uint32_t sample_rate;
+		int16_t *samples = load(argv[i], &nb, &sample_rate);
+		if (samples == NULL) {
+			ret = EXIT_FAILURE;
+			continue;
+		}
+
+		struct result best, res;
+		for (unsigned k = 0; k < sizeof detecnames / sizeof *detecnames;
+		     k++) {
+			best.seconds = -1;
+			for (unsigned r = 0; r < runs; r++) {
+				if (!run_detector(k, samples, nb, sample_rate,
+						  &params, &res)) {
+					fprintf(stderr, "Detector "
+						"initialization failed\n");
+					exit(EXIT_FAILURE);
+				}
+				if (best.seconds < 0
+				    || res.seconds < best.seconds)
+					best = res;
+			}
+			report(argv[i], detecnames[k], nb, &best, true);
+		}
+
+		best.seconds = -1;
+		for (unsigned r = 0; r < runs; r++) {
+			if (!run_decimate(Tg, samples, nb, sample_rate, &res)) {
+				fprintf(stderr, "%s: Geiger dead time of %g s "
+					"shorter than two samples\n", argv[i],
+					Tg);
+				ret = EXIT_FAILURE;
+				break;
+			}
+			if (best.seconds < 0 || res.seconds < best.seconds)
+				best = res;
+		}
+		if (best.seconds >= 0)
+			report(argv[i], "decimate", nb, &best, false);
+		free(samples);
+	}
+	return ret;
+}
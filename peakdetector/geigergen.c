@@ -0,0 +1,529 @@
+/* Geiger counter listener prototype - 2012
+ * by "Cyrus Smith" for "Le Projet Olduva"
+ *
+ * See http://le-projet-olduvai.wikiforum.net/t6044-projet-de-logiciel-pour-compteur-geiger-muller
+ *
+ * This code is under GNU GPLv3.
+ *
+ * This program writes a synthetic recording of a Geiger counter, and the
+ * list of the pulses it contains (the ground truth), to measure the speed
+ * and the accuracy of the detectors on known inputs:
+ *    $ geigergen -d 3600 -c 50 -t truth.txt test.wav
+ *
+ * The pulses arrive as a Poisson process. Each one is a difference of two
+ * exponentials (rise and decay times), scaled to a random peak amplitude.
+ * Pulses closer than the dead time of the tube are lost (non-paralyzable
+ * model), the others are summed: at high count rates they pile up. White
+ * Gaussian noise and a mains hum are added, then the signal is rounded and
+ * clipped to 16 bits (or fewer, with -Q).
+ *
+ * The file is written in any sample format (-f), from the same 16-bit
+ * samples: the 24 and 32-bit integers and the floats hold exactly the
+ * 16-bit signal, scaled, and give the same events. The 8-bit samples only
+ * keep its high byte: with -Q 8, the 16-bit signal is that one.
+ *
+ * The ground truth has one line per pulse, as the detectors write them:
+ * the time of its peak, its amplitude, and 1 if it starts on the tail of
+ * the previous pulse (pile-up), 0 otherwise. Its first lines, starting
+ * with '#', give the parameters.
+ *
+ * With several channels (-C), each channel is a tube of its own: channel k
+ * is exactly the recording written with the seed + k, and the ground truth
+ * is the one of the first channel.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sndfile.h>
+
+#ifndef M_PI
+#define M_PI (3.14159265358979323846)
+#endif
+
+#define GEN_BLOCK (4096)   /* samples computed at once */
+#define GEN_TAIL (12)      /* length of a pulse, in decay times */
+#define GEN_PILEUP (0.1)   /* tail level, relative to the peak, under which
+			      a new pulse is not counted as piled up */
+#define GEN_MAX_CHANNELS (16)
+
+struct genparams {
+	uint32_t sample_rate;
+	double duration;       /* s */
+	double count_rate;     /* pulses per second, before the dead time */
+	double amplitude;      /* mean peak amplitude */
+	double spread;         /* standard deviation of the amplitude,
+				  relative to the mean */
+	double rise;           /* rise and decay times of a pulse, in s */
+	double decay;
+	bool negative;         /* polarity of the pulses */
+	double dead_time;      /* dead time of the tube, in s */
+	double noise;          /* RMS of the baseline noise */
+	double hum;            /* amplitude and frequency of the mains hum */
+	double hum_freq;
+	uint64_t seed;
+	unsigned bits;         /* resolution of the 16-bit samples */
+};
+
+static const struct {
+	const char *name;
+	int format;
+} formats[] = {
+	{ "int8", SF_FORMAT_PCM_U8 },
+	{ "int16", SF_FORMAT_PCM_16 },
+	{ "int24", SF_FORMAT_PCM_24 },
+	{ "int32", SF_FORMAT_PCM_32 },
+	{ "float", SF_FORMAT_FLOAT },
+};
+#define NB_FORMATS (sizeof formats / sizeof formats[0])
+
+
+/* Pseudo-random numbers: xorshift64*, the same sequence on every system
+   for a given seed. Each channel has its own sequence. */
+
+struct rng {
+	uint64_t state;
+	bool have_spare;       /* second number of Box-Muller */
+	double spare;
+};
+
+static void
+rng_seed(struct rng *r, uint64_t seed)
+{
+	/* splitmix64 step, so that close seeds give unrelated sequences */
+	uint64_t z = seed + 0x9e3779b97f4a7c15ULL;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	r->state = (z ^ (z >> 31)) | 1;
+	r->have_spare = false;
+}
+
+static uint64_t
+rng_next(struct rng *r)
+{
+	r->state ^= r->state >> 12;
+	r->state ^= r->state << 25;
+	r->state ^= r->state >> 27;
+	return r->state * 0x2545f4914f6cdd1dULL;
+}
+
+/* Uniform in (0, 1] */
+static double
+rng_uniform(struct rng *r)
+{
+	return ((rng_next(r) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+/* Standard normal (Box-Muller) */
+static double
+rng_gauss(struct rng *r)
+{
+	if (r->have_spare) {
+		r->have_spare = false;
+		return r->spare;
+	}
+	const double m = sqrt(-2 * log(rng_uniform(r)));
+	const double phi = 2 * M_PI * rng_uniform(r);
+	r->spare = m * sin(phi);
+	r->have_spare = true;
+	return m * cos(phi);
+}
+
+
+/* A pulse being rendered: its value at sample next is
+   scale * (decay_term - rise_term). */
+struct pulse {
+	uint64_t next;
+	uint64_t end;
+	double scale;
+	double decay_term;
+	double rise_term;
+};
+
+struct generator {
+	const struct genparams *p;
+	struct rng rng;
+	double peak_time;      /* time from the start to the peak of a pulse */
+	double peak_value;     /* peak of the unscaled shape */
+	double pileup_time;    /* length of a pulse above GEN_PILEUP */
+	double kdecay;         /* factors of the exponentials per sample */
+	double krise;
+	double next_arrival;   /* in s */
+	double last_start;     /* start of the last pulse kept, in s */
+	struct pulse *pulses;
+	size_t nb_pulses;
+	size_t size;
+	FILE *truth;
+	uint64_t kept;
+	uint64_t lost;
+	uint64_t piled;
+	uint64_t clipped;
+};
+
+/* Unscaled shape of a pulse, t seconds after its start */
+static double
+shape(const struct genparams *p, double t)
+{
+	return exp(-t / p->decay) - exp(-t / p->rise);
+}
+
+static void
+generator_init(struct generator *g, const struct genparams *p, uint64_t seed,
+	       FILE *truth)
+{
+	memset(g, 0, sizeof *g);
+	g->p = p;
+	g->truth = truth;
+	g->peak_time = log(p->decay / p->rise) * p->rise * p->decay
+		/ (p->decay - p->rise);
+	g->peak_value = shape(p, g->peak_time);
+	/* the tail decreases: find where it crosses GEN_PILEUP by bisection */
+	double lo = g->peak_time, hi = GEN_TAIL * p->decay;
+	while (hi - lo > 1e-9) {
+		const double mid = (lo + hi) / 2;
+		if (shape(p, mid) > GEN_PILEUP * g->peak_value)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	g->pileup_time = hi;
+	g->kdecay = exp(-1 / (p->decay * p->sample_rate));
+	g->krise = exp(-1 / (p->rise * p->sample_rate));
+	g->last_start = -INFINITY;
+	rng_seed(&g->rng, seed);
+	g->next_arrival = p->count_rate > 0
+		? -log(rng_uniform(&g->rng)) / p->count_rate : INFINITY;
+}
+
+static void
+add_pulse(struct generator *g, double start)
+{
+	const struct genparams *p = g->p;
+	double amplitude = p->amplitude * (1 + p->spread * rng_gauss(&g->rng));
+	if (amplitude < 0)
+		amplitude = 0;
+	if (p->negative)
+		amplitude = -amplitude;
+	const bool piled = start - g->last_start < g->pileup_time;
+	g->last_start = start;
+	g->kept++;
+	if (piled)
+		g->piled++;
+	if (g->truth != NULL)
+		fprintf(g->truth, "%.6f\t%6.0f\t%d\n", start + g->peak_time,
+			amplitude, piled);
+
+	if (g->nb_pulses == g->size) {
+		g->size = g->size ? 2 * g->size : 64;
+		g->pulses = realloc(g->pulses, g->size * sizeof(struct pulse));
+		assert(g->pulses != NULL);
+	}
+	struct pulse *pl = &g->pulses[g->nb_pulses++];
+	const double rate = p->sample_rate;
+	pl->next = (uint64_t) ceil(start * rate);
+	pl->end = (uint64_t) ceil((start + GEN_TAIL * p->decay) * rate);
+	pl->scale = amplitude / g->peak_value;
+	const double t = pl->next / rate - start;
+	pl->decay_term = exp(-t / p->decay);
+	pl->rise_term = exp(-t / p->rise);
+}
+
+/* Compute the samples [from, from + nb) into out. */
+static void
+generate(struct generator *g, uint64_t from, size_t nb, int16_t *out)
+{
+	const struct genparams *p = g->p;
+	const double rate = p->sample_rate;
+	const uint64_t to = from + nb;
+
+	/* New pulses starting in the block */
+	while (g->next_arrival * rate < to) {
+		if (g->next_arrival - g->last_start >= p->dead_time)
+			add_pulse(g, g->next_arrival);
+		else
+			g->lost++;
+		g->next_arrival += -log(rng_uniform(&g->rng)) / p->count_rate;
+	}
+
+	double acc[GEN_BLOCK];
+	assert(nb <= GEN_BLOCK);
+	for (size_t i = 0; i < nb; i++) {
+		acc[i] = p->noise * rng_gauss(&g->rng);
+		if (p->hum != 0)
+			acc[i] += p->hum
+				* sin(2 * M_PI * p->hum_freq * (from + i) / rate);
+	}
+
+	size_t k = 0;
+	for (size_t j = 0; j < g->nb_pulses; j++) {
+		struct pulse *pl = &g->pulses[j];
+		const uint64_t end = pl->end < to ? pl->end : to;
+		for (; pl->next < end; pl->next++) {
+			acc[pl->next - from] += pl->scale
+				* (pl->decay_term - pl->rise_term);
+			pl->decay_term *= g->kdecay;
+			pl->rise_term *= g->krise;
+		}
+		if (pl->next < pl->end)
+			g->pulses[k++] = *pl;
+	}
+	g->nb_pulses = k;
+
+	/* rounded to a multiple of step, the last one is step - 1 lower than
+	   the 16-bit limit */
+	const double step = 1 << (16 - p->bits);
+	for (size_t i = 0; i < nb; i++) {
+		const double v = step * nearbyint(acc[i] / step);
+		if (v > INT16_MAX || v < INT16_MIN) {
+			out[i] = v > 0 ? INT16_MAX + 1 - step : INT16_MIN;
+			g->clipped++;
+		} else {
+			out[i] = v;
+		}
+	}
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: geigergen [-r rate] [-d duration] [-c cps] "
+		"[-a amplitude] [-s spread]\n"
+		"                 [-R rise] [-D decay] [-i] [-T dead_time] "
+		"[-n noise] [-m hum] [-F freq]\n"
+		"                 [-S seed] [-C channels] [-f format] "
+		"[-Q bits] [-t truthfile]\n"
+		"                 outputfile\n");
+	fprintf(stderr, "\t -r: sample rate in Hz (44100)\n");
+	fprintf(stderr, "\t -d: duration in s (60)\n");
+	fprintf(stderr, "\t -c: mean count rate in pulses/s (20)\n");
+	fprintf(stderr, "\t -a: mean peak amplitude (8000)\n");
+	fprintf(stderr, "\t -s: standard deviation of the amplitude, relative "
+		"to the mean (0.2)\n");
+	fprintf(stderr, "\t -R, -D: rise and decay times of a pulse in s "
+		"(2e-05, 0.0002)\n");
+	fprintf(stderr, "\t -i: negative pulses\n");
+	fprintf(stderr, "\t -T: dead time of the tube in s (0)\n");
+	fprintf(stderr, "\t -n: RMS of the baseline noise (30)\n");
+	fprintf(stderr, "\t -m, -F: amplitude and frequency in Hz of the mains "
+		"hum (0, 50)\n");
+	fprintf(stderr, "\t -S: seed of the random numbers (1)\n");
+	fprintf(stderr, "\t -C: number of channels, channel k with the seed "
+		"+ k (1, at most %d)\n", GEN_MAX_CHANNELS);
+	fprintf(stderr, "\t -f: sample format of the file:");
+	for (size_t i = 0; i < NB_FORMATS; i++)
+		fprintf(stderr, " %s", formats[i].name);
+	fprintf(stderr, " (int16)\n");
+	fprintf(stderr, "\t -Q: resolution of the signal, in bits (16, at "
+		"least 2)\n");
+	fprintf(stderr, "\t -t: write the ground truth (of the first channel) "
+		"to truthfile\n");
+	fprintf(stderr, "\t outputfile: WAV file, - for stdout\n");
+}
+
+/* Parse a number >= min, or exit */
+static double
+number(const char *arg, double min)
+{
+	char *end;
+	errno = 0;
+	const double v = strtod(arg, &end);
+	if (errno || end == arg || *end != '\0' || !(v >= min)) {
+		fprintf(stderr, "incorrect value: %s\n", arg);
+		usage();
+		exit(EXIT_FAILURE);
+	}
+	return v;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct genparams p = {
+		.sample_rate = 44100,
+		.duration = 60,
+		.count_rate = 20,
+		.amplitude = 8000,
+		.spread = 0.2,
+		.rise = 20e-6,
+		.decay = 200e-6,
+		.noise = 30,
+		.hum_freq = 50,
+		.seed = 1,
+		.bits = 16,
+	};
+	size_t format = 1; /* in formats, int16 */
+	const char *truthname = NULL;
+	unsigned channels = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "r:d:c:a:s:R:D:iT:n:m:F:S:C:f:Q:t:"))
+	       != -1) {
+		switch (opt) {
+		case 'r':
+			p.sample_rate = number(optarg, 1);
+			break;
+		case 'd':
+			p.duration = number(optarg, 0);
+			break;
+		case 'c':
+			p.count_rate = number(optarg, 0);
+			break;
+		case 'a':
+			p.amplitude = number(optarg, 0);
+			break;
+		case 's':
+			p.spread = number(optarg, 0);
+			break;
+		case 'R':
+			p.rise = number(optarg, 1e-9);
+			break;
+		case 'D':
+			p.decay = number(optarg, 1e-9);
+			break;
+		case 'i':
+			p.negative = true;
+			break;
+		case 'T':
+			p.dead_time = number(optarg, 0);
+			break;
+		case 'n':
+			p.noise = number(optarg, 0);
+			break;
+		case 'm':
+			p.hum = number(optarg, 0);
+			break;
+		case 'F':
+			p.hum_freq = number(optarg, 0);
+			break;
+		case 'S':
+			p.seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'C':
+			channels = number(optarg, 1);
+			if (channels > GEN_MAX_CHANNELS) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'f':
+			for (format = 0; format < NB_FORMATS; format++)
+				if (!strcmp(optarg, formats[format].name))
+					break;
+			if (format == NB_FORMATS) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'Q':
+			p.bits = number(optarg, 2);
+			if (p.bits > 16) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 't':
+			truthname = optarg;
+			break;
+		default:
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (optind != argc - 1) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+	if (p.rise >= p.decay) {
+		fprintf(stderr, "the rise time must be shorter than the decay "
+			"time\n");
+		exit(EXIT_FAILURE);
+	}
+
+	FILE *truth = NULL;
+	if (truthname != NULL) {
+		truth = fopen(truthname, "w");
+		if (truth == NULL) {
+			fprintf(stderr, "Unable to open %s: %s\n", truthname,
+				strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		fprintf(truth, "# geigergen -r %u -d %g -c %g -a %g -s %g "
+			"-R %g -D %g%s -T %g -n %g -m %g -F %g -S %llu",
+			p.sample_rate, p.duration, p.count_rate, p.amplitude,
+			p.spread, p.rise, p.decay, p.negative ? " -i" : "",
+			p.dead_time, p.noise, p.hum, p.hum_freq,
+			(unsigned long long) p.seed);
+		if (channels > 1)
+			fprintf(truth, " -C %u", channels);
+		if (p.bits < 16)
+			fprintf(truth, " -Q %u", p.bits);
+		fprintf(truth, "\n");
+		fprintf(truth, "# time (s)\tamplitude\tpile-up\n");
+	}
+
+	SF_INFO sinfo;
+	memset(&sinfo, 0, sizeof sinfo);
+	sinfo.samplerate = p.sample_rate;
+	sinfo.channels = channels;
+	sinfo.format = SF_FORMAT_WAV | formats[format].format;
+	SNDFILE *stream = sf_open(argv[optind], SFM_WRITE, &sinfo);
+	if (stream == NULL) {
+		fprintf(stderr, "Unable to open audio stream (write): %s\n",
+			sf_strerror(NULL));
+		exit(EXIT_FAILURE);
+	}
+
+	static struct generator g[GEN_MAX_CHANNELS];
+	for (unsigned c = 0; c < channels; c++)
+		generator_init(&g[c], &p, p.seed + c, c ? NULL : truth);
+	const uint64_t total = (uint64_t) llround(p.duration * p.sample_rate);
+	static int16_t block[GEN_BLOCK];
+	static int16_t buffer[GEN_BLOCK * GEN_MAX_CHANNELS];
+	bool ok = true;
+	for (uint64_t spl = 0; ok && spl < total; spl += GEN_BLOCK) {
+		const size_t nb = total - spl < GEN_BLOCK ? total - spl
+			: GEN_BLOCK;
+		for (unsigned c = 0; c < channels; c++) {
+			generate(&g[c], spl, nb, block);
+			for (size_t i = 0; i < nb; i++)
+				buffer[i * channels + c] = block[i];
+		}
+		ok = sf_writef_short(stream, buffer, nb) == (sf_count_t) nb;
+	}
+	if (!ok)
+		fprintf(stderr, "Write error: %s\n", sf_strerror(stream));
+	int err = sf_close(stream);
+	if (err) {
+		fprintf(stderr, "Unable to close properly audio stream: %s\n",
+			sf_error_number(err));
+		ok = false;
+	}
+	if (truth != NULL && fclose(truth)) {
+		fprintf(stderr, "Unable to write %s: %s\n", truthname,
+			strerror(errno));
+		ok = false;
+	}
+
+	for (unsigned c = 0; c < channels; c++) {
+		if (channels > 1)
+			fprintf(stderr, "channel %u: ", c);
+		fprintf(stderr, "%llu samples, %llu pulses (%llu piled up), "
+			"%llu lost in the dead time, %llu samples clipped\n",
+			(unsigned long long) total,
+			(unsigned long long) g[c].kept,
+			(unsigned long long) g[c].piled,
+			(unsigned long long) g[c].lost,
+			(unsigned long long) g[c].clipped);
+		free(g[c].pulses);
+	}
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,264 @@
+/* Geiger counter listener prototype - 2012
+ * by "Cyrus Smith" for "Le Projet Olduva"
+ *
+ * See http://le-projet-olduvai.wikiforum.net/t6044-projet-de-logiciel-pour-compteur-geiger-muller
+ *
+ * This code is under GNU GPLv3.
+ *
+ * Instrumentation of a live capture, see livestats.h.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "livestats.h"
+
+/* Counters with a single writer: no read-modify-write needed */
+static void
+add(atomic_uint_fast64_t *c, uint64_t v)
+{
+	atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed)
+			      + v, memory_order_relaxed);
+}
+
+static void
+raise_max(atomic_uint_fast64_t *c, uint64_t v)
+{
+	if (v > atomic_load_explicit(c, memory_order_relaxed))
+		atomic_store_explicit(c, v, memory_order_relaxed);
+}
+
+static unsigned
+bin_of(uint64_t units)
+{
+	unsigned bin = 0;
+	while (units && bin < LIVESTATS_BINS - 1) {
+		units >>= 1;
+		bin++;
+	}
+	return bin;
+}
+
+void
+callbackstats_init(struct callbackstats *st)
+{
+	atomic_init(&st->callbacks, 0);
+	atomic_init(&st->frames, 0);
+	atomic_init(&st->cycles, 0);
+	atomic_init(&st->max_cycles, 0);
+	atomic_init(&st->ns, 0);
+	atomic_init(&st->max_ns, 0);
+	atomic_init(&st->overflows, 0);
+	for (unsigned i = 0; i < LIVESTATS_BINS; i++)
+		atomic_init(&st->load[i], 0);
+}
+
+void
+latencystats_init(struct latencystats *st)
+{
+	atomic_init(&st->events, 0);
+	atomic_init(&st->us, 0);
+	atomic_init(&st->max_us, 0);
+	for (unsigned i = 0; i < LIVESTATS_BINS; i++)
+		atomic_init(&st->bins[i], 0);
+}
+
+void
+livestats_now(struct livestats_clock *clk)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	clk->ns = ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+#if defined(__x86_64__) || defined(__i386__)
+	clk->cycles = __rdtsc();
+#else
+	clk->cycles = clk->ns;
+#endif
+}
+
+void
+callbackstats_add(struct callbackstats *st,
+		  const struct livestats_clock *start, uint64_t frames,
+		  double period, bool overflow)
+{
+	struct livestats_clock end;
+	livestats_now(&end);
+	const uint64_t cycles = end.cycles - start->cycles;
+	const uint64_t ns = end.ns - start->ns;
+
+	add(&st->frames, frames);
+	add(&st->cycles, cycles);
+	raise_max(&st->max_cycles, cycles);
+	add(&st->ns, ns);
+	raise_max(&st->max_ns, ns);
+	if (overflow)
+		add(&st->overflows, 1);
+	if (period > 0)
+		add(&st->load[bin_of((uint64_t) (ns * 1024 / (period * 1e9)))],
+		    1);
+	/* last: a reader seeing this callback sees its cost */
+	atomic_store_explicit(&st->callbacks,
+			      atomic_load_explicit(&st->callbacks,
+						   memory_order_relaxed) + 1,
+			      memory_order_release);
+}
+
+void
+latencystats_add(struct latencystats *st, double latency)
+{
+	const uint64_t us = latency > 0 ? (uint64_t) (latency * 1e6) : 0;
+	add(&st->us, us);
+	raise_max(&st->max_us, us);
+	add(&st->bins[bin_of(us / 1000)], 1);
+	atomic_store_explicit(&st->events,
+			      atomic_load_explicit(&st->events,
+						   memory_order_relaxed) + 1,
+			      memory_order_release);
+}
+
+
+/* Latency sink */
+
+struct eventsinkdata {
+	struct eventsink *next;
+	struct latencystats *st;
+	livestats_adctime adc_time;
+	void *ctx;
+};
+
+static void
+latencysink_write(const struct event *ev, size_t nb,
+		  struct eventsinkdata *data)
+{
+	struct livestats_clock now;
+	livestats_now(&now);
+	for (size_t i = 0; i < nb; i++) {
+		const uint64_t adc = data->adc_time(&ev[i], data->ctx);
+		latencystats_add(data->st, adc < now.ns
+				 ? (now.ns - adc) * 1e-9 : 0);
+	}
+	if (data->next != NULL)
+		data->next->write(ev, nb, data->next->data);
+}
+
+static void
+latencysink_flush(struct eventsinkdata *data)
+{
+	if (data->next != NULL)
+		data->next->flush(data->next->data);
+}
+
+static int
+terminate_latencysink(struct eventsink *sink)
+{
+	assert(sink != NULL);
+	assert(sink->data != NULL);
+	int ret = 0;
+	if (sink->data->next != NULL)
+		ret = sink->data->next->terminate(sink->data->next);
+	free(sink->data);
+	free(sink);
+	return ret;
+}
+
+struct eventsink*
+init_latencysink(struct eventsink *next, struct latencystats *st,
+		 livestats_adctime adc_time, void *ctx)
+{
+	assert(st != NULL);
+	assert(adc_time != NULL);
+	struct eventsink *sink = calloc(1, sizeof(struct eventsink));
+	if (sink == NULL)
+		return NULL;
+	sink->data = calloc(1, sizeof(struct eventsinkdata));
+	if (sink->data == NULL) {
+		free(sink);
+		return NULL;
+	}
+
+	sink->name = "latency";
+	sink->write = &latencysink_write;
+	sink->flush = &latencysink_flush;
+	sink->terminate = &terminate_latencysink;
+	sink->data->next = next;
+	sink->data->st = st;
+	sink->data->adc_time = adc_time;
+	sink->data->ctx = ctx;
+	return sink;
+}
+
+
+/* Output */
+
+static uint64_t
+get(const atomic_uint_fast64_t *c)
+{
+	return atomic_load_explicit((atomic_uint_fast64_t *) c,
+				    memory_order_acquire);
+}
+
+void
+callbackstats_print(FILE *out, const char *name,
+		    const struct callbackstats *st)
+{
+	const uint64_t n = get(&st->callbacks);
+	fprintf(out, "%s: %llu callbacks, %llu overflow(s)\n", name,
+		(unsigned long long) n,
+		(unsigned long long) get(&st->overflows));
+	if (n == 0)
+		return;
+	fprintf(out, "%s: %.0f frames per callback, %.1f us (%.0f cycles) "
+		"per callback, at most %.1f us (%llu cycles)\n", name,
+		(double) get(&st->frames) / n, get(&st->ns) * 1e-3 / n,
+		(double) get(&st->cycles) / n, get(&st->max_ns) * 1e-3,
+		(unsigned long long) get(&st->max_cycles));
+	fprintf(out, "%s: time over buffer period:", name);
+	for (unsigned i = 0; i < LIVESTATS_BINS; i++) {
+		const uint64_t b = get(&st->load[i]);
+		if (b == 0)
+			continue;
+		if (i == LIVESTATS_BINS - 1)
+			fprintf(out, " late %llu", (unsigned long long) b);
+		else
+			fprintf(out, " <%g%% %llu",
+				100.0 * (UINT64_C(1) << i) / 1024,
+				(unsigned long long) b);
+	}
+	fprintf(out, "\n");
+}
+
+void
+latencystats_print(FILE *out, const char *name,
+		   const struct latencystats *st)
+{
+	const uint64_t n = get(&st->events);
+	fprintf(out, "%s: %llu events", name, (unsigned long long) n);
+	if (n == 0) {
+		fprintf(out, "\n");
+		return;
+	}
+	fprintf(out, ", ADC to output in %.1f ms, at most %.1f ms\n",
+		get(&st->us) * 1e-3 / n, get(&st->max_us) * 1e-3);
+	fprintf(out, "%s: latency:", name);
+	for (unsigned i = 0; i < LIVESTATS_BINS; i++) {
+		const uint64_t b = get(&st->bins[i]);
+		if (b == 0)
+			continue;
+		if (i == LIVESTATS_BINS - 1)
+			fprintf(out, " >=%llu ms %llu",
+				(unsigned long long) (UINT64_C(1) << (i - 1)),
+				(unsigned long long) b);
+		else
+			fprintf(out, " <%llu ms %llu",
+				(unsigned long long) (UINT64_C(1) << i),
+				(unsigned long long) b);
+	}
+	fprintf(out, "\n");
+}
@@ -0,0 +1,96 @@
+#ifndef _LIVESTATS_H_
+#define _LIVESTATS_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "eventsink.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Instrumentation of a live capture: the cost of the audio callbacks, and
+ * the latency of the events from the ADC to their output.
+ *
+ * Each set of statistics has a single writer (the audio thread of a device,
+ * or the thread writing out the events), which only does relaxed loads and
+ * stores of its counters: no locked instruction and no system call on the
+ * audio thread. Any other thread can read the counters at any time; each
+ * one is consistent, but a reader may see a callback counted and not yet
+ * its duration.
+ *
+ * The histograms have LIVESTATS_BINS power-of-two bins: bin 0 below a unit,
+ * bin k in [2^(k-1), 2^k) units, and the last bin for the rest.
+ *
+ * This uses the C11 atomics: it is built with geiger, not with the C99
+ * tools of this directory.
+ */
+
+#define LIVESTATS_BINS (12)
+
+/* Time stamp of the start of a callback */
+struct livestats_clock {
+	uint64_t cycles;        /* time-stamp counter, or ns without one */
+	uint64_t ns;            /* CLOCK_MONOTONIC */
+};
+
+struct callbackstats {
+	atomic_uint_fast64_t callbacks;
+	atomic_uint_fast64_t frames;
+	atomic_uint_fast64_t cycles;     /* spent in the callbacks */
+	atomic_uint_fast64_t max_cycles;
+	atomic_uint_fast64_t ns;
+	atomic_uint_fast64_t max_ns;
+	atomic_uint_fast64_t overflows;  /* reported by the host */
+	/* duration of a callback over its buffer period, in units of 1/1024
+	   of the period: the last bin counts the callbacks which took longer
+	   than their buffer, and so missed their deadline */
+	atomic_uint_fast64_t load[LIVESTATS_BINS];
+};
+
+struct latencystats {
+	atomic_uint_fast64_t events;
+	atomic_uint_fast64_t us;         /* sum of the latencies */
+	atomic_uint_fast64_t max_us;
+	atomic_uint_fast64_t bins[LIVESTATS_BINS]; /* in milliseconds */
+};
+
+void callbackstats_init(struct callbackstats *st);
+void latencystats_init(struct latencystats *st);
+
+/* Time stamp now */
+void livestats_now(struct livestats_clock *clk);
+
+/* A callback started at start processed frames frames, of period seconds,
+   with an input overflow or not. */
+void callbackstats_add(struct callbackstats *st,
+		       const struct livestats_clock *start, uint64_t frames,
+		       double period, bool overflow);
+
+/* An event written out latency seconds after its sample was captured */
+void latencystats_add(struct latencystats *st, double latency);
+
+/* Time (CLOCK_MONOTONIC, in ns) at which the sample of an event was
+   captured by the ADC */
+typedef uint64_t (*livestats_adctime)(const struct event *ev, void *ctx);
+
+/* Adds the latency of the events to st, then passes them to next (which
+   may be NULL). Terminating the sink also terminates next. */
+struct eventsink* init_latencysink(struct eventsink *next,
+				   struct latencystats *st,
+				   livestats_adctime adc_time, void *ctx);
+
+/* Print the statistics, each line starting with name. */
+void callbackstats_print(FILE *out, const char *name,
+			 const struct callbackstats *st);
+void latencystats_print(FILE *out, const char *name,
+			const struct latencystats *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_LIVESTATS_H_ */
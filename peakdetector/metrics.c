@@ -0,0 +1,309 @@
+/* Geiger counter listener prototype - 2012
+ * by "Cyrus Smith" for "Le Projet Olduva"
+ *
+ * See http://le-projet-olduvai.wikiforum.net/t6044-projet-de-logiciel-pour-compteur-geiger-muller
+ *
+ * This code is under GNU GPLv3.
+ *
+ * Metrics server, see metrics.h.
+ *
+ * The server answers one connection at a time, with HTTP/1.0: it reads the
+ * request line, writes the whole response and closes the connection. A slow
+ * client only delays the other scrapes, never the capture.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "metrics.h"
+
+#define METRICS_POLL (500)       /* ms between two checks of the stop flag */
+#define METRICS_TIMEOUT (2)      /* seconds to receive a request */
+#define METRICS_REQUEST (4096)   /* longest request read */
+
+struct metricsserver {
+	int fd;
+	char *path;              /* of the Unix socket, NULL for TCP */
+	metrics_writer write;
+	void *ctx;
+	pthread_t thread;
+	atomic_bool stop;
+};
+
+static int
+listen_unix(const char *path)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof addr.sun_path) {
+		fprintf(stderr, "Socket path too long: %s\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	/* a socket left by a previous run, but nothing else */
+	struct stat st;
+	if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || bind(fd, (struct sockaddr*) &addr, sizeof addr) < 0
+	    || listen(fd, 4) < 0) {
+		fprintf(stderr, "Unable to listen on %s: %s\n", path,
+			strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int
+listen_tcp(const char *address)
+{
+	char host[256];
+	const char *port = strrchr(address, ':');
+	if (port == NULL) {
+		strcpy(host, "127.0.0.1");
+		port = address;
+	} else {
+		size_t len = port - address;
+		port++;
+		/* [::1]:9100 */
+		if (len >= 2 && address[0] == '[' && address[len - 1] == ']') {
+			address++;
+			len -= 2;
+		}
+		if (len >= sizeof host) {
+			fprintf(stderr, "Incorrect address: %s\n", address);
+			return -1;
+		}
+		memcpy(host, address, len);
+		host[len] = 0;
+	}
+
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	int err = getaddrinfo(host[0] ? host : NULL, port, &hints, &res);
+	if (err != 0) {
+		fprintf(stderr, "Incorrect address %s: %s\n", address,
+			gai_strerror(err));
+		return -1;
+	}
+	int fd = -1;
+	for (struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		const int on = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+		if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0
+		    && listen(fd, 4) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	if (fd < 0)
+		fprintf(stderr, "Unable to listen on %s: %s\n", address,
+			strerror(errno));
+	freeaddrinfo(res);
+	return fd;
+}
+
+static void
+send_all(int fd, const char *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+		if (n <= 0 && errno != EINTR)
+			return;
+		if (n > 0) {
+			buf += n;
+			len -= n;
+		}
+	}
+}
+
+/* Read the request, up to the end of its headers, and answer it. */
+static void
+serve(struct metricsserver *srv, int fd)
+{
+	const struct timeval timeout = { METRICS_TIMEOUT, 0 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+
+	char req[METRICS_REQUEST + 1];
+	size_t len = 0;
+	while (len < METRICS_REQUEST) {
+		ssize_t n = recv(fd, req + len, METRICS_REQUEST - len, 0);
+		if (n <= 0)
+			break;
+		len += n;
+		req[len] = 0;
+		if (strstr(req, "\r\n\r\n") != NULL
+		    || strstr(req, "\n\n") != NULL)
+			break;
+	}
+	req[len] = 0;
+
+	const char *status = "200 OK";
+	char *body = NULL;
+	size_t size = 0;
+	if (strncmp(req, "GET ", 4) && strncmp(req, "HEAD ", 5)) {
+		status = "405 Method Not Allowed";
+	} else if (strncmp(strchr(req, ' ') + 1, "/metrics ", 9)
+		   && strncmp(strchr(req, ' ') + 1, "/ ", 2)) {
+		status = "404 Not Found";
+	} else {
+		FILE *out = open_memstream(&body, &size);
+		if (out == NULL) {
+			status = "500 Internal Server Error";
+		} else {
+			srv->write(out, srv->ctx);
+			fclose(out);
+		}
+	}
+
+	char head[256];
+	int n = snprintf(head, sizeof head, "HTTP/1.0 %s\r\n"
+			 "Content-Type: text/plain; version=0.0.4\r\n"
+			 "Content-Length: %zu\r\n"
+			 "Connection: close\r\n\r\n", status, size);
+	send_all(fd, head, n);
+	if (strncmp(req, "HEAD ", 5))
+		send_all(fd, body, size);
+	free(body);
+}
+
+static void*
+metrics_thread(void *arg)
+{
+	struct metricsserver *srv = arg;
+	struct pollfd pfd = { srv->fd, POLLIN, 0 };
+	while (!atomic_load(&srv->stop)) {
+		if (poll(&pfd, 1, METRICS_POLL) <= 0)
+			continue;
+		int fd = accept(srv->fd, NULL, NULL);
+		if (fd < 0)
+			continue;
+		serve(srv, fd);
+		close(fd);
+	}
+	return NULL;
+}
+
+struct metricsserver*
+metrics_start(const char *address, metrics_writer write, void *ctx)
+{
+	assert(address != NULL);
+	assert(write != NULL);
+	struct metricsserver *srv = calloc(1, sizeof *srv);
+	if (srv == NULL)
+		return NULL;
+	if (strchr(address, '/') != NULL) {
+		srv->path = strdup(address);
+		srv->fd = srv->path ? listen_unix(address) : -1;
+	} else {
+		srv->fd = listen_tcp(address);
+	}
+	if (srv->fd < 0) {
+		free(srv->path);
+		free(srv);
+		return NULL;
+	}
+	srv->write = write;
+	srv->ctx = ctx;
+	atomic_init(&srv->stop, false);
+
+	/* the signals are for the main thread */
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	int err = pthread_create(&srv->thread, NULL, &metrics_thread, srv);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (err != 0) {
+		fprintf(stderr, "Unable to start the metrics server: %s\n",
+			strerror(err));
+		close(srv->fd);
+		if (srv->path != NULL)
+			unlink(srv->path);
+		free(srv->path);
+		free(srv);
+		return NULL;
+	}
+	return srv;
+}
+
+void
+metrics_stop(struct metricsserver *srv)
+{
+	if (srv == NULL)
+		return;
+	atomic_store(&srv->stop, true);
+	pthread_join(srv->thread, NULL);
+	close(srv->fd);
+	if (srv->path != NULL)
+		unlink(srv->path);
+	free(srv->path);
+	free(srv);
+}
+
+
+/* Text format */
+
+void
+metrics_family(FILE *out, const char *name, const char *type,
+	       const char *help)
+{
+	fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void
+metrics_value(FILE *out, const char *name, const char *labels, double value)
+{
+	if (labels[0])
+		fprintf(out, "%s{%s} %.17g\n", name, labels, value);
+	else
+		fprintf(out, "%s %.17g\n", name, value);
+}
+
+void
+metrics_histogram(FILE *out, const char *name, const char *labels,
+		  const atomic_uint_fast64_t *bins, unsigned nb, double unit,
+		  double sum)
+{
+	const char *sep = labels[0] ? "," : "";
+	uint64_t count = 0;
+	for (unsigned k = 0; k < nb; k++) {
+		count += atomic_load_explicit(&bins[k], memory_order_relaxed);
+		if (k + 1 < nb)
+			fprintf(out, "%s_bucket{%s%sle=\"%g\"} %llu\n", name,
+				labels, sep, unit * (UINT64_C(1) << k),
+				(unsigned long long) count);
+	}
+	fprintf(out, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep,
+		(unsigned long long) count);
+	char sample[128];
+	snprintf(sample, sizeof sample, "%s_sum", name);
+	metrics_value(out, sample, labels, sum);
+	snprintf(sample, sizeof sample, "%s_count", name);
+	metrics_value(out, sample, labels, count);
+}
@@ -0,0 +1,57 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Metrics of a live capture in the Prometheus text format, served over HTTP
+ * on a TCP port or a Unix socket.
+ *
+ * The server has its own thread, which answers each request with the text
+ * written by a callback. The callback runs on that thread: it must only
+ * read counters published for it (atomics, or snapshots), never take a lock
+ * shared with the audio callbacks.
+ *
+ * Like livestats, this uses the C11 atomics and is built with geiger only.
+ */
+
+struct metricsserver;
+
+/* Write the metrics to out */
+typedef void (*metrics_writer)(FILE *out, void *ctx);
+
+/* Serve the metrics written by write on address: a path (with a '/') for a
+   Unix socket, else "port" for the loopback interface or "host:port".
+   Returns NULL, with a message on stderr, if the socket cannot be set up. */
+struct metricsserver* metrics_start(const char *address,
+				    metrics_writer write, void *ctx);
+
+/* Stop the server and close its socket. */
+void metrics_stop(struct metricsserver *srv);
+
+/* The "# HELP" and "# TYPE" lines of a family of metrics, before its
+   samples. */
+void metrics_family(FILE *out, const char *name, const char *type,
+		    const char *help);
+
+/* A sample name{labels} value; labels is like "device=\"1\"", or "". */
+void metrics_value(FILE *out, const char *name, const char *labels,
+		   double value);
+
+/* The samples of a histogram of power-of-two bins (see livestats.h): bin k
+   is below unit * 2^k, the last one is unbounded. sum is the sum of the
+   observations. */
+void metrics_histogram(FILE *out, const char *name, const char *labels,
+		       const atomic_uint_fast64_t *bins, unsigned nb,
+		       double unit, double sum);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_METRICS_H_ */
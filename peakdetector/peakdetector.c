@@ -15,42 +15,112 @@
  *    $ peakdetector file.wav
  * which is similar to:
  *    $ cat file.wav | peakdetector
+ * With "-o events.gevl", the events are written to a compact binary event
+ * log (see eventlog.h) instead of the standard output; eventlogcat converts
+ * it back to text.
+ *
+ * Many recordings can be analysed at once, on all the cores, with the batch
+ * mode:
+ *    $ peakdetector -d results C1 recordings/ other.wav
+ * Each file (or WAV file of a directory) gets its own event file in the
+ * output directory, results/<name>.txt (or .gevl with -g). A summary of
+ * each file and an aggregate report are written to the standard output; a
+ * file which cannot be analysed is reported, and the others still are.
+ *
+ * A single long file can also be cut in segments analysed in parallel (see
+ * segments.h), with the same output as a sequential analysis:
+ *    $ peakdetector -j 8 C1 file.wav
+ *
+ * The max-abs filter of streamfilter can be run as a stage before the
+ * detector, on the same buffers: "-f Tg", which may be repeated, replaces
+ *    $ streamfilter Tg | peakdetector PPP
+ * with
+ *    $ peakdetector -f Tg PPP
+ *
+ * The Geiger dead time is not applied by default: with "-t T", an event
+ * less than T seconds after the previous one is dropped (non-paralyzable
+ * model); with "-p", the tube is paralyzable and any event, even dropped,
+ * extends its dead time. The rate corrected for the dead time is reported.
+ *
+ * A multi-channel recording (several tubes on one sound card) is analysed
+ * with one detector per channel; the events of all the channels are merged
+ * in order, with a third column giving the channel. Such a recording is not
+ * cut in segments.
+ *
+ * The WAV files may have 8, 16, 24 or 32-bit integer samples, or float ones.
+ * The detectors work on the samples as they are stored (the 8-bit ones
+ * aside, read as 16-bit), with the threshold and the amplitudes of the
+ * events always on the scale of 16-bit samples. The filters of "-f" work on
+ * 16-bit samples, to which the others are converted.
  *
  * [1]: SoX: http://sox.sourceforge.net/
  *
  * The actual detection algorithm is implemented in another file and must
  * respect the interface provided by detector.h. It can then be changed
- * easily at compile time.
+ * easily at compile time. The detected peaks are passed by batches to an
+ * event sink (eventsink.h), which writes them out.
  *
  * WARNING: this program should not be used to detect peak oil and other
  *   ressource peaks.
  *
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <assert.h>
+#include <dirent.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
 
 #include <sndfile.h>
 
 #include "peakdetector.h"
+#include "channels.h"
+#include "decimate.h"
 #include "detector_c1.h"
+#include "detector_peak.h"
 #include "detector_ppp.h"
+#include "eventlog.h"
+#include "segments.h"
 
 enum detectors {
 	C1,
 	PPP,
+	PEAK,
+};
+
+static const char *detecnames[] = { "C1", "PPP", "PEAK" };
+
+static const char *deadtimenames[] = {
+	"none", "non-paralyzable", "paralyzable"
 };
 
 struct detector* (*detecinit[])(uint32_t sample_rate,
 				const struct parameters *params,
-				void (*callback)(double, int16_t)) = { &init_detector_c1, &init_detector_ppp };
+				struct eventsink *sink) = { &init_detector_c1, &init_detector_ppp, &init_detector_peak };
 
-static void
+/* Frames read at once: small for a single, possibly live, stream; larger
+   when analysing files in batch. */
+#define STREAM_BLOCK (128)
+#define BATCH_BLOCK (16384)
+
+/* Filter stages before the detector */
+#define MAX_FILTERS (4)
+
+/* Geiger dead time with -p alone, in seconds */
+#define DEFAULT_DEAD_TIME (0.001)
+
+static bool
 closeaudiostream(SNDFILE* stream)
 {
 	assert(stream != NULL);
@@ -58,114 +128,835 @@ closeaudiostream(SNDFILE* stream)
 	if (err) {
 		fprintf(stderr, "Unable to close properly audio stream: %s\n",
 			sf_error_number(err));
-		exit(EXIT_FAILURE);
+		return false;
 	}
+	return true;
 }
 
+/* Returns NULL, after an error message, if the stream cannot be analysed. */
 static SNDFILE*
 openaudiostream(const char* filename, SF_INFO *sinfo)
 {
 	assert(filename != NULL);
 	assert(sinfo != NULL);
-	memset(sinfo, 0, sizeof sinfo);
+	memset(sinfo, 0, sizeof *sinfo);
 	SNDFILE* stream = sf_open(filename, SFM_READ, sinfo);
 	if (stream == NULL) {
-		fprintf(stderr, "Unable to open audio stream: %s\n",
-			sf_strerror(NULL));
-		exit(EXIT_FAILURE);
+		fprintf(stderr, "%s: unable to open audio stream: %s\n",
+			filename, sf_strerror(NULL));
+		return NULL;
 	}
 
-	if (sinfo->channels != 1) {
-		fprintf(stderr, "Don't know how to process stream with %d "
-			"channels\n", sinfo->channels);
+	if (sinfo->channels < 1 || sinfo->channels > MAX_CHANNELS) {
+		fprintf(stderr, "%s: don't know how to process stream with %d "
+			"channels (at most %d)\n", filename, sinfo->channels,
+			MAX_CHANNELS);
 		closeaudiostream(stream);
-		exit(EXIT_FAILURE);
+		return NULL;
+	}
+
+	const int type = sinfo->format & SF_FORMAT_TYPEMASK;
+	switch (sinfo->format & SF_FORMAT_SUBMASK) {
+	case SF_FORMAT_PCM_U8:
+	case SF_FORMAT_PCM_16:
+	case SF_FORMAT_PCM_24:
+	case SF_FORMAT_PCM_32:
+	case SF_FORMAT_FLOAT:
+	case SF_FORMAT_DOUBLE:
+		if (type == SF_FORMAT_WAV || type == SF_FORMAT_WAVEX)
+			return stream;
+	}
+	fprintf(stderr, "%s: input is not a PCM or float WAV file\n",
+		filename);
+	closeaudiostream(stream);
+	return NULL;
+}
 
+/* The format in which the samples of a stream are read: the integer
+   samples as they are stored, the 24-bit ones raw, and the floats as float.
+   The filters want 16-bit samples. */
+static enum sample_format
+stream_format(const SF_INFO *sinfo, bool filters)
+{
+	if (filters)
+		return SAMPLE_INT16;
+	switch (sinfo->format & SF_FORMAT_SUBMASK) {
+	case SF_FORMAT_PCM_24:
+		return SAMPLE_INT24;
+	case SF_FORMAT_PCM_32:
+		return SAMPLE_INT32;
+	case SF_FORMAT_FLOAT:
+	case SF_FORMAT_DOUBLE:
+		return SAMPLE_FLOAT;
+	default:
+		return SAMPLE_INT16;
 	}
+}
 
-	if (sinfo->format != (SF_FORMAT_WAV | SF_FORMAT_PCM_16)) {
-		fprintf(stderr, "Input is not a 16-bit PCM WAV file\n");
-		closeaudiostream(stream);
-		exit(EXIT_FAILURE);
+static const char *formatnames[] = {
+	"16-bit", "8-bit", "24-bit", "32-bit", "float"
+};
+
+/* Read at most frames frames of channels samples of the format. Returns
+   the number of frames read. */
+static sf_count_t
+readframes(SNDFILE *stream, enum sample_format format, void *buffer,
+	   sf_count_t frames, unsigned channels)
+{
+	switch (format) {
+	case SAMPLE_INT24: {
+		const sf_count_t width = 3 * channels;
+		return sf_read_raw(stream, buffer, frames * width) / width;
 	}
+	case SAMPLE_INT32:
+		return sf_readf_int(stream, buffer, frames);
+	case SAMPLE_FLOAT:
+		return sf_readf_float(stream, buffer, frames);
+	default:
+		return sf_readf_short(stream, buffer, frames);
+	}
+}
 
-	return stream;
+
+/* A seekable file, read by segments by several threads (see segments.h). */
+
+struct segmentsourcedata {
+	const char *filename;
+	enum sample_format format;
+};
+
+struct segmentreader {
+	SNDFILE *stream;
+	enum sample_format format;
+	uint64_t pos;
+	int32_t buffer[BATCH_BLOCK]; /* room for the samples of any format */
+};
+
+static struct segmentreader*
+sfsource_open(struct segmentsourcedata *data)
+{
+	struct segmentreader *r = calloc(1, sizeof(struct segmentreader));
+	if (r == NULL)
+		return NULL;
+	SF_INFO sinfo;
+	memset(&sinfo, 0, sizeof sinfo);
+	r->stream = sf_open(data->filename, SFM_READ, &sinfo);
+	if (r->stream == NULL) {
+		fprintf(stderr, "%s: unable to open audio stream: %s\n",
+			data->filename, sf_strerror(NULL));
+		free(r);
+		return NULL;
+	}
+	r->format = data->format;
+	return r;
 }
 
-void
-displaycallback(double time, int16_t amplitude)
+static size_t
+sfsource_read(struct segmentreader *r, uint64_t spl, size_t nb,
+	      const void **samples)
 {
-	printf("%.4f\t%6d\n", time, amplitude);
+	if (r->pos != spl) {
+		if (sf_seek(r->stream, spl, SEEK_SET) < 0)
+			return 0;
+		r->pos = spl;
+	}
+	if (nb > BATCH_BLOCK)
+		nb = BATCH_BLOCK;
+	sf_count_t nbfr = readframes(r->stream, r->format, r->buffer, nb, 1);
+	if (nbfr <= 0)
+		return 0;
+	r->pos += nbfr;
+	*samples = r->buffer;
+	return nbfr;
 }
 
+static void
+sfsource_close(struct segmentreader *r)
+{
+	sf_close(r->stream);
+	free(r);
+}
+
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* The events of all the channels before this sample are in the merge: the
+   detectors may still report a pulse they are in. */
+static uint64_t
+pending(struct detector *const *d, unsigned nch)
+{
+	uint64_t spl = UINT64_MAX;
+	for (unsigned c = 0; c < nch; c++) {
+		const uint64_t p = d[c]->pending(d[c]->data);
+		if (p < spl)
+			spl = p;
+	}
+	return spl;
+}
+
+struct analysis {
+	enum detectors detector;
+	struct parameters params;
+	bool eventlog;        /* binary event log instead of text */
+	size_t block_size;    /* frames read at once */
+	unsigned jobs;        /* threads analysing segments of the file */
+	unsigned nb_filters;
+	double filters[MAX_FILTERS]; /* Geiger dead time of each filter */
+	bool verbose;
+};
+
+struct filestats {
+	bool ok;
+	uint32_t sample_rate;
+	uint64_t samples;
+	uint64_t events;
+	double seconds;       /* processing time */
+};
+
+/* Run the detector on a whole audio file ("-" for stdin) and write the
+   events to outname (NULL or "-" for stdout). Errors are reported on
+   stderr, and in stats->ok. */
+static void
+analyse(const char *filename, const char *outname, const struct analysis *an,
+	struct filestats *stats)
+{
+	memset(stats, 0, sizeof *stats);
+	const double t0 = now();
+
+	SF_INFO sinfo;
+	SNDFILE* stream = openaudiostream(filename, &sinfo);
+	if (stream == NULL)
+		return;
+	stats->sample_rate = sinfo.samplerate;
+
+	const unsigned nch = sinfo.channels;
+	struct parameters params = an->params;
+	params.sample_format = stream_format(&sinfo, an->nb_filters > 0);
+	const size_t width = sample_size(params.sample_format);
+
+	/* The detectors see the sample rate of the last filter. Each channel
+	   has its own filters. */
+	struct decimator dec[MAX_CHANNELS][MAX_FILTERS];
+	uint32_t rate = sinfo.samplerate;
+	for (unsigned i = 0; i < an->nb_filters; i++) {
+		if (decimator_init(&dec[0][i], rate, an->filters[i])) {
+			fprintf(stderr, "%s: Geiger dead time of %g s shorter "
+				"than two samples\n", filename, an->filters[i]);
+			closeaudiostream(stream);
+			return;
+		}
+		for (unsigned c = 1; c < nch; c++)
+			dec[c][i] = dec[0][i];
+		rate = decimator_rate(&dec[0][i], rate);
+	}
+
+	FILE *out = stdout;
+	if (outname != NULL && strcmp(outname, "-")) {
+		out = fopen(outname, an->eventlog ? "wb" : "w");
+		if (out == NULL) {
+			fprintf(stderr, "Unable to open %s: %s\n", outname,
+				strerror(errno));
+			closeaudiostream(stream);
+			return;
+		}
+	}
+
+	struct eventsink *sink;
+	if (an->eventlog) {
+		struct eventlog_header hdr = {
+			.sample_rate = rate,
+			/* a stream read from stdin is assumed to be live */
+			.start_time = strcmp(filename, "-") ? 0 : time(NULL),
+			.threshold = an->params.noise_threshold,
+			.dead_time = an->params.dead_time_model == DEADTIME_NONE
+				? 0 : an->params.geiger_dead_time,
+			.channels = nch,
+		};
+		strncpy(hdr.detector, detecnames[an->detector],
+			sizeof hdr.detector - 1);
+		sink = init_eventlogsink(out, &hdr);
+	} else if (nch > 1) {
+		sink = init_channeltextsink(out, rate);
+	} else {
+		sink = init_textsink(out, rate);
+	}
+	struct eventsink *counter = NULL;
+	if (sink != NULL) {
+		counter = init_countsink(sink, &stats->events);
+		if (counter == NULL)
+			sink->terminate(sink);
+	}
+	struct channelmerge *merge = NULL;
+	if (counter != NULL && nch > 1) {
+		merge = channelmerge_new(counter, nch);
+		if (merge == NULL) {
+			counter->terminate(counter);
+			counter = NULL;
+		}
+	}
+	/* The frames read, then the samples of each channel one after the
+	   other (the same buffer for a single channel) */
+	unsigned char *buffer = malloc(an->block_size * nch * width);
+	unsigned char *planes = nch > 1
+		? malloc(an->block_size * nch * width) : buffer;
+	void *chbuf[MAX_CHANNELS];
+	struct detector *d[MAX_CHANNELS] = { NULL };
+	bool ok = false;
+	if (counter != NULL && buffer != NULL && planes != NULL) {
+		ok = true;
+		for (unsigned c = 0; c < nch && ok; c++) {
+			chbuf[c] = planes + c * an->block_size * width;
+			d[c] = detecinit[an->detector](rate, &params,
+				merge != NULL ? channelmerge_sink(merge, c)
+					      : counter);
+			ok = d[c] != NULL;
+		}
+		if (!ok)
+			fprintf(stderr, "Detector initialization failed\n");
+	} else {
+		fprintf(stderr, "Output initialization failed\n");
+	}
+
+	if (ok) {
+		if (an->verbose) {
+			fprintf(stderr, "Using detection algorithm %s\n",
+				d[0]->name);
+			fprintf(stderr, "Sample rate: %d\n", sinfo.samplerate);
+			if (nch > 1)
+				fprintf(stderr, "Channels: %u\n", nch);
+			if (params.sample_format != SAMPLE_INT16)
+				fprintf(stderr, "Sample format: %s\n",
+					formatnames[params.sample_format]);
+			for (unsigned i = 0; i < an->nb_filters; i++)
+				fprintf(stderr, "Filter: Geiger dead time %g s, "
+					"%u samples per interval\n",
+					an->filters[i],
+					dec[0][i].nb_points_inter);
+			if (an->nb_filters)
+				fprintf(stderr, "Detector sample rate: %u\n",
+					rate);
+			if (an->params.dead_time_model != DEADTIME_NONE)
+				fprintf(stderr, "Geiger dead time: %g s, %s\n",
+					an->params.geiger_dead_time,
+					deadtimenames[an->params.
+						      dead_time_model]);
+		}
+
+		/* The filters and the channels are not cut in segments */
+		if (an->jobs > 1 && an->nb_filters == 0 && nch == 1
+		    && sinfo.seekable && strcmp(filename, "-")) {
+			struct segmentsourcedata data = {
+				filename, params.sample_format
+			};
+			const struct segmentsource src = {
+				.nb_samples = sinfo.frames,
+				.open = &sfsource_open,
+				.read = &sfsource_read,
+				.close = &sfsource_close,
+				.data = &data,
+			};
+			struct segmentstats sst;
+			if (analyse_segments(&src, detecinit[an->detector],
+					     sinfo.samplerate, &params,
+					     counter, an->jobs, &sst)) {
+				fprintf(stderr, "%s: read error\n", filename);
+				ok = false;
+			} else {
+				stats->samples = sinfo.frames;
+			}
+			if (an->verbose)
+				fprintf(stderr, "%zu segments on %u threads, "
+					"%zu analysed again\n", sst.segments,
+					an->jobs, sst.reruns);
+		} else {
+			while(1) {
+				int nbfr = readframes(stream,
+						      params.sample_format,
+						      buffer, an->block_size,
+						      nch);
+				if (nbfr <= 0)
+					break;
+				if (nch > 1)
+					deinterleave_samples(buffer, nbfr, nch,
+							     width, chbuf);
+				size_t nb = nbfr;
+				for (unsigned c = 0; c < nch; c++) {
+					nb = nbfr;
+					for (unsigned i = 0; i < an->nb_filters;
+					     i++)
+						nb = decimate(&dec[c][i],
+							      chbuf[c], nb,
+							      chbuf[c]);
+					d[c]->detector(chbuf[c], nb,
+						       d[c]->data);
+				}
+				if (merge != NULL)
+					channelmerge_flush(merge,
+							   pending(d, nch));
+				stats->samples += nbfr;
+			}
+			if (sf_error(stream) != SF_ERR_NO_ERROR) {
+				fprintf(stderr, "%s: read error: %s\n",
+					filename, sf_strerror(stream));
+				ok = false;
+			}
+		}
+	}
+
+	for (unsigned c = 0; c < nch; c++)
+		if (d[c] != NULL)
+			d[c]->terminate(d[c]);
+	if (merge != NULL) {
+		channelmerge_flush(merge, UINT64_MAX);
+		channelmerge_free(merge);
+	}
+	if (planes != buffer)
+		free(planes);
+	free(buffer);
+	if (counter != NULL)
+		counter->terminate(counter);
+	if (out != stdout && fclose(out)) {
+		fprintf(stderr, "Unable to write %s: %s\n", outname,
+			strerror(errno));
+		ok = false;
+	}
+	ok = closeaudiostream(stream) && ok;
+
+	stats->seconds = now() - t0;
+	stats->ok = ok;
+	if (ok && an->verbose && an->params.dead_time_model != DEADTIME_NONE) {
+		const double dur = (double) stats->samples / sinfo.samplerate;
+		const double cps = dur > 0 ? stats->events / dur : 0;
+		fprintf(stderr, "%llu events in %.3f s: %.3f cps, %.3f cps "
+			"corrected for the dead time\n",
+			(unsigned long long) stats->events, dur, cps,
+			deadtime_true_rate(cps, an->params.geiger_dead_time,
+					   an->params.dead_time_model));
+	}
+}
+
+
+/* Batch mode */
+
+struct filelist {
+	char **names;
+	size_t nb;
+	size_t size;
+};
+
+static void
+filelist_add(struct filelist *list, const char *name)
+{
+	if (list->nb == list->size) {
+		list->size = list->size ? 2 * list->size : 64;
+		list->names = realloc(list->names,
+				      list->size * sizeof(char*));
+		assert(list->names != NULL);
+	}
+	list->names[list->nb] = strdup(name);
+	assert(list->names[list->nb] != NULL);
+	list->nb++;
+}
+
+static int
+compare_names(const void *a, const void *b)
+{
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+static bool
+has_wav_suffix(const char *name)
+{
+	size_t len = strlen(name);
+	return len > 4 && !strcasecmp(name + len - 4, ".wav");
+}
+
+/* Add a file, or the WAV files of a directory (sorted by name). Names that
+   cannot be opened are still added, to be reported as failed. */
+static void
+add_input(struct filelist *list, const char *path)
+{
+	struct stat st;
+	if (stat(path, &st) || !S_ISDIR(st.st_mode)) {
+		filelist_add(list, path);
+		return;
+	}
+
+	DIR *dir = opendir(path);
+	if (dir == NULL) {
+		filelist_add(list, path);
+		return;
+	}
+	const size_t first = list->nb;
+	struct dirent *ent;
+	while ((ent = readdir(dir)) != NULL) {
+		if (!has_wav_suffix(ent->d_name))
+			continue;
+		char *name = malloc(strlen(path) + strlen(ent->d_name) + 2);
+		assert(name != NULL);
+		sprintf(name, "%s/%s", path, ent->d_name);
+		filelist_add(list, name);
+		free(name);
+	}
+	closedir(dir);
+	qsort(list->names + first, list->nb - first, sizeof(char*),
+	      &compare_names);
+}
+
+/* Add the files and directories listed in listname, one per line. */
+static bool
+add_listed_inputs(struct filelist *list, const char *listname)
+{
+	FILE *in = strcmp(listname, "-") ? fopen(listname, "r") : stdin;
+	if (in == NULL) {
+		fprintf(stderr, "Unable to open %s: %s\n", listname,
+			strerror(errno));
+		return false;
+	}
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	while ((len = getline(&line, &size, in)) != -1) {
+		while (len > 0 && (line[len - 1] == '\n'
+				   || line[len - 1] == '\r'))
+			line[--len] = '\0';
+		if (len > 0)
+			add_input(list, line);
+	}
+	free(line);
+	if (in != stdin)
+		fclose(in);
+	return true;
+}
+
+/* outdir/<file name without .wav><ext> */
+static char*
+output_name(const char *outdir, const char *filename, const char *ext)
+{
+	const char *base = strrchr(filename, '/');
+	base = base ? base + 1 : filename;
+	size_t len = strlen(base);
+	if (has_wav_suffix(base))
+		len -= 4;
+	char *name = malloc(strlen(outdir) + len + strlen(ext) + 2);
+	assert(name != NULL);
+	sprintf(name, "%s/%.*s%s", outdir, (int) len, base, ext);
+	return name;
+}
+
+struct batch {
+	const struct analysis *an;
+	const struct filelist *inputs;
+	char **outputs;
+	struct filestats *stats;
+	pthread_mutex_t lock;
+	size_t next;          /* next file to analyse */
+	size_t done;
+};
+
+static void*
+batch_worker(void *arg)
+{
+	struct batch *b = arg;
+	while (1) {
+		pthread_mutex_lock(&b->lock);
+		const size_t i = b->next++;
+		pthread_mutex_unlock(&b->lock);
+		if (i >= b->inputs->nb)
+			break;
+
+		struct filestats *st = &b->stats[i];
+		analyse(b->inputs->names[i], b->outputs[i], b->an, st);
+
+		pthread_mutex_lock(&b->lock);
+		const size_t done = ++b->done;
+		pthread_mutex_unlock(&b->lock);
+		fprintf(stderr, "[%zu/%zu] %s: %s, %.1f Mspl/s\n", done,
+			b->inputs->nb, b->inputs->names[i],
+			st->ok ? "done" : "FAILED",
+			st->seconds > 0 ? st->samples / st->seconds / 1e6 : 0);
+	}
+	return NULL;
+}
+
+/* Analyse all the inputs with jobs threads; returns the number of files
+   which failed. */
+static size_t
+run_batch(const struct filelist *inputs, const char *outdir, unsigned jobs,
+	  const struct analysis *an)
+{
+	struct batch b = {
+		.an = an,
+		.inputs = inputs,
+		.outputs = calloc(inputs->nb, sizeof(char*)),
+		.stats = calloc(inputs->nb, sizeof(struct filestats)),
+	};
+	assert(b.outputs != NULL && b.stats != NULL);
+	pthread_mutex_init(&b.lock, NULL);
+
+	const char *ext = an->eventlog ? ".gevl" : ".txt";
+	for (size_t i = 0; i < inputs->nb; i++)
+		b.outputs[i] = output_name(outdir, inputs->names[i], ext);
+	{ /* Two inputs with the same name would overwrite their results */
+		char **sorted = malloc(inputs->nb * sizeof(char*));
+		assert(sorted != NULL);
+		memcpy(sorted, b.outputs, inputs->nb * sizeof(char*));
+		qsort(sorted, inputs->nb, sizeof(char*), &compare_names);
+		for (size_t i = 1; i < inputs->nb; i++) {
+			if (!strcmp(sorted[i - 1], sorted[i])) {
+				fprintf(stderr, "Several input files would be "
+					"written to %s\n", sorted[i]);
+				exit(EXIT_FAILURE);
+			}
+		}
+		free(sorted);
+	}
+
+	if (jobs > inputs->nb)
+		jobs = inputs->nb;
+	const double t0 = now();
+	pthread_t threads[jobs];
+	for (unsigned i = 0; i < jobs; i++) {
+		int err = pthread_create(&threads[i], NULL, &batch_worker, &b);
+		if (err) {
+			fprintf(stderr, "pthread_create failed: %s\n",
+				strerror(err));
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (unsigned i = 0; i < jobs; i++)
+		pthread_join(threads[i], NULL);
+	const double elapsed = now() - t0;
+
+	/* Report, in the order of the inputs */
+	size_t failed = 0;
+	uint64_t samples = 0, events = 0;
+	double duration = 0;
+	const double tau = an->params.geiger_dead_time;
+	const enum deadtime_model model = an->params.dead_time_model;
+	printf("# file\tstatus\tsamples\tduration (s)\tevents\trate (cps)"
+	       "\ttrue rate (cps)\ttime (s)\tMspl/s\n");
+	for (size_t i = 0; i < inputs->nb; i++) {
+		const struct filestats *st = &b.stats[i];
+		const double dur = st->sample_rate
+			? (double) st->samples / st->sample_rate : 0;
+		const double cps = dur > 0 ? st->events / dur : 0;
+		printf("%s\t%s\t%llu\t%.3f\t%llu\t%.3f\t%.3f\t%.3f\t%.1f\n",
+		       inputs->names[i], st->ok ? "ok" : "FAILED",
+		       (unsigned long long) st->samples, dur,
+		       (unsigned long long) st->events, cps,
+		       deadtime_true_rate(cps, tau, model), st->seconds,
+		       st->seconds > 0 ? st->samples / st->seconds / 1e6 : 0);
+		if (!st->ok) {
+			failed++;
+			continue;
+		}
+		samples += st->samples;
+		events += st->events;
+		duration += dur;
+	}
+	printf("# %zu files, %zu failed, %llu samples (%.1f s), %llu events "
+	       "(%.3f cps), %.3f s with %u threads (%.1f Mspl/s)\n",
+	       inputs->nb, failed, (unsigned long long) samples, duration,
+	       (unsigned long long) events,
+	       duration > 0 ? events / duration : 0, elapsed, jobs,
+	       elapsed > 0 ? samples / elapsed / 1e6 : 0);
+
+	pthread_mutex_destroy(&b.lock);
+	for (size_t i = 0; i < inputs->nb; i++)
+		free(b.outputs[i]);
+	free(b.outputs);
+	free(b.stats);
+	return failed;
+}
+
+
 static void
 usage(void)
 {
-	fprintf(stderr, "usage: peakdetector algorithm [inputfile]\n");
-	fprintf(stderr, "\t algorithm can be C1 or PPP\n");
+	fprintf(stderr, "usage: peakdetector [-f Tg ...] [-t T] [-p] "
+		"[-o eventlog] [-j jobs] algorithm [inputfile]\n");
+	fprintf(stderr, "       peakdetector -d outdir [-f Tg ...] [-t T] [-p] "
+		"[-g] [-j jobs] [-L filelist]\n\t\t    algorithm "
+		"[input ...]\n");
+	fprintf(stderr, "\t algorithm can be C1, PPP or PEAK (CPeakDetector of "
+		"geigerwave)\n");
+	fprintf(stderr, "\t -f: filter the input as streamfilter does, "
+		"with a Geiger dead time of\n\t     Tg seconds, before the "
+		"detector (up to %d filters)\n", MAX_FILTERS);
+	fprintf(stderr, "\t -t: drop the events less than T seconds after the "
+		"previous one (the Geiger\n\t     dead time, non-paralyzable "
+		"model)\n");
+	fprintf(stderr, "\t -p: paralyzable model, any event extends the dead "
+		"time (default T: %g s)\n", DEFAULT_DEAD_TIME);
+	fprintf(stderr, "\t -o: write the events to a binary event log "
+		"(- for stdout)\n");
+	fprintf(stderr, "\t -d: batch mode, analyse all the inputs (files, or "
+		"directories of WAV files)\n\t     and write their events to "
+		"outdir\n");
+	fprintf(stderr, "\t -g: in batch mode, write binary event logs\n");
+	fprintf(stderr, "\t -j: number of threads analysing segments of the "
+		"file, or files in\n\t     batch mode (default: 1, number of "
+		"cores in batch mode); a\n\t     multi-channel file is "
+		"analysed by a single thread\n");
+	fprintf(stderr, "\t -L: also analyse the inputs listed in filelist, "
+		"one per line (- for stdin)\n");
 }
 
 int
 main(int argc, char *argv[])
 {
-	/* threshold, Geiger dead time */
-	const struct parameters params = {500, 0.001};
+	/* threshold, Geiger dead time (not applied by default) */
+	struct parameters params = {500, DEFAULT_DEAD_TIME, DEADTIME_NONE};
+
+	char *logname = NULL;
+	char *outdir = NULL;
+	char *listname = NULL;
+	bool eventlog = false;
+	long jobs = 0;
+	unsigned nb_filters = 0;
+	double filters[MAX_FILTERS];
+	{
+		int ch;
+		while ((ch = getopt(argc, argv, "f:t:po:d:gj:L:")) != -1) {
+			switch (ch) {
+			case 'f': {
+				double Tg = strtod(optarg, NULL);
+				if (Tg * 10000 <= 0 || Tg > 1) {
+					fprintf(stderr, "incorrect time "
+						"specification\n");
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				if (nb_filters == MAX_FILTERS) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				filters[nb_filters++] = Tg;
+				break;
+			}
+			case 't':
+				params.geiger_dead_time = strtod(optarg, NULL);
+				if (!(params.geiger_dead_time > 0
+				      && params.geiger_dead_time <= 1)) {
+					fprintf(stderr, "incorrect time "
+						"specification\n");
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				if (params.dead_time_model == DEADTIME_NONE)
+					params.dead_time_model =
+						DEADTIME_NONPARALYZABLE;
+				break;
+			case 'p':
+				params.dead_time_model = DEADTIME_PARALYZABLE;
+				break;
+			case 'o':
+				logname = optarg;
+				break;
+			case 'd':
+				outdir = optarg;
+				break;
+			case 'g':
+				eventlog = true;
+				break;
+			case 'j':
+				jobs = strtol(optarg, NULL, 10);
+				if (jobs <= 0) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'L':
+				listname = optarg;
+				break;
+			default:
+				usage();
+				exit(EXIT_FAILURE);
+			}
+		}
+		argc -= optind;
+		argv += optind;
+
+		const bool batch_options = eventlog || listname;
+		if ((outdir == NULL && batch_options)
+		    || (outdir != NULL && logname != NULL)) {
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
 
 	enum detectors detector;
 	{
-		if (argc < 2) {
+		if (argc < 1 || (outdir == NULL && argc > 2)) {
 			usage();
 			exit(EXIT_FAILURE);
 		}
-		int av1len = strlen(argv[1]);
+		int av0len = strlen(argv[0]);
 
-		if (av1len == 2 && !strncmp(argv[1], "C1", 2)) {
+		if (av0len == 2 && !strncmp(argv[0], "C1", 2)) {
 			detector = C1;
-		} else if (av1len == 3 && !strncmp(argv[1], "PPP", 3)) {
+		} else if (av0len == 3 && !strncmp(argv[0], "PPP", 3)) {
 			detector = PPP;
+		} else if (av0len == 4 && !strncmp(argv[0], "PEAK", 4)) {
+			detector = PEAK;
 		} else {
 			usage();
 			exit(EXIT_FAILURE);
 		}
 	}
 
-	SF_INFO sinfo;
-	SNDFILE* stream = NULL;
-	{
-		char *filename;
-		if (argc < 3)
-			filename = "-";
-		else
-			filename = argv[2];
+	struct analysis an = {
+		.detector = detector,
+		.params = params,
+		.nb_filters = nb_filters,
+	};
+	memcpy(an.filters, filters, nb_filters * sizeof(double));
 
-		stream = openaudiostream(filename, &sinfo);
-		assert(stream != NULL);
+	if (outdir == NULL) {
+		an.eventlog = logname != NULL;
+		an.block_size = STREAM_BLOCK;
+		an.jobs = jobs;
+		an.verbose = true;
+		struct filestats stats;
+		analyse(argc < 2 ? "-" : argv[1], logname, &an, &stats);
+		return stats.ok ? EXIT_SUCCESS : EXIT_FAILURE;
 	}
 
-	struct detector *d;
-	d = detecinit[detector](sinfo.samplerate, &params, &displaycallback);
-	if (d == NULL) {
-		fprintf(stderr, "Detector initialization failed\n");
-		closeaudiostream(stream);
-		return EXIT_FAILURE;
+	struct filelist inputs = { NULL, 0, 0 };
+	for (int i = 1; i < argc; i++)
+		add_input(&inputs, argv[i]);
+	if (listname != NULL && !add_listed_inputs(&inputs, listname))
+		exit(EXIT_FAILURE);
+	if (inputs.nb == 0) {
+		fprintf(stderr, "No input file\n");
+		exit(EXIT_FAILURE);
 	}
-
-	fprintf(stderr, "Using detection algorithm %s\n", d->name);
-	fprintf(stderr, "Sample rate: %d\n", sinfo.samplerate);
-
-	const size_t spl_size = 128;
-	int16_t buffer[spl_size];
-
-	while(1) {
-		int nbfr = sf_readf_short(stream, buffer, spl_size);
-		if (!nbfr)
-			break;
-		d->detector(buffer, nbfr, d->data);
+	if (mkdir(outdir, 0777) && errno != EEXIST) {
+		fprintf(stderr, "Unable to create %s: %s\n", outdir,
+			strerror(errno));
+		exit(EXIT_FAILURE);
 	}
 
-	d->terminate(d);
+	if (jobs == 0) {
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+		if (jobs <= 0)
+			jobs = 1;
+	}
+	an.eventlog = eventlog;
+	an.block_size = BATCH_BLOCK;
+	an.jobs = 1;
+	size_t failed = run_batch(&inputs, outdir, jobs, &an);
 
-	closeaudiostream(stream);
+	for (size_t i = 0; i < inputs.nb; i++)
+		free(inputs.names[i]);
+	free(inputs.names);
 
-	return EXIT_SUCCESS;
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -1,18 +1,85 @@
 #ifndef _PEAKDETECTOR_H_
 #define _PEAKDETECTOR_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* How the Geiger dead time is applied to the events: not at all, or the
+   tube is dead for geiger_dead_time after each event it counts
+   (non-paralyzable), or after each event, even those it misses
+   (paralyzable). */
+enum deadtime_model {
+	DEADTIME_NONE,
+	DEADTIME_NONPARALYZABLE,
+	DEADTIME_PARALYZABLE,
+};
+
+/* Format of the samples given to a detector. The detection threshold and
+   the amplitudes of the events are on the scale of 16-bit samples, whatever
+   the format. */
+enum sample_format {
+	SAMPLE_INT16,
+	SAMPLE_INT8,
+	SAMPLE_INT24,  /* packed little-endian, 3 bytes per sample */
+	SAMPLE_INT32,
+	SAMPLE_FLOAT,  /* full scale at 1.0 */
+};
+
+/* Size of a sample of the format, in bytes */
+static inline size_t
+sample_size(enum sample_format format)
+{
+	static const unsigned char sizes[] = { 2, 1, 3, 4, sizeof(float) };
+	return sizes[format];
+}
+
 struct parameters {
 	unsigned int noise_threshold;  // Detection threshold to filter noise.
 	double geiger_dead_time;       // Geiger dead time (in seconds).
+	enum deadtime_model dead_time_model;
+	enum sample_format sample_format;
+};
+
+/* True count rate, from the rate measured with a dead time (in seconds)
+   applied with the given model. Returns INFINITY if the measured rate
+   cannot be reached with this dead time: the counter is saturated. */
+double deadtime_true_rate(double rate, double dead_time,
+			  enum deadtime_model model);
+
+/* Snapshot of the state of a detector between two calls. The opaque part
+   is up to the detector. */
+struct detectorstate {
+	uint64_t sample_number;        // Samples processed so far.
+	unsigned char opaque[48];
 };
 
 struct detectordata;
 
 struct detector {
 	char *name;
-	int (*detector)(int16_t *sample, size_t sample_size, struct detectordata* data);
+	/* samples of the format given in the parameters */
+	int (*detector)(const void *sample, size_t sample_size, struct detectordata* data);
 	int (*terminate)(struct detector* detector);
+	/* Used to analyse a stream by segments (see segments.h): two detectors
+	   in the same state give the same events for the same samples. */
+	void (*getstate)(const struct detectordata *data, struct detectorstate *state);
+	void (*setstate)(struct detectordata *data, const struct detectorstate *state);
+	bool (*samestate)(const struct detectorstate *a, const struct detectorstate *b);
+	/* First sample an event may still be reported at: the events of the
+	   samples before it have all been passed to the sink. An algorithm
+	   may report a pulse long after its sample (PEAK, at the end of the
+	   pulse). NULL for a detector never used with a channel merge. */
+	uint64_t (*pending)(const struct detectordata *data);
 	struct detectordata *data;
 };
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* !_PEAKDETECTOR_H_ */
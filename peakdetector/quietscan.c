@@ -0,0 +1,335 @@
+/* Geiger counter listener prototype - 2012
+ * by "Cyrus Smith" for "Le Projet Olduva"
+ *
+ * See http://le-projet-olduvai.wikiforum.net/t6044-projet-de-logiciel-pour-compteur-geiger-muller
+ *
+ * This code is under GNU GPLv3.
+ *
+ * Most of a recording is baseline noise, well below the detection threshold.
+ * quietscan() finds the next sample that gets near the threshold, so that the
+ * detectors only run their state machine where something may happen, and
+ * fast-forward over the quiet stretches in between.
+ *
+ * The vectorized versions (SSE2, or AVX2 when built with -mavx2) only look
+ * for blocks containing a candidate sample; the exact position is then found
+ * by the scalar loop, which is the reference behaviour.
+ *
+ * Each sample format has its own kernel, working on the samples as they are:
+ * the 8 and 32-bit ones compare against both level - 1 and 1 - level, the
+ * float one takes the absolute value by clearing the sign bit, and the 24-bit
+ * one first sign-extends 4 samples to 32 bits (with pshufb when built with
+ * SSSE3).
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "quietscan.h"
+
+static size_t
+scan_scalar(const int16_t *in, size_t from, size_t to, int32_t level)
+{
+	for (size_t i = from; i < to; i++) {
+		if (abs(in[i]) >= level)
+			return i;
+	}
+	return to;
+}
+
+size_t
+quietscan(const int16_t *in, size_t size, int32_t level)
+{
+	if (level <= 0)
+		return 0;
+	if (level > -INT16_MIN)
+		return size;
+
+	size_t i = 0;
+
+	/* The SIMD absolute value saturates (abs(-32768) gives 32767), hence
+	   the comparison against level - 1 clamped to 32766: a block is only a
+	   candidate, the scalar loop decides. */
+	const int16_t lim = (int16_t) (level > INT16_MAX ? INT16_MAX - 1
+				       : level - 1);
+#if defined(__AVX2__)
+	const __m256i vlim = _mm256_set1_epi16(lim);
+	const __m256i zero = _mm256_setzero_si256();
+	for (; i + 32 <= size; i += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i *) (in + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *) (in + i + 16));
+		a = _mm256_max_epi16(a, _mm256_subs_epi16(zero, a));
+		b = _mm256_max_epi16(b, _mm256_subs_epi16(zero, b));
+		__m256i hit = _mm256_or_si256(_mm256_cmpgt_epi16(a, vlim),
+					      _mm256_cmpgt_epi16(b, vlim));
+		if (_mm256_movemask_epi8(hit)) {
+			size_t j = scan_scalar(in, i, i + 32, level);
+			if (j < i + 32)
+				return j;
+		}
+	}
+#elif defined(__SSE2__)
+	const __m128i vlim = _mm_set1_epi16(lim);
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 32 <= size; i += 32) {
+		__m128i hit = zero;
+		for (int k = 0; k < 32; k += 8) {
+			__m128i a = _mm_loadu_si128((const __m128i *) (in + i + k));
+			a = _mm_max_epi16(a, _mm_subs_epi16(zero, a));
+			hit = _mm_or_si128(hit, _mm_cmpgt_epi16(a, vlim));
+		}
+		if (_mm_movemask_epi8(hit)) {
+			size_t j = scan_scalar(in, i, i + 32, level);
+			if (j < i + 32)
+				return j;
+		}
+	}
+#else
+	(void) lim;
+#endif
+	return scan_scalar(in, i, size, level);
+}
+
+/* 8-bit */
+
+static size_t
+scan_scalar_int8(const int8_t *in, size_t from, size_t to, int32_t level)
+{
+	for (size_t i = from; i < to; i++) {
+		if (abs(in[i]) >= level)
+			return i;
+	}
+	return to;
+}
+
+size_t
+quietscan_int8(const int8_t *in, size_t size, int32_t level)
+{
+	if (level <= 0)
+		return 0;
+	if (level > -INT8_MIN)
+		return size;
+
+	size_t i = 0;
+#if defined(__AVX2__)
+	const __m256i hi = _mm256_set1_epi8((int8_t) (level - 1));
+	const __m256i lo = _mm256_set1_epi8((int8_t) (1 - level));
+	for (; i + 64 <= size; i += 64) {
+		__m256i a = _mm256_loadu_si256((const __m256i *) (in + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *) (in + i + 32));
+		__m256i hit = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpgt_epi8(a, hi),
+					_mm256_cmpgt_epi8(lo, a)),
+			_mm256_or_si256(_mm256_cmpgt_epi8(b, hi),
+					_mm256_cmpgt_epi8(lo, b)));
+		if (_mm256_movemask_epi8(hit)) {
+			size_t j = scan_scalar_int8(in, i, i + 64, level);
+			if (j < i + 64)
+				return j;
+		}
+	}
+#elif defined(__SSE2__)
+	const __m128i hi = _mm_set1_epi8((int8_t) (level - 1));
+	const __m128i lo = _mm_set1_epi8((int8_t) (1 - level));
+	for (; i + 64 <= size; i += 64) {
+		__m128i hit = _mm_setzero_si128();
+		for (int k = 0; k < 64; k += 16) {
+			__m128i a = _mm_loadu_si128((const __m128i *) (in + i + k));
+			hit = _mm_or_si128(hit, _mm_cmpgt_epi8(a, hi));
+			hit = _mm_or_si128(hit, _mm_cmpgt_epi8(lo, a));
+		}
+		if (_mm_movemask_epi8(hit)) {
+			size_t j = scan_scalar_int8(in, i, i + 64, level);
+			if (j < i + 64)
+				return j;
+		}
+	}
+#endif
+	return scan_scalar_int8(in, i, size, level);
+}
+
+/* 24-bit */
+
+static int32_t
+load_int24(const uint8_t *p)
+{
+	return (int32_t) ((uint32_t) p[0] << 8 | (uint32_t) p[1] << 16
+			  | (uint32_t) p[2] << 24) >> 8;
+}
+
+static size_t
+scan_scalar_int24(const uint8_t *in, size_t from, size_t to, int32_t level)
+{
+	for (size_t i = from; i < to; i++) {
+		if (abs(load_int24(in + 3 * i)) >= level)
+			return i;
+	}
+	return to;
+}
+
+#if defined(__SSE2__)
+/* The samples i..i+3 as 32-bit integers; reads 16 bytes from sample i with
+   SSSE3, 13 bytes otherwise. */
+static __m128i
+load4_int24(const uint8_t *in, size_t i)
+{
+	const uint8_t *p = in + 3 * i;
+#if defined(__SSSE3__)
+	const __m128i spread = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5,
+					     -1, 6, 7, 8, -1, 9, 10, 11);
+	__m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) p),
+				     spread);
+#else
+	int32_t w[4];
+	for (int k = 0; k < 4; k++)
+		memcpy(&w[k], p + 3 * k, sizeof w[k]);
+	__m128i v = _mm_slli_epi32(_mm_loadu_si128((const __m128i *) w), 8);
+#endif
+	return _mm_srai_epi32(v, 8);
+}
+#endif
+
+size_t
+quietscan_int24(const uint8_t *in, size_t size, int32_t level)
+{
+	if (level <= 0)
+		return 0;
+	if (level > 1 << 23)
+		return size;
+
+	size_t i = 0;
+#if defined(__SSE2__)
+	const __m128i hi = _mm_set1_epi32(level - 1);
+	const __m128i lo = _mm_set1_epi32(1 - level);
+	/* 16 samples per block, the last load reading past sample i + 15 */
+	for (; i + 18 <= size; i += 16) {
+		__m128i hit = _mm_setzero_si128();
+		for (int k = 0; k < 16; k += 4) {
+			__m128i a = load4_int24(in, i + k);
+			hit = _mm_or_si128(hit, _mm_cmpgt_epi32(a, hi));
+			hit = _mm_or_si128(hit, _mm_cmpgt_epi32(lo, a));
+		}
+		if (_mm_movemask_epi8(hit)) {
+			size_t j = scan_scalar_int24(in, i, i + 16, level);
+			if (j < i + 16)
+				return j;
+		}
+	}
+#endif
+	return scan_scalar_int24(in, i, size, level);
+}
+
+/* 32-bit */
+
+static size_t
+scan_scalar_int32(const int32_t *in, size_t from, size_t to, int64_t level)
+{
+	for (size_t i = from; i < to; i++) {
+		if (llabs(in[i]) >= level)
+			return i;
+	}
+	return to;
+}
+
+size_t
+quietscan_int32(const int32_t *in, size_t size, int64_t level)
+{
+	if (level <= 0)
+		return 0;
+	if (level > -(int64_t) INT32_MIN)
+		return size;
+
+	size_t i = 0;
+#if defined(__AVX2__)
+	const __m256i hi = _mm256_set1_epi32((int32_t) (level - 1));
+	const __m256i lo = _mm256_set1_epi32((int32_t) (1 - level));
+	for (; i + 16 <= size; i += 16) {
+		__m256i a = _mm256_loadu_si256((const __m256i *) (in + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *) (in + i + 8));
+		__m256i hit = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpgt_epi32(a, hi),
+					_mm256_cmpgt_epi32(lo, a)),
+			_mm256_or_si256(_mm256_cmpgt_epi32(b, hi),
+					_mm256_cmpgt_epi32(lo, b)));
+		if (_mm256_movemask_epi8(hit)) {
+			size_t j = scan_scalar_int32(in, i, i + 16, level);
+			if (j < i + 16)
+				return j;
+		}
+	}
+#elif defined(__SSE2__)
+	const __m128i hi = _mm_set1_epi32((int32_t) (level - 1));
+	const __m128i lo = _mm_set1_epi32((int32_t) (1 - level));
+	for (; i + 16 <= size; i += 16) {
+		__m128i hit = _mm_setzero_si128();
+		for (int k = 0; k < 16; k += 4) {
+			__m128i a = _mm_loadu_si128((const __m128i *) (in + i + k));
+			hit = _mm_or_si128(hit, _mm_cmpgt_epi32(a, hi));
+			hit = _mm_or_si128(hit, _mm_cmpgt_epi32(lo, a));
+		}
+		if (_mm_movemask_epi8(hit)) {
+			size_t j = scan_scalar_int32(in, i, i + 16, level);
+			if (j < i + 16)
+				return j;
+		}
+	}
+#endif
+	return scan_scalar_int32(in, i, size, level);
+}
+
+/* float */
+
+static size_t
+scan_scalar_float(const float *in, size_t from, size_t to, float level)
+{
+	for (size_t i = from; i < to; i++) {
+		if (fabsf(in[i]) >= level)
+			return i;
+	}
+	return to;
+}
+
+size_t
+quietscan_float(const float *in, size_t size, float level)
+{
+	if (!(level > 0))
+		return 0;
+
+	size_t i = 0;
+#if defined(__AVX2__)
+	const __m256 vlevel = _mm256_set1_ps(level);
+	const __m256 sign = _mm256_set1_ps(-0.f);
+	for (; i + 16 <= size; i += 16) {
+		__m256 a = _mm256_andnot_ps(sign, _mm256_loadu_ps(in + i));
+		__m256 b = _mm256_andnot_ps(sign, _mm256_loadu_ps(in + i + 8));
+		__m256 hit = _mm256_or_ps(_mm256_cmp_ps(a, vlevel, _CMP_GE_OQ),
+					  _mm256_cmp_ps(b, vlevel, _CMP_GE_OQ));
+		if (_mm256_movemask_ps(hit)) {
+			size_t j = scan_scalar_float(in, i, i + 16, level);
+			if (j < i + 16)
+				return j;
+		}
+	}
+#elif defined(__SSE2__)
+	const __m128 vlevel = _mm_set1_ps(level);
+	const __m128 sign = _mm_set1_ps(-0.f);
+	for (; i + 16 <= size; i += 16) {
+		__m128 hit = _mm_setzero_ps();
+		for (int k = 0; k < 16; k += 4) {
+			__m128 a = _mm_loadu_ps(in + i + k);
+			a = _mm_andnot_ps(sign, a);
+			hit = _mm_or_ps(hit, _mm_cmpge_ps(a, vlevel));
+		}
+		if (_mm_movemask_ps(hit)) {
+			size_t j = scan_scalar_float(in, i, i + 16, level);
+			if (j < i + 16)
+				return j;
+		}
+	}
+#endif
+	return scan_scalar_float(in, i, size, level);
+}
@@ -0,0 +1,26 @@
+#ifndef _QUIETSCAN_H_
+#define _QUIETSCAN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Return the index of the first sample in[i] such that abs(in[i]) >= level,
+   or size if all the samples are below level. */
+size_t quietscan(const int16_t *in, size_t size, int32_t level);
+
+/* The same for the other sample formats, with level in the unit of the
+   samples. The 24-bit samples are packed little-endian, 3 bytes each. */
+size_t quietscan_int8(const int8_t *in, size_t size, int32_t level);
+size_t quietscan_int24(const uint8_t *in, size_t size, int32_t level);
+size_t quietscan_int32(const int32_t *in, size_t size, int64_t level);
+size_t quietscan_float(const float *in, size_t size, float level);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_QUIETSCAN_H_ */
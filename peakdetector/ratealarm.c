@@ -0,0 +1,157 @@
+/* Geiger counter listener prototype - 2012
+ * by "Cyrus Smith" for "Le Projet Olduva"
+ *
+ * See http://le-projet-olduvai.wikiforum.net/t6044-projet-de-logiciel-pour-compteur-geiger-muller
+ *
+ * This code is under GNU GPLv3.
+ *
+ * Poisson CUSUM alarm on a rise of the count rate, see ratealarm.h.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#include "ratealarm.h"
+
+/* The score is capped at this multiple of the threshold: after a long
+   alarm, it takes about as long to clear it as it took to raise it. */
+#define SCORE_CAP (2)
+
+/* The background rate is measured over this many events at least, and
+   taken 2 standard deviations above the measure: a background rate too low
+   would make false alarms much more frequent than asked. */
+#define LEARN_EVENTS (100)
+
+/* Background rate known: arm the alarm */
+static void
+arm(struct ratealarm *al, double background)
+{
+	al->background = background;
+	al->per_spl = (al->factor - 1) * background / al->sample_rate;
+	al->threshold = log(background * al->false_alarm_time);
+	if (al->threshold < al->log_factor)
+		al->threshold = al->log_factor;
+}
+
+int
+ratealarm_init(struct ratealarm *al, uint32_t sample_rate, double factor,
+	       double false_alarm_time, double background, double learning)
+{
+	assert(al != NULL);
+	memset(al, 0, sizeof *al);
+	if (sample_rate == 0 || !(factor > 1) || !(false_alarm_time > 0)
+	    || !(background >= 0) || (background == 0 && !(learning > 0)))
+		return -1;
+	al->sample_rate = sample_rate;
+	al->factor = factor;
+	al->false_alarm_time = false_alarm_time;
+	al->log_factor = log(factor);
+	if (background > 0)
+		arm(al, background);
+	else
+		al->learn_end = (uint64_t) (learning * sample_rate + 0.5);
+	return 0;
+}
+
+enum ratealarm_change
+ratealarm_event(struct ratealarm *al, uint64_t spl)
+{
+	if (al->background == 0) {
+		if (spl < al->learn_end || al->learn_count < LEARN_EVENTS
+		    || spl == 0) {
+			al->learn_count++;
+			return RATEALARM_NONE;
+		}
+		const double n = al->learn_count;
+		arm(al, (n + 2 * sqrt(n)) * al->sample_rate / spl);
+		al->last_spl = spl;
+	}
+
+	const uint64_t dt = spl > al->last_spl ? spl - al->last_spl : 0;
+	al->last_spl = spl;
+	double score = al->score + al->log_factor - al->per_spl * dt;
+	if (score < 0)
+		score = 0;
+	if (score > SCORE_CAP * al->threshold)
+		score = SCORE_CAP * al->threshold;
+	al->score = score;
+
+	if (!al->raised && score > al->threshold) {
+		al->raised = true;
+		return RATEALARM_RAISED;
+	}
+	if (al->raised && score == 0) {
+		al->raised = false;
+		return RATEALARM_CLEARED;
+	}
+	return RATEALARM_NONE;
+}
+
+
+/* Event sink feeding an alarm */
+
+struct eventsinkdata {
+	struct eventsink *next;
+	struct ratealarm *al;
+	ratealarm_notify notify;
+	void *ctx;
+};
+
+static void
+alarmsink_write(const struct event *ev, size_t nb, struct eventsinkdata *data)
+{
+	for (size_t i = 0; i < nb; i++) {
+		const enum ratealarm_change c = ratealarm_event(data->al,
+								ev[i].spl);
+		if (c != RATEALARM_NONE && data->notify != NULL)
+			data->notify(data->al, c, ev[i].spl, data->ctx);
+	}
+	if (data->next != NULL)
+		data->next->write(ev, nb, data->next->data);
+}
+
+static void
+alarmsink_flush(struct eventsinkdata *data)
+{
+	if (data->next != NULL)
+		data->next->flush(data->next->data);
+}
+
+static int
+terminate_alarmsink(struct eventsink *sink)
+{
+	assert(sink != NULL);
+	assert(sink->data != NULL);
+	int ret = 0;
+	if (sink->data->next != NULL)
+		ret = sink->data->next->terminate(sink->data->next);
+	free(sink->data);
+	free(sink);
+	return ret;
+}
+
+struct eventsink*
+init_alarmsink(struct eventsink *next, struct ratealarm *al,
+	       ratealarm_notify notify, void *ctx)
+{
+	assert(al != NULL);
+	struct eventsink *sink = calloc(1, sizeof(struct eventsink));
+	if (sink == NULL)
+		return NULL;
+	sink->data = calloc(1, sizeof(struct eventsinkdata));
+	if (sink->data == NULL) {
+		free(sink);
+		return NULL;
+	}
+
+	sink->name = "alarm";
+	sink->write = &alarmsink_write;
+	sink->flush = &alarmsink_flush;
+	sink->terminate = &terminate_alarmsink;
+	sink->data->next = next;
+	sink->data->al = al;
+	sink->data->notify = notify;
+	sink->data->ctx = ctx;
+	return sink;
+}
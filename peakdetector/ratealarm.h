@@ -0,0 +1,79 @@
+#ifndef _RATEALARM_H_
+#define _RATEALARM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "eventsink.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Alarm on a rise of the count rate: Poisson CUSUM.
+ *
+ * The count rate is compared to the background rate b: for each event, the
+ * time dt since the previous one gives the log-likelihood ratio of a rate
+ * f.b against b,
+ *	ln(f) - (f - 1) b dt,
+ * summed into a score which never goes below 0. The alarm is raised when
+ * the score goes over a threshold h, and cleared when the score is back to
+ * 0: the rate went back to the background. The cost is O(1) per event.
+ *
+ * Under the background rate, the score goes over h less than once every
+ * exp(h) events on average: h = ln(b T) gives a false alarm less than once
+ * every T seconds. The time to detect a rise to f.b is about
+ *	h / (f.b (ln(f) - 1 + 1/f)) seconds.
+ * Without a given background rate, it is measured on the first seconds of
+ * the stream (and 100 events at least), before the alarm is armed: a
+ * background rate known beforehand is better.
+ */
+
+enum ratealarm_change {
+	RATEALARM_NONE,
+	RATEALARM_RAISED,
+	RATEALARM_CLEARED,
+};
+
+struct ratealarm {
+	uint32_t sample_rate;
+	double factor;           /* rise detected, f */
+	double false_alarm_time; /* T, in seconds */
+	double background;       /* b in events/s, 0 while learning */
+	uint64_t learn_end;      /* end of the measure of b, at least */
+	uint64_t learn_count;
+	double log_factor;       /* ln(f) */
+	double per_spl;          /* (f - 1) b / sample_rate */
+	double threshold;        /* h */
+	double score;
+	uint64_t last_spl;       /* of the last event */
+	bool raised;
+};
+
+/* Alarm on a rise of the rate by factor (> 1), with a false alarm less
+   than once every false_alarm_time seconds. The background rate is given
+   in events/s, or 0 to measure it over the first learning seconds.
+   Returns -1 if a parameter is out of range. */
+int ratealarm_init(struct ratealarm *al, uint32_t sample_rate, double factor,
+		   double false_alarm_time, double background,
+		   double learning);
+
+/* An event at sample spl: returns whether the alarm changed. */
+enum ratealarm_change ratealarm_event(struct ratealarm *al, uint64_t spl);
+
+/* Called with the event which changed the alarm */
+typedef void (*ratealarm_notify)(const struct ratealarm *al,
+				 enum ratealarm_change change, uint64_t spl,
+				 void *ctx);
+
+/* Passes the events to al, and to next (which may be NULL). Terminating
+   the sink also terminates next. */
+struct eventsink* init_alarmsink(struct eventsink *next, struct ratealarm *al,
+				 ratealarm_notify notify, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_RATEALARM_H_ */
@@ -0,0 +1,163 @@
+/* Geiger counter listener prototype - 2012
+ * by "Cyrus Smith" for "Le Projet Olduva"
+ *
+ * See http://le-projet-olduvai.wikiforum.net/t6044-projet-de-logiciel-pour-compteur-geiger-muller
+ *
+ * This code is under GNU GPLv3.
+ *
+ * Count rate over sliding windows, see ratemeter.h.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+
+#include "ratemeter.h"
+
+struct ratemeter {
+	uint32_t sample_rate;
+	uint64_t bin_spl;       /* samples per bin */
+	size_t nb_bins;         /* size of the ring: longest window + 1 */
+	uint64_t bin;           /* current bin, spl / bin_spl */
+	uint64_t total;         /* events so far */
+	uint64_t *start;        /* events before bin b, at b % nb_bins */
+};
+
+struct ratemeter*
+ratemeter_new(uint32_t sample_rate, double bin_width, double max_window)
+{
+	assert(sample_rate > 0);
+	struct ratemeter *rm = calloc(1, sizeof(struct ratemeter));
+	if (rm == NULL)
+		return NULL;
+	rm->sample_rate = sample_rate;
+	rm->bin_spl = (uint64_t) (bin_width * sample_rate + 0.5);
+	if (rm->bin_spl == 0)
+		rm->bin_spl = 1;
+	const double bins = max_window * sample_rate / rm->bin_spl;
+	if (!(bins < SIZE_MAX / sizeof(uint64_t))) {
+		free(rm);
+		return NULL;
+	}
+	rm->nb_bins = (bins > 1 ? (size_t) (bins + 0.5) : 1) + 1;
+	rm->start = calloc(rm->nb_bins, sizeof(uint64_t));
+	if (rm->start == NULL) {
+		free(rm);
+		return NULL;
+	}
+	return rm;
+}
+
+void
+ratemeter_free(struct ratemeter *rm)
+{
+	if (rm == NULL)
+		return;
+	free(rm->start);
+	free(rm);
+}
+
+void
+ratemeter_advance(struct ratemeter *rm, uint64_t spl)
+{
+	const uint64_t bin = spl / rm->bin_spl;
+	if (bin <= rm->bin)
+		return;
+	/* the bins skipped are empty; only the last nb_bins are kept */
+	uint64_t b = bin - rm->bin > rm->nb_bins ? bin - rm->nb_bins + 1
+		: rm->bin + 1;
+	for (; b <= bin; b++)
+		rm->start[b % rm->nb_bins] = rm->total;
+	rm->bin = bin;
+}
+
+void
+ratemeter_add(struct ratemeter *rm, uint64_t spl, uint64_t nb)
+{
+	/* an event late for its bin is counted in the current one */
+	ratemeter_advance(rm, spl);
+	rm->total += nb;
+}
+
+double
+ratemeter_rate(const struct ratemeter *rm, double window, double *seconds)
+{
+	uint64_t k = (uint64_t) (window * rm->sample_rate / rm->bin_spl
+				 + 0.5);
+	if (k > rm->nb_bins - 1)
+		k = rm->nb_bins - 1;
+	if (k > rm->bin)
+		k = rm->bin;
+	const double s = (double) (k * rm->bin_spl) / rm->sample_rate;
+	if (seconds != NULL)
+		*seconds = s;
+	if (k == 0)
+		return 0;
+	const uint64_t nb = rm->start[rm->bin % rm->nb_bins]
+		- rm->start[(rm->bin - k) % rm->nb_bins];
+	return nb / s;
+}
+
+uint64_t
+ratemeter_total(const struct ratemeter *rm)
+{
+	return rm->total;
+}
+
+
+/* Event sink feeding a rate meter */
+
+struct eventsinkdata {
+	struct eventsink *next;
+	struct ratemeter *rm;
+};
+
+static void
+ratesink_write(const struct event *ev, size_t nb, struct eventsinkdata *data)
+{
+	for (size_t i = 0; i < nb; i++)
+		ratemeter_add(data->rm, ev[i].spl, 1);
+	if (data->next != NULL)
+		data->next->write(ev, nb, data->next->data);
+}
+
+static void
+ratesink_flush(struct eventsinkdata *data)
+{
+	if (data->next != NULL)
+		data->next->flush(data->next->data);
+}
+
+static int
+terminate_ratesink(struct eventsink *sink)
+{
+	assert(sink != NULL);
+	assert(sink->data != NULL);
+	int ret = 0;
+	if (sink->data->next != NULL)
+		ret = sink->data->next->terminate(sink->data->next);
+	free(sink->data);
+	free(sink);
+	return ret;
+}
+
+struct eventsink*
+init_ratesink(struct eventsink *next, struct ratemeter *rm)
+{
+	assert(rm != NULL);
+	struct eventsink *sink = calloc(1, sizeof(struct eventsink));
+	if (sink == NULL)
+		return NULL;
+	sink->data = calloc(1, sizeof(struct eventsinkdata));
+	if (sink->data == NULL) {
+		free(sink);
+		return NULL;
+	}
+
+	sink->name = "rate";
+	sink->write = &ratesink_write;
+	sink->flush = &ratesink_flush;
+	sink->terminate = &terminate_ratesink;
+	sink->data->next = next;
+	sink->data->rm = rm;
+	return sink;
+}
@@ -0,0 +1,59 @@
+#ifndef _RATEMETER_H_
+#define _RATEMETER_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "eventsink.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Count rate over sliding windows.
+ *
+ * The time is cut in bins of a fixed number of samples. A ring keeps, for
+ * each of the last bins, the number of events counted before it started:
+ * the events of the last k bins are a single difference, whatever k. Any
+ * window up to the longest one given at creation is thus answered at any
+ * time in O(1), with a memory fixed at creation.
+ *
+ * The rate meter is fed with the events, in order, and with the progress
+ * of the stream: a window only covers complete bins, the current one is
+ * left out until the stream goes past it.
+ */
+
+struct ratemeter;
+
+/* Bins of bin_width seconds (at least one sample), windows up to
+   max_window seconds. Returns NULL if the memory cannot be allocated. */
+struct ratemeter* ratemeter_new(uint32_t sample_rate, double bin_width,
+				double max_window);
+
+void ratemeter_free(struct ratemeter *rm);
+
+/* nb events at sample spl. */
+void ratemeter_add(struct ratemeter *rm, uint64_t spl, uint64_t nb);
+
+/* All the events before sample spl have been added. */
+void ratemeter_advance(struct ratemeter *rm, uint64_t spl);
+
+/* Events per second over the last window seconds, rounded to whole bins.
+   The window is shortened to the time elapsed at the start of the stream,
+   and to max_window; its actual length is written to *seconds (if not
+   NULL). Returns 0 until a bin is complete. */
+double ratemeter_rate(const struct ratemeter *rm, double window,
+		      double *seconds);
+
+/* Events added so far. */
+uint64_t ratemeter_total(const struct ratemeter *rm);
+
+/* Adds the events to rm, and passes them to next (which may be NULL).
+   Terminating the sink also terminates next, not rm. */
+struct eventsink* init_ratesink(struct eventsink *next, struct ratemeter *rm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_RATEMETER_H_ */
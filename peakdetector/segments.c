@@ -0,0 +1,344 @@
+/* Geiger counter listener prototype - 2012
+ * by "Cyrus Smith" for "Le Projet Olduva"
+ *
+ * See http://le-projet-olduvai.wikiforum.net/t6044-projet-de-logiciel-pour-compteur-geiger-muller
+ *
+ * This code is under GNU GPLv3.
+ *
+ * Parallel analysis of a recording by segments, see segments.h.
+ *
+ * The workers take the segments in order, but never more than SEGMENT_AHEAD
+ * per thread in advance of the segments already passed to the sink: the
+ * events waiting to be written stay bounded, whatever the length of the
+ * recording.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "segments.h"
+
+#define SEGMENT_WARMUP (4096)    /* samples analysed before each segment */
+#define SEGMENT_MIN (1 << 20)    /* bounds of the length of the segments */
+#define SEGMENT_MAX (1 << 24)
+#define SEGMENT_PERJOB (4)       /* segments per thread, for the balance */
+#define SEGMENT_AHEAD (2)
+#define SEGMENT_READ (16384)     /* samples passed at once to a detector */
+
+enum segmentstatus {
+	SEGMENT_PENDING,
+	SEGMENT_DONE,
+	SEGMENT_FAILED,
+};
+
+struct segment {
+	uint64_t start;
+	uint64_t end;
+	struct detectorstate start_state; /* after the warm-up */
+	struct detectorstate end_state;
+	struct event *ev;                 /* events of the segment */
+	size_t nb;
+	size_t size;
+	enum segmentstatus status;
+};
+
+
+/* Segment sink: stores the events in the current segment, or drops them
+   during the warm-up. */
+
+struct eventsinkdata {
+	struct segment *seg;
+};
+
+static void
+segsink_write(const struct event *ev, size_t nb, struct eventsinkdata *data)
+{
+	struct segment *seg = data->seg;
+	if (seg == NULL)
+		return;
+	if (seg->nb + nb > seg->size) {
+		seg->size = 2 * seg->size > seg->nb + nb ?
+			2 * seg->size : seg->nb + nb + 1024;
+		seg->ev = realloc(seg->ev, seg->size * sizeof(struct event));
+		assert(seg->ev != NULL);
+	}
+	memcpy(seg->ev + seg->nb, ev, nb * sizeof(struct event));
+	seg->nb += nb;
+}
+
+static void
+segsink_flush(struct eventsinkdata *data)
+{
+}
+
+static int
+terminate_segsink(struct eventsink *sink)
+{
+	assert(sink != NULL);
+	assert(sink->data != NULL);
+	free(sink->data);
+	free(sink);
+	return 0;
+}
+
+static struct eventsink*
+init_segsink(void)
+{
+	struct eventsink *sink = calloc(1, sizeof(struct eventsink));
+	if (sink == NULL)
+		return NULL;
+	sink->data = calloc(1, sizeof(struct eventsinkdata));
+	if (sink->data == NULL) {
+		free(sink);
+		return NULL;
+	}
+
+	sink->name = "segment";
+	sink->write = &segsink_write;
+	sink->flush = &segsink_flush;
+	sink->terminate = &terminate_segsink;
+	return sink;
+}
+
+
+struct segmentrun {
+	const struct segmentsource *src;
+	detector_init init;
+	uint32_t sample_rate;
+	const struct parameters *params;
+	struct segment *segs;
+	size_t nb_segs;
+	unsigned ahead;          /* segments analysed but not yet emitted */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	size_t next;             /* next segment to analyse */
+	size_t emitted;          /* segments already passed to the sink */
+	bool abort;
+};
+
+/* A detector with its sink and reader. */
+struct segmentworker {
+	struct detector *d;
+	struct eventsink *sink;
+	struct segmentreader *reader;
+	struct detectorstate initial; /* state of a new detector */
+};
+
+static void
+worker_free(const struct segmentrun *run, struct segmentworker *w)
+{
+	if (w->d != NULL)
+		w->d->terminate(w->d);
+	if (w->sink != NULL)
+		w->sink->terminate(w->sink);
+	if (w->reader != NULL)
+		run->src->close(w->reader);
+}
+
+static bool
+worker_init(const struct segmentrun *run, struct segmentworker *w)
+{
+	memset(w, 0, sizeof *w);
+	w->sink = init_segsink();
+	if (w->sink != NULL)
+		w->d = run->init(run->sample_rate, run->params, w->sink);
+	if (w->d != NULL)
+		w->reader = run->src->open(run->src->data);
+	if (w->reader == NULL) {
+		worker_free(run, w);
+		return false;
+	}
+	w->d->getstate(w->d->data, &w->initial);
+	return true;
+}
+
+/* Pass the samples [from, to) to the detector. */
+static bool
+feed(const struct segmentrun *run, struct segmentworker *w, uint64_t from,
+     uint64_t to)
+{
+	while (from < to) {
+		const void *samples;
+		const size_t want = to - from < SEGMENT_READ ?
+			to - from : SEGMENT_READ;
+		const size_t nb = run->src->read(w->reader, from, want,
+						 &samples);
+		if (nb == 0)
+			return false;
+		w->d->detector(samples, nb, w->d->data);
+		from += nb;
+	}
+	return true;
+}
+
+/* Analyse a segment from a given state. */
+static bool
+analyse_from(const struct segmentrun *run, struct segmentworker *w,
+	     struct segment *seg, const struct detectorstate *state)
+{
+	w->d->setstate(w->d->data, state);
+	seg->nb = 0;
+	w->sink->data->seg = seg;
+	const bool ok = feed(run, w, seg->start, seg->end);
+	w->sink->data->seg = NULL;
+	w->d->getstate(w->d->data, &seg->end_state);
+	return ok;
+}
+
+/* Analyse a segment after a warm-up from a new detector. */
+static bool
+analyse_segment(const struct segmentrun *run, struct segmentworker *w,
+		struct segment *seg)
+{
+	struct detectorstate state = w->initial;
+	state.sample_number = seg->start > SEGMENT_WARMUP ?
+		seg->start - SEGMENT_WARMUP : 0;
+	w->d->setstate(w->d->data, &state);
+	if (!feed(run, w, state.sample_number, seg->start))
+		return false;
+	w->d->getstate(w->d->data, &seg->start_state);
+	return analyse_from(run, w, seg, &seg->start_state);
+}
+
+static void*
+segment_thread(void *arg)
+{
+	struct segmentrun *run = arg;
+	struct segmentworker w;
+	const bool ok = worker_init(run, &w);
+
+	pthread_mutex_lock(&run->lock);
+	if (!ok) {
+		run->abort = true;
+		pthread_cond_broadcast(&run->cond);
+	}
+	while (ok) {
+		while (!run->abort && run->next < run->nb_segs
+		       && run->next >= run->emitted + run->ahead)
+			pthread_cond_wait(&run->cond, &run->lock);
+		if (run->abort || run->next >= run->nb_segs)
+			break;
+		struct segment *seg = &run->segs[run->next++];
+		pthread_mutex_unlock(&run->lock);
+
+		const bool done = analyse_segment(run, &w, seg);
+
+		pthread_mutex_lock(&run->lock);
+		seg->status = done ? SEGMENT_DONE : SEGMENT_FAILED;
+		pthread_cond_broadcast(&run->cond);
+	}
+	pthread_mutex_unlock(&run->lock);
+
+	if (ok)
+		worker_free(run, &w);
+	return NULL;
+}
+
+int
+analyse_segments(const struct segmentsource *src, detector_init init,
+		 uint32_t sample_rate, const struct parameters *params,
+		 struct eventsink *sink, unsigned jobs,
+		 struct segmentstats *stats)
+{
+	assert(src != NULL);
+	assert(sink != NULL);
+	if (jobs == 0)
+		jobs = 1;
+
+	uint64_t len = src->nb_samples / (SEGMENT_PERJOB * jobs);
+	if (len < SEGMENT_MIN)
+		len = SEGMENT_MIN;
+	if (len > SEGMENT_MAX)
+		len = SEGMENT_MAX;
+
+	struct segmentrun run = {
+		.src = src,
+		.init = init,
+		.sample_rate = sample_rate,
+		.params = params,
+		.nb_segs = (src->nb_samples + len - 1) / len,
+		.ahead = SEGMENT_AHEAD * jobs,
+	};
+	run.segs = calloc(run.nb_segs ? run.nb_segs : 1,
+			  sizeof(struct segment));
+	assert(run.segs != NULL);
+	for (size_t k = 0; k < run.nb_segs; k++) {
+		run.segs[k].start = k * len;
+		run.segs[k].end = (k + 1) * len < src->nb_samples ?
+			(k + 1) * len : src->nb_samples;
+	}
+	if (stats != NULL) {
+		stats->segments = run.nb_segs;
+		stats->reruns = 0;
+	}
+
+	/* The main thread passes the events to the sink, and analyses again
+	   the segments whose warm-up was not enough. */
+	struct segmentworker w;
+	if (!worker_init(&run, &w)) {
+		free(run.segs);
+		return -1;
+	}
+
+	pthread_mutex_init(&run.lock, NULL);
+	pthread_cond_init(&run.cond, NULL);
+	if (jobs > run.nb_segs)
+		jobs = run.nb_segs;
+	pthread_t threads[jobs ? jobs : 1];
+	for (unsigned i = 0; i < jobs; i++) {
+		int err = pthread_create(&threads[i], NULL, &segment_thread,
+					 &run);
+		assert(err == 0);
+	}
+
+	int ret = 0;
+	for (size_t k = 0; k < run.nb_segs; k++) {
+		struct segment *seg = &run.segs[k];
+		pthread_mutex_lock(&run.lock);
+		while (seg->status == SEGMENT_PENDING && !run.abort)
+			pthread_cond_wait(&run.cond, &run.lock);
+		const enum segmentstatus status = seg->status;
+		pthread_mutex_unlock(&run.lock);
+		if (status != SEGMENT_DONE) {
+			ret = -1;
+			break;
+		}
+
+		if (k > 0 && !w.d->samestate(&run.segs[k - 1].end_state,
+					     &seg->start_state)) {
+			if (!analyse_from(&run, &w, seg,
+					  &run.segs[k - 1].end_state)) {
+				ret = -1;
+				break;
+			}
+			if (stats != NULL)
+				stats->reruns++;
+		}
+		if (seg->nb)
+			sink->write(seg->ev, seg->nb, sink->data);
+		free(seg->ev);
+		seg->ev = NULL;
+
+		pthread_mutex_lock(&run.lock);
+		run.emitted = k + 1;
+		pthread_cond_broadcast(&run.cond);
+		pthread_mutex_unlock(&run.lock);
+	}
+
+	pthread_mutex_lock(&run.lock);
+	run.abort = true;
+	pthread_cond_broadcast(&run.cond);
+	pthread_mutex_unlock(&run.lock);
+	for (unsigned i = 0; i < jobs; i++)
+		pthread_join(threads[i], NULL);
+
+	worker_free(&run, &w);
+	for (size_t k = 0; k < run.nb_segs; k++)
+		free(run.segs[k].ev);
+	free(run.segs);
+	pthread_cond_destroy(&run.cond);
+	pthread_mutex_destroy(&run.lock);
+	return ret;
+}
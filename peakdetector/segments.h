@@ -0,0 +1,61 @@
+#ifndef _SEGMENTS_H_
+#define _SEGMENTS_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "eventsink.h"
+#include "peakdetector.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Parallel analysis of a recording by segments.
+ *
+ * The recording is cut in segments, analysed in parallel by separate
+ * detectors. Each detector first processes a few samples before its segment
+ * (the warm-up), without keeping their events, to rebuild the state it would
+ * have there in a sequential run. The segments are then stitched in order:
+ * if the state at the start of a segment is not the one at the end of the
+ * previous segment, the segment is analysed again from the right state. The
+ * events are thus exactly those of a sequential run.
+ */
+
+struct segmentsourcedata;
+struct segmentreader;
+
+/* Random access to the samples; each thread opens its own reader. */
+struct segmentsource {
+	uint64_t nb_samples;
+	struct segmentreader* (*open)(struct segmentsourcedata *data);
+	/* Make *samples point to at most nb samples, starting at sample spl,
+	   in the format of the parameters given to the detectors. Returns the
+	   number of samples, 0 on error. */
+	size_t (*read)(struct segmentreader *reader, uint64_t spl, size_t nb,
+		       const void **samples);
+	void (*close)(struct segmentreader *reader);
+	struct segmentsourcedata *data;
+};
+
+typedef struct detector* (*detector_init)(uint32_t sample_rate,
+					  const struct parameters *params,
+					  struct eventsink *sink);
+
+struct segmentstats {
+	size_t segments;
+	size_t reruns;    /* segments analysed again after the warm-up failed */
+};
+
+/* Analyse the whole source with jobs threads, passing the events in order
+   to sink. Returns 0, or -1 if the source could not be read. */
+int analyse_segments(const struct segmentsource *src, detector_init init,
+		     uint32_t sample_rate, const struct parameters *params,
+		     struct eventsink *sink, unsigned jobs,
+		     struct segmentstats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_SEGMENTS_H_ */
@@ -14,10 +14,16 @@
  *  2) Given the Geiger dead time Tg, for each time interval of size Tg/2
  *    take the max of data[i] on this interval.
  *  3) output the stream of these maxima as the output stream.
+ * (see decimate.c)
  *
  * Use it for instance with SoX [1] and a detector program:
  *    $ sox -d -t wav -c 1 - | streamfilter | peakdetector
- * to analyse the audio stream from the soundcard.
+ * to analyse the audio stream from the soundcard. The same filter can also
+ * run inside peakdetector, without the second WAV encoding and the pipe:
+ *    $ sox -d -t wav -c 1 - | peakdetector -f Tg PPP
+ *
+ * Each channel of a multi-channel stream is filtered on its own, and the
+ * output has the same channels.
  *
  * [1]: SoX: http://sox.sourceforge.net/
  *
@@ -35,6 +41,12 @@
 
 #include <sndfile.h>
 
+#include "channels.h"
+#include "decimate.h"
+
+/* Frames read at once: the decimation runs on whole blocks */
+#define STREAMFILTER_BLOCK (16384)
+
 static void
 closeaudiostream(SNDFILE* stream)
 {
@@ -65,9 +77,10 @@ openaudiostream(const char* filename, SF_INFO *sinfo, bool in)
 	if (!in)
 		return stream;
 
-	if (sinfo->channels != 1) {
+	if (sinfo->channels < 1 || sinfo->channels > MAX_CHANNELS) {
 		fprintf(stderr, "Don't know how to process stream with %d "
-			"channels\n", sinfo->channels);
+			"channels (at most %d)\n", sinfo->channels,
+			MAX_CHANNELS);
 		closeaudiostream(stream);
 		exit(EXIT_FAILURE);
 
@@ -75,88 +88,9 @@ openaudiostream(const char* filename, SF_INFO *sinfo, bool in)
 	return stream;
 }
 
-struct intdata {
-	int16_t cmax;
-	int16_t cmin;
-	int16_t nbpoints;
-};
-
 uint32_t totala = 0;
 uint32_t totalb = 0;
 
-
-static uint32_t
-process(uint32_t samplerate, double Tg,
-	int16_t *inbuffer, size_t inbuffersize,
-	int16_t *outbuffer, size_t outbuffersize, struct intdata *inprog)
-{
-	bool unfinishedbusiness = false;
-	const double Tg2 = Tg/2;
-
-	const uint32_t nb_points_inter = Tg2 * samplerate;
-	assert(nb_points_inter > 0);
-
-//	fprintf(stderr, "nb_points_inter: %u\n", nb_points_inter);
-
-	assert(inprog->nbpoints < nb_points_inter);
-
-	const uint32_t extra_points = inprog->nbpoints;
-	const uint32_t nb_points = inbuffersize + extra_points;
-	uint32_t nb_inter = nb_points / nb_points_inter;
-
-	assert(nb_inter > 0);
-	assert(nb_points >= nb_inter * nb_points_inter);
-
-	assert(nb_inter <= outbuffersize);
-
-	uint32_t nb_points_last = nb_points - nb_inter * nb_points_inter;
-	if (nb_points_last) {
-		nb_inter++;
-		unfinishedbusiness = true;
-	}
-
-
-
-	memset(outbuffer, 0, outbuffersize);
-	const uint32_t shift = inprog->nbpoints;
-	for (unsigned int j = 0; j < nb_inter; j++) { // for each interval
-		assert(j < outbuffersize);
-		int16_t cmax = 0;
-		unsigned int bmin = 0;
-		if (!j) {
-			bmin = inprog->nbpoints;
-			cmax = inprog->cmax;
-		}
-		unsigned int bmax = nb_points_inter;
-		if (j == nb_inter - 1 && unfinishedbusiness) {
-			bmax = nb_points_last;
-		}
-		for (unsigned int i = bmin; i < bmax; i++) {
-			// for each point in interval
-			totalb++;
-			const uint32_t inidx = j * nb_points_inter + i - shift;
-			assert(inidx < inbuffersize);
-			const int16_t inval = abs(inbuffer[inidx]);
-			if (inval > cmax) {
-				cmax = inval;
-			}
-		}
-		if (j == nb_inter - 1 && unfinishedbusiness) {
-			inprog->cmax = cmax;
-			inprog->nbpoints = nb_points_last;
-		} else {
-			outbuffer[j] = cmax;
-		}
-	}
-	if (unfinishedbusiness) {
-		assert((nb_inter - 1) * nb_points_inter
-		       == inbuffersize + extra_points - inprog->nbpoints);
-		return nb_inter - 1;
-	}
-	assert(nb_inter * nb_points_inter == inbuffersize + extra_points);
-	return nb_inter;
-}
-
 static void
 usage(void)
 {
@@ -196,49 +130,68 @@ main(int argc, char *argv[])
 		assert(instream != NULL);
 	}
 
+	const unsigned nch = insinfo.channels;
+	struct decimator dec[MAX_CHANNELS];
+	if (decimator_init(&dec[0], insinfo.samplerate, Tg)) {
+		fprintf(stderr, "Geiger dead time shorter than two samples\n");
+		closeaudiostream(instream);
+		exit(EXIT_FAILURE);
+	}
+	for (unsigned c = 1; c < nch; c++)
+		dec[c] = dec[0];
+
 	SF_INFO outsinfo;
 	SNDFILE* outstream = NULL;
 	{
 		char *filename;
-		if (argc < 3)
+		if (argc < 4)
 			filename = "-";
 		else
 			filename = argv[3];
 
 		memset(&outsinfo, 0, sizeof outsinfo);
-		uint32_t tmp = Tg/2 * insinfo.samplerate;
-		outsinfo.samplerate = insinfo.samplerate / tmp;
+		outsinfo.samplerate = decimator_rate(&dec[0],
+						     insinfo.samplerate);
 		fprintf(stderr, "samplerate: %d\n", outsinfo.samplerate);
-		outsinfo.channels = 1;
+		outsinfo.channels = nch;
 		outsinfo.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
 
 		outstream = openaudiostream(filename, &outsinfo, false);
 		assert(outstream != NULL);
 	}
 
-	const size_t inspl_size = 128;
-	int16_t inbuffer[inspl_size];
-
-	const size_t outbufsize = 128;
-	int16_t outbuffer[outbufsize];
-
-	struct intdata tmpdat = {0, 0};
+	/* The frames, and the samples of each channel */
+	static int16_t buffer[MAX_CHANNELS * STREAMFILTER_BLOCK];
+	static int16_t planes[MAX_CHANNELS][STREAMFILTER_BLOCK];
+	int16_t *chbuf[MAX_CHANNELS];
+	for (unsigned c = 0; c < nch; c++)
+		chbuf[c] = planes[c];
 
 	while(1) {
-		int nbfr = sf_readf_short(instream, inbuffer, inspl_size);
+		int nbfr = sf_readf_short(instream, buffer, STREAMFILTER_BLOCK);
 		totala += nbfr;
 		if (!nbfr)
 			break;
 
-		uint32_t actualoutbufsize = process(insinfo.samplerate, Tg,
-						    inbuffer, nbfr,
-						    outbuffer, outbufsize,
-						    &tmpdat);
+		/* decimated in place; all the channels give the same number
+		   of samples */
+		size_t nbout = 0;
+		if (nch == 1) {
+			nbout = decimate(&dec[0], buffer, nbfr, buffer);
+		} else {
+			deinterleave(buffer, nbfr, nch, chbuf);
+			for (unsigned c = 0; c < nch; c++)
+				nbout = decimate(&dec[c], chbuf[c], nbfr,
+						 chbuf[c]);
+			interleave((const int16_t *const *) chbuf, nbout, nch,
+				   buffer);
+		}
+		totalb += nbout;
 
-		sf_writef_short(outstream, outbuffer, actualoutbufsize);
+		sf_writef_short(outstream, buffer, nbout);
 	}
 
-	fprintf(stderr, "total pts: a: %u, b: %u\n", totala, totalb);
+	fprintf(stderr, "total pts: in: %u, out: %u\n", totala, totalb);
 
 	closeaudiostream(instream);
 	closeaudiostream(outstream);